@@ -2,6 +2,7 @@
 #include <string.h>
 #include <limits>
 #include <type_traits>
+#include <vector>
 #include <glib.h>
 #include <gst/gst.h>
 #include "AudioConverter.h"
@@ -18,6 +19,9 @@
 
 namespace
 {
+  // GStreamer's limit for channel positions
+  const int MAX_DOWNMIX_CHANNELS = 64;
+
   struct tUInt24
   {
     guint8 a;
@@ -32,41 +36,6 @@ namespace
     guint8 c;
   };
 
-  template<typename T, int channels = 0>
-  class SampleReader
-  {
-    public:
-      inline static const T *readSampleFrame (const T *p, T &left, T &right, int numChannels)
-      {
-        left = *(p++);
-        right = *(p++);
-        return p + sizeof (T) * (numChannels - 2);
-      }
-  };
-
-  template<typename T>
-  class SampleReader<T, 1>
-  {
-    public:
-      inline static const T *readSampleFrame (const T *p, T &left, T &right, int numChannels)
-      {
-        left = right = *(p++);
-        return p;
-      }
-  };
-
-  template<typename T>
-  class SampleReader<T, 2>
-  {
-    public:
-      inline static const T *readSampleFrame (const T *p, T &left, T &right, int numChannels)
-      {
-        left = *(p++);
-        right = *(p++);
-        return p;
-      }
-  };
-
   inline guint8 toLittleEndian (guint8 in)
   {
     return in;
@@ -120,6 +89,11 @@ namespace
     return in;
   }
 
+  inline gdouble toLittleEndian (gdouble in)
+  {
+    return in;
+  }
+
   template<typename tIn>
   typename std::make_signed<tIn>::type makeSigned (tIn in)
   {
@@ -188,6 +162,12 @@ namespace
     return makeSample (i);
   }
 
+  inline tSample makeSample (gdouble v)
+  {
+    gint32 i = v * (G_MAXINT32 - (1 << (32 - 8 * sizeof (tSample)) / 2));
+    return makeSample (i);
+  }
+
   template<typename T>
   inline T shiftLeft (T v, int s)
   {
@@ -199,6 +179,11 @@ namespace
     return f;
   }
 
+  inline double shiftLeft (double f, int s)
+  {
+    return f;
+  }
+
   inline tInt24 shiftLeft (tInt24 f, int s)
   {
     return f;
@@ -210,7 +195,41 @@ namespace
   }
 }
 
-AudioConverter::AudioConverter (GstCaps *srcCaps)
+AudioConverter::AudioConverter (GstCaps *srcCaps, int outChannels) :
+    outChannels (isSupportedChannelCount (outChannels) ? outChannels : 2),
+    currentCaps (NULL),
+    kernel (NULL)
+{
+  setCaps (srcCaps);
+}
+
+AudioConverter::~AudioConverter ()
+{
+  if (currentCaps)
+    gst_caps_unref (currentCaps);
+}
+
+bool AudioConverter::setCaps (GstCaps *srcCaps)
+{
+  // called for every buffer, the caps object usually stays the same
+  if (srcCaps == currentCaps || (currentCaps && gst_caps_is_equal (srcCaps, currentCaps)))
+    return false;
+
+  if (currentCaps)
+    gst_caps_unref (currentCaps);
+
+  currentCaps = gst_caps_ref (srcCaps);
+
+  parseCaps (srcCaps);
+  kernel = isPassthrough () ? NULL : selectKernel ();
+
+  if (!kernel && !isPassthrough ())
+    g_print ("AudioConverter: cannot convert from this format, dropping the audio\n");
+
+  return true;
+}
+
+void AudioConverter::parseCaps (GstCaps *srcCaps)
 {
   srcIsBigEndian = FALSE;
   srcIsFloat = FALSE;
@@ -229,8 +248,13 @@ AudioConverter::AudioConverter (GstCaps *srcCaps)
   {
     gst_structure_get_int (s, "channels", &srcChannels);
 
-    if (srcChannels > 2)
-      srcChannels = 2;
+    guint64 channelMask = 0;
+
+    if (gst_structure_has_field (s, "channel-mask"))
+      gst_structure_get (s, "channel-mask", GST_TYPE_BITMASK, &channelMask, NULL);
+
+    if (downmix.build (channelMask, srcChannels, outChannels))
+      g_print ("AudioConverter: downmixing with channel-mask 0x%" G_GINT64_MODIFIER "x\n", channelMask);
 
     const gchar *format = gst_structure_get_string (s, "format");
     if (format)
@@ -271,23 +295,93 @@ AudioConverter::AudioConverter (GstCaps *srcCaps)
     }
   }
 
-  g_print ("AudioConverter: %s %s %d %d\n",
+  g_print ("AudioConverter: %s %s %d %d, %d to %d channels\n",
            srcIsBigEndian ? "BE" : "LE",
            srcIsFloat ? "float" : (srcIsSigned ? "signed" : "unsigned"),
-           srcDepth, srcWidth);
+           srcDepth, srcWidth, srcChannels, outChannels);
 }
 
-GstBuffer *AudioConverter::eat (GstBuffer *inBuffer)
+int AudioConverter::getOutChannels () const
+{
+  return outChannels;
+}
+
+bool AudioConverter::isPassthrough () const
 {
   const int outSampleWidth = sizeof (tSample) * 8;
   const int outSampleDepth = BITDEPTH;
 
-  if (!srcIsBigEndian && !srcIsFloat &&
-      srcIsSigned && srcWidth == outSampleWidth &&
-      srcDepth == outSampleDepth && srcChannels == 2)
+  return !srcIsBigEndian && !srcIsFloat &&
+         srcIsSigned && srcWidth == outSampleWidth &&
+         srcDepth == outSampleDepth && srcChannels == outChannels;
+}
+
+AudioConverter::tKernel AudioConverter::selectKernel () const
+{
+  if (srcIsFloat)
+  {
+    switch (srcWidth)
+    {
+    case 32:
+      return selectKernel<gfloat> ();
+
+    case 64:
+      return selectKernel<gdouble> ();
+    }
+
+    return NULL;
+  }
+
+  if (srcIsSigned)
+  {
+    switch (srcWidth)
+    {
+    case 8:
+      return selectKernel<gint8> ();
+
+    case 16:
+      return selectKernel<gint16> ();
+
+    case 24:
+      return selectKernel<tInt24> ();
+
+    case 32:
+      return selectKernel<gint32> ();
+    }
+  }
+  else
+  {
+    switch (srcWidth)
+    {
+    case 8:
+      return selectKernel<guint8> ();
+
+    case 16:
+      return selectKernel<guint16> ();
+
+    case 24:
+      return selectKernel<tUInt24> ();
+
+    case 32:
+      return selectKernel<guint32> ();
+    }
+  }
+
+  return NULL;
+}
+
+GstBuffer *AudioConverter::eat (GstBuffer *inBuffer)
+{
+  if (!kernel)
   {
-    gst_buffer_ref (inBuffer);
-    return inBuffer;
+    // either nothing to do, or nothing we can do
+    if (isPassthrough ())
+    {
+      gst_buffer_ref (inBuffer);
+      return inBuffer;
+    }
+
+    return gst_buffer_new ();
   }
 
   const int bytesPerSample = srcWidth / 8;
@@ -298,7 +392,7 @@ GstBuffer *AudioConverter::eat (GstBuffer *inBuffer)
   }
 
   const int numInSampleFrames = gst_buffer_get_size (inBuffer) / bytesPerSample / srcChannels;
-  const int neededSize = 2 * sizeof (tSample) * numInSampleFrames;
+  const int neededSize = outChannels * sizeof (tSample) * numInSampleFrames;
 
   GstBuffer *outBuffer = gst_buffer_new_allocate (NULL, neededSize, NULL);
 
@@ -308,106 +402,151 @@ GstBuffer *AudioConverter::eat (GstBuffer *inBuffer)
   if (gst_buffer_map (inBuffer, &in, GST_MAP_READ) &&
       gst_buffer_map (outBuffer, &out, GST_MAP_WRITE))
   {
-    tSample *dest = (tSample*) out.data;
+    (this->*kernel) ((tSample*) out.data, in.data, numInSampleFrames);
 
-    if (srcIsFloat)
-    {
-      doLoop (dest, (const gfloat*) in.data, numInSampleFrames);
-    }
-    else if (srcIsSigned)
-    {
-      switch (srcWidth)
-      {
-      case 8:
-        doLoop (dest, (const gint8*) in.data, numInSampleFrames);
-        break;
+    gst_buffer_unmap (outBuffer, &out);
+    gst_buffer_unmap (inBuffer, &in);
+  }
 
-      case 16:
-        doLoop (dest, (const gint16*) in.data, numInSampleFrames);
-        break;
+  return outBuffer;
+}
 
-      case 24:
-        doLoop (dest, (const tInt24*) in.data, numInSampleFrames);
-        break;
 
-      case 32:
-        doLoop (dest, (const gint32*) in.data, numInSampleFrames);
-        break;
-      }
-    }
-    else // !srcIsSigned)
-    {
-      switch (srcWidth)
-      {
-      case 8:
-        doLoop (dest, (const guint8*) in.data, numInSampleFrames);
-        break;
+template<typename T, bool bigEndian, bool padded>
+inline tSample AudioConverter::convertSample (T sample) const
+{
+  if (bigEndian)
+    sample = toLittleEndian (sample);
 
-      case 16:
-        doLoop (dest, (const guint16*) in.data, numInSampleFrames);
-        break;
+  if (padded)
+    sample = shiftLeft (sample, srcWidth - srcDepth);
 
-      case 24:
-        doLoop (dest, (const tUInt24*) in.data, numInSampleFrames);
-        break;
+  return makeSample (sample);
+}
 
-      case 32:
-        doLoop (dest, (const guint32*) in.data, numInSampleFrames);
-        break;
-      }
+template<typename T, bool bigEndian, bool padded, int inChannels, int outChannels>
+void AudioConverter::doDownmix (tSample* __restrict__ out, const void* __restrict__ data, size_t numFrames)
+{
+  const T* __restrict__ src = (const T*) data;
+
+  // 0 if the source layout has no instance of its own
+  const int srcStep = inChannels ? inChannels : srcChannels;
+  const float* __restrict__ matrix = downmix.getCoefficients ();
+
+  // with constant channel counts both loops are unrolled and the products vectorized
+  float frame[inChannels ? inChannels : MAX_DOWNMIX_CHANNELS];
+
+  while (numFrames--)
+  {
+    for (int c = 0; c < srcStep; c++)
+      frame[c] = convertSample<T, bigEndian, padded> (src[c]);
+
+    for (int o = 0; o < outChannels; o++)
+    {
+      float sum = 0;
+
+      for (int c = 0; c < srcStep; c++)
+        sum += matrix[o * srcStep + c] * frame[c];
+
+      // clamp and round without a call into libm
+      sum = CLAMP (sum, (float) MINVALUE, (float) MAXVALUE);
+      out[o] = sum + (sum < 0 ? -0.5f : 0.5f);
     }
 
-    gst_buffer_unmap (outBuffer, &out);
-    gst_buffer_unmap (inBuffer, &in);
+    src += srcStep;
+    out += outChannels;
   }
-
-  return outBuffer;
 }
 
+template<typename T, bool bigEndian, bool padded, int outChannels>
+AudioConverter::tKernel AudioConverter::selectDownmix () const
+{
+  switch (srcChannels)
+  {
+    case 6:
+      return &AudioConverter::doDownmix<T, bigEndian, padded, 6, outChannels>;
+
+    case 8:
+      return &AudioConverter::doDownmix<T, bigEndian, padded, 8, outChannels>;
 
-template<typename T, typename tFrameReader>
-void AudioConverter::doLoop (tSample* __restrict__ out, const T* __restrict__ src, size_t numFrames)
+    default:
+      return &AudioConverter::doDownmix<T, bigEndian, padded, 0, outChannels>;
+  }
+}
+
+template<typename T, bool bigEndian, bool padded, int inChannels, int outChannels>
+void AudioConverter::doLoop (tSample* __restrict__ out, const void* __restrict__ data, size_t numFrames)
 {
-  T left;
-  T right;
+  const T* __restrict__ src = (const T*) data;
 
-  const bool convertEndianess = srcIsBigEndian;
-  const int paddingShiftAmount = srcIsFloat ? 0 : srcWidth - srcDepth;
+  // 0 if the source layout has no instance of its own
+  const int srcStep = inChannels ? inChannels : srcChannels;
 
   while (numFrames--)
   {
-    src = tFrameReader::readSampleFrame (src, left, right, srcChannels);
-
-    if (convertEndianess)
+    for (int c = 0; c < outChannels; c++)
     {
-      left = toLittleEndian (left);
-      right = toLittleEndian (right);
+      // mono goes to both front channels
+      int from = (srcStep == 1 && c == 1) ? 0 : c;
+      out[c] = from < srcStep ? convertSample<T, bigEndian, padded> (src[from]) : 0;
     }
 
-    if (paddingShiftAmount)
-    {
-      left = shiftLeft (left, paddingShiftAmount);
-      right = shiftLeft (right, paddingShiftAmount);
-    }
+    src += srcStep;
+    out += outChannels;
+  }
+}
+
+template<typename T, bool bigEndian, bool padded, int outChannels>
+AudioConverter::tKernel AudioConverter::selectLoop () const
+{
+  if (srcChannels == outChannels)
+    return &AudioConverter::doLoop<T, bigEndian, padded, outChannels, outChannels>;
+
+  switch (srcChannels)
+  {
+    case 1:
+      return &AudioConverter::doLoop<T, bigEndian, padded, 1, outChannels>;
+
+    case 2:
+      return &AudioConverter::doLoop<T, bigEndian, padded, 2, outChannels>;
 
-    *(out++) = makeSample (left);
-    *(out++) = makeSample (right);
+    default:
+      return &AudioConverter::doLoop<T, bigEndian, padded, 0, outChannels>;
   }
 }
 
 template<typename T>
-void AudioConverter::doLoop (tSample* __restrict__ out, const T* __restrict__ src, size_t numFrames)
+AudioConverter::tKernel AudioConverter::selectKernel () const
+{
+  // decided once per caps, so the inner loops carry neither test
+  bool bigEndian = srcIsBigEndian && sizeof (T) > 1;
+  bool padded = !srcIsFloat && srcWidth != srcDepth;
+
+  if (bigEndian)
+    return padded ? selectKernel<T, true, true> () : selectKernel<T, true, false> ();
+
+  return padded ? selectKernel<T, false, true> () : selectKernel<T, false, false> ();
+}
+
+template<typename T, bool bigEndian, bool padded>
+AudioConverter::tKernel AudioConverter::selectKernel () const
 {
-  switch(srcChannels)
+  if (downmix.isValid ())
+    return outChannels == 1 ? selectDownmix<T, bigEndian, padded, 1> () : selectDownmix<T, bigEndian, padded, 2> ();
+
+  switch (outChannels)
   {
     case 1:
-      return doLoop<T, SampleReader<T, 1>>(out,  src, numFrames);
+      return selectLoop<T, bigEndian, padded, 1> ();
 
-    case 2:
-      return doLoop<T, SampleReader<T, 2>>(out,  src, numFrames);
+    case 6:
+      return selectLoop<T, bigEndian, padded, 6> ();
+
+    case 8:
+      return selectLoop<T, bigEndian, padded, 8> ();
 
     default:
-      return doLoop<T, SampleReader<T>>(out,  src, numFrames);
+      return selectLoop<T, bigEndian, padded, 2> ();
   }
 }
 
@@ -479,8 +618,103 @@ static void test_makeSample ()
 #endif
 }
 
+static std::vector<tSample> convertForTest (const gchar *format, int inChannels, int outChannels, const void *data, gsize size)
+{
+  GstCaps *caps = gst_caps_new_simple ("audio/x-raw",
+                                       "format", G_TYPE_STRING, format,
+                                       "rate", G_TYPE_INT, 48000,
+                                       "channels", G_TYPE_INT, inChannels,
+                                       "layout", G_TYPE_STRING, "interleaved",
+                                       NULL);
+
+  AudioConverter converter (caps, outChannels);
+  gst_caps_unref (caps);
+
+  g_assert_cmpint (converter.getOutChannels (), ==, outChannels);
+
+  GstBuffer *in = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_fill (in, 0, data, size);
+
+  // eat () doesn't take the input, the caller still owns it
+  GstBuffer *out = converter.eat (in);
+
+  std::vector<tSample> result (gst_buffer_get_size (out) / sizeof (tSample));
+  gst_buffer_extract (out, 0, result.data (), result.size () * sizeof (tSample));
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  return result;
+}
+
+static void test_surroundS16 ()
+{
+  const gint16 in[] = {
+    100, -200, 300, -400, 500, -600,
+    G_MAXINT16, G_MININT16, 0, 1, -1, 12345
+  };
+
+  // 5.1 to 7.1, the rear side pair stays silent
+  std::vector<tSample> up = convertForTest ("S16LE", 6, 8, in, sizeof (in));
+  g_assert_cmpuint (up.size (), ==, 2 * 8);
+
+  for (int frame = 0; frame < 2; frame++)
+  {
+    for (int c = 0; c < 6; c++)
+      g_assert_cmpint (up[frame * 8 + c], ==, makeSample (in[frame * 6 + c]));
+
+    g_assert_cmpint (up[frame * 8 + 6], ==, 0);
+    g_assert_cmpint (up[frame * 8 + 7], ==, 0);
+  }
+
+  // 7.1 to 5.1, the surplus channels are dropped
+  std::vector<tSample> down = convertForTest ("S16LE", 8, 6, in, 8 * sizeof (gint16));
+  g_assert_cmpuint (down.size (), ==, 6);
+
+  for (int c = 0; c < 6; c++)
+    g_assert_cmpint (down[c], ==, makeSample (in[c]));
+}
+
+static void test_surroundS24 ()
+{
+  const tInt24 in[] = {
+    { 0x00, 0x01, 0x00 }, { 0xFF, 0xFF, 0x7F }, { 0x00, 0x00, 0x80 }, { 0xFF, 0xFF, 0xFF },
+    { 0x56, 0x34, 0x12 }, { 0xAA, 0xCB, 0xED }, { 0x00, 0x00, 0x00 }, { 0x10, 0x00, 0xC0 }
+  };
+
+  // one 7.1 frame, or one 5.1 frame from the first six samples
+  std::vector<tSample> eight = convertForTest ("S24LE", 8, 8, in, sizeof (in));
+  g_assert_cmpuint (eight.size (), ==, 8);
+
+  for (int c = 0; c < 8; c++)
+    g_assert_cmpint (eight[c], ==, makeSample (in[c]));
+
+  std::vector<tSample> six = convertForTest ("S24LE", 6, 6, in, 6 * sizeof (tInt24));
+  g_assert_cmpuint (six.size (), ==, 6);
+
+  for (int c = 0; c < 6; c++)
+    g_assert_cmpint (six[c], ==, makeSample (in[c]));
+}
+
+static void test_float ()
+{
+  const gdouble in[] = { 0.5, -0.5, 0.25, -0.75, 0.0, 0.125 };
+
+  // F64 has its own kernel, nothing is read as F32 or dropped as silence
+  std::vector<tSample> out = convertForTest ("F64LE", 2, 2, in, sizeof (in));
+  g_assert_cmpuint (out.size (), ==, 6);
+
+  for (int i = 0; i < 6; i++)
+    g_assert_cmpint (out[i], ==, makeSample (in[i]));
+
+  g_assert_cmpint (out[0], >, 0);
+  g_assert_cmpint (out[1], <, 0);
+}
+
 void AudioConverter::registerTests ()
 {
   g_test_add_func ("/AudioConverter/makeSigned", test_makeSigned);
   g_test_add_func ("/AudioConverter/makeSample", test_makeSample);
+  g_test_add_func ("/AudioConverter/surroundS16", test_surroundS16);
+  g_test_add_func ("/AudioConverter/surroundS24", test_surroundS24);
+  g_test_add_func ("/AudioConverter/float", test_float);
 }
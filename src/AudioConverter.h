@@ -1,19 +1,47 @@
 #pragma once
 
 #include "StreamDecoder.h"
+#include "DownmixMatrix.h"
 #include "gst/gst.h"
 
+/**
+ * AudioConverter turns decoded audio of any integer or float format into
+ * interleaved tSample frames with the channel count requested by the
+ * renderer. Surround sources are folded into stereo and mono through a
+ * DownmixMatrix, in the same pass. Otherwise mono feeds both front channels,
+ * surplus source channels are dropped and missing ones stay silent.
+ */
 class AudioConverter
 {
   public:
-    AudioConverter (GstCaps *srcCaps);
+    // see isSupportedChannelCount, falls back to stereo
+    AudioConverter (GstCaps *srcCaps, int outChannels = 2);
+    ~AudioConverter ();
+
+    // picks the conversion kernel for new caps, returns false without any work if they didn't change
+    bool setCaps (GstCaps *srcCaps);
+
     GstBuffer *eat (GstBuffer *in);
 
+    int getOutChannels () const;
+
     static void registerTests ();
 
   private:
-    template<typename T> void doLoop (tSample* __restrict__ out, const T* __restrict__ src, size_t numFrames);
-    template<typename T, typename tFrameReader> void doLoop (tSample* __restrict__ out, const T* __restrict__ src, size_t numFrames);
+    typedef void (AudioConverter::*tKernel) (tSample* __restrict__ out, const void* __restrict__ src, size_t numFrames);
+
+    void parseCaps (GstCaps *srcCaps);
+    bool isPassthrough () const;
+
+    tKernel selectKernel () const;
+    template<typename T> tKernel selectKernel () const;
+    template<typename T, bool bigEndian, bool padded> tKernel selectKernel () const;
+    template<typename T, bool bigEndian, bool padded, int outChannels> tKernel selectLoop () const;
+    template<typename T, bool bigEndian, bool padded, int outChannels> tKernel selectDownmix () const;
+
+    template<typename T, bool bigEndian, bool padded, int inChannels, int outChannels> void doLoop (tSample* __restrict__ out, const void* __restrict__ src, size_t numFrames);
+    template<typename T, bool bigEndian, bool padded, int inChannels, int outChannels> void doDownmix (tSample* __restrict__ out, const void* __restrict__ src, size_t numFrames);
+    template<typename T, bool bigEndian, bool padded> tSample convertSample (T sample) const;
 
     gboolean srcIsBigEndian;
     gboolean srcIsFloat;
@@ -21,4 +49,11 @@ class AudioConverter
     int srcWidth;
     int srcDepth;
     int srcChannels;
+    int outChannels;
+    DownmixMatrix downmix;
+
+    GstCaps *currentCaps;
+
+    // resolved by setCaps, NULL for passthrough and unsupported formats
+    tKernel kernel;
 };
@@ -0,0 +1,257 @@
+#include "BatchDecoder.h"
+#include "Pipeline.h"
+#include "DecodeOptions.h"
+#include "StreamDecoder.h"
+#include "Trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace
+{
+  const gsize READ_SIZE = 64 * 1024;
+}
+
+BatchDecoder::BatchDecoder (const vector<string> &inputs, guint32 sampleRate, guint32 channels, const string &outputDir, guint numJobs) :
+    m_inputs (inputs), m_sampleRate (sampleRate), m_channels (channels), m_outputDir (outputDir), m_numJobs (MAX (numJobs, 1))
+{
+}
+
+BatchDecoder::~BatchDecoder ()
+{
+  // interrupted, releasing the pipeline closes the pipe and ends the reader
+  for (auto &job : m_jobs)
+  {
+    job->pipeline.reset ();
+
+    if (job->reader.joinable ())
+      job->reader.join ();
+
+    if (job->input >= 0)
+      close (job->input);
+
+    if (job->output >= 0)
+      close (job->output);
+  }
+}
+
+string BatchDecoder::toUri (const string &input)
+{
+  if (input.find ("://") != string::npos)
+    return input;
+
+  gchar *cwd = g_get_current_dir ();
+  gchar *path = g_path_is_absolute (input.c_str ()) ? g_strdup (input.c_str ()) : g_build_filename (cwd, input.c_str (), NULL);
+  gchar *uri = g_filename_to_uri (path, NULL, NULL);
+  string result = uri ? uri : input;
+
+  g_free (uri);
+  g_free (path);
+  g_free (cwd);
+  return result;
+}
+
+string BatchDecoder::getOutputPath (size_t index) const
+{
+  string uri = toUri (m_inputs[index]);
+  string path = uri.substr (0, uri.find_first_of ("?#"));
+  gchar *name = g_path_get_basename (path.c_str ());
+
+  // the index keeps inputs with the same name apart
+  gchar *file = g_strdup_printf ("%03" G_GSIZE_FORMAT "-%s.pcm", index + 1, strcmp (name, "/") && strcmp (name, ".") ? name : "stream");
+  gchar *full = g_build_filename (m_outputDir.c_str (), file, NULL);
+  string result = full;
+
+  g_free (full);
+  g_free (file);
+  g_free (name);
+  return result;
+}
+
+bool BatchDecoder::run (GMainLoop *loop)
+{
+  m_loop = loop;
+  m_startUs = g_get_monotonic_time ();
+
+  startNext ();
+
+  if (m_running > 0)
+    g_main_loop_run (m_loop);
+
+  double elapsed = (g_get_monotonic_time () - m_startUs) / 1e6;
+  double audio = (double) m_totalBytes / (m_sampleRate * m_channels * sizeof (tSample));
+
+  g_print ("Batch: %u of %" G_GSIZE_FORMAT " inputs decoded, %.1f s of audio in %.2f s, %.1fx realtime with %u jobs\n",
+           m_succeeded, m_inputs.size (), audio, elapsed, elapsed > 0 ? audio / elapsed : 0, m_numJobs);
+
+  return m_succeeded == m_inputs.size ();
+}
+
+void BatchDecoder::startNext ()
+{
+  while (m_running < m_numJobs && m_next < m_inputs.size ())
+  {
+    if (start (m_next++))
+      m_running++;
+  }
+
+  if (m_running == 0)
+    g_main_loop_quit (m_loop);
+}
+
+bool BatchDecoder::start (size_t index)
+{
+  Job *job = new Job ();
+  m_jobs.emplace_back (job);
+
+  job->owner = this;
+  job->index = index;
+  job->uri = toUri (m_inputs[index]);
+  job->input = -1;
+  job->output = -1;
+  job->bytes = 0;
+  job->failed = false;
+
+  if (!m_outputDir.empty ())
+  {
+    string path = getOutputPath (index);
+    job->output = open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (job->output < 0)
+    {
+      g_printerr ("%s: cannot write %s: %s\n", job->uri.c_str (), path.c_str (), strerror (errno));
+      return false;
+    }
+  }
+
+  // the same dictionary a renderer would send with DecodeWithOptions
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "profile", g_variant_new_string ("throughput"));
+  g_variant_builder_add (&builder, "{sv}", "channels", g_variant_new_uint32 (m_channels));
+
+  GVariant *options = g_variant_ref_sink (g_variant_builder_end (&builder));
+  GVariant *rates = g_variant_ref_sink (g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, &m_sampleRate, 1, sizeof (guint32)));
+
+  job->pipeline = make_shared<Pipeline> (index + 1, job->uri.c_str (), rates, DecodeOptions (options), g_get_monotonic_time ());
+
+  g_variant_unref (rates);
+  g_variant_unref (options);
+
+  job->pipeline->setMessageCallback ([job] (const std::string &type, const std::string &msg)
+  {
+    // may come from a streaming thread, the pipeline is released on the main loop
+    if (type == "error" && !job->failed.exchange (true))
+    {
+      job->error = msg;
+      g_idle_add ((GSourceFunc) &BatchDecoder::onJobFailed, job);
+    }
+  });
+
+  // the pipeline closes its end of the pipe when released
+  gint32 fd = job->pipeline->init ();
+  job->input = fd < 0 ? -1 : fcntl (fd, F_DUPFD_CLOEXEC, 0);
+
+  if (job->input < 0)
+  {
+    g_printerr ("%s: cannot set up the pipeline\n", job->uri.c_str ());
+    job->pipeline.reset ();
+    return false;
+  }
+
+  job->startUs = g_get_monotonic_time ();
+  job->reader = thread ([this, job] ()
+  {
+    read (job);
+  });
+
+  return true;
+}
+
+void BatchDecoder::read (Job *job)
+{
+  vector<guint8> buffer (READ_SIZE);
+  bool writing = job->output >= 0;
+
+  while (true)
+  {
+    ssize_t numRead = ::read (job->input, buffer.data (), buffer.size ());
+
+    if (numRead < 0 && errno == EINTR)
+      continue;
+
+    if (numRead <= 0)
+      break;
+
+    job->bytes += numRead;
+
+    for (ssize_t done = 0; writing && done < numRead;)
+    {
+      ssize_t written = write (job->output, buffer.data () + done, numRead - done);
+
+      if (written < 0 && errno == EINTR)
+        continue;
+
+      // keep draining, so the pipeline still runs to its end
+      if (written < 0)
+      {
+        Tracer::warning ("BatchDecoder:", job->uri, "cannot write output,", strerror (errno));
+        job->failed = true;
+        writing = false;
+      }
+      else
+        done += written;
+    }
+  }
+
+  g_idle_add ((GSourceFunc) &BatchDecoder::onJobDone, job);
+}
+
+gboolean BatchDecoder::onJobFailed (Job *job)
+{
+  // closes the pipe, the reader finishes the job
+  job->pipeline.reset ();
+  return G_SOURCE_REMOVE;
+}
+
+gboolean BatchDecoder::onJobDone (Job *job)
+{
+  BatchDecoder *pThis = job->owner;
+  gint64 elapsedUs = g_get_monotonic_time () - job->startUs;
+
+  job->reader.join ();
+  job->pipeline.reset ();
+
+  close (job->input);
+  job->input = -1;
+
+  if (job->output >= 0 && close (job->output) < 0)
+    job->failed = true;
+
+  job->output = -1;
+
+  pThis->report (job, elapsedUs);
+  pThis->m_totalBytes += job->bytes;
+
+  if (!job->failed)
+    pThis->m_succeeded++;
+
+  pThis->m_running--;
+  pThis->startNext ();
+
+  return G_SOURCE_REMOVE;
+}
+
+void BatchDecoder::report (const Job *job, gint64 elapsedUs) const
+{
+  // the leading sample rate or chunk headers are counted as audio, a few bytes per stream
+  double audio = (double) job->bytes / (m_sampleRate * m_channels * sizeof (tSample));
+  double elapsed = elapsedUs / 1e6;
+
+  if (job->failed)
+    g_print ("%s: failed after %.1f s of audio: %s\n", job->uri.c_str (), audio, job->error.empty () ? "cannot write output" : job->error.c_str ());
+  else
+    g_print ("%s: %.1f s of audio in %.2f s, %.1fx realtime, %.1f MB/s\n", job->uri.c_str (), audio, elapsed,
+             elapsed > 0 ? audio / elapsed : 0, elapsed > 0 ? job->bytes / elapsed / 1e6 : 0);
+}
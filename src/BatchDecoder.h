@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class Pipeline;
+
+/**
+ * BatchDecoder decodes a list of URIs or local files offline, e.g. to warm
+ * caches or to check a library, and doubles as a benchmark of the whole
+ * decoding path.
+ *
+ * Every input runs through a regular Pipeline, so it takes the same
+ * decoder, AudioConverter and Resampler path as a stream for the renderer.
+ * A reader thread drains the pipe as fast as it is filled, into a file or
+ * nowhere, so decoding is only limited by the CPU. Up to numJobs inputs are
+ * decoded at once; the throughput of each one is printed when it is done.
+ */
+class BatchDecoder
+{
+  public:
+    // outputDir may be empty to discard the decoded audio
+    BatchDecoder (const vector<string> &inputs, guint32 sampleRate, guint32 channels, const string &outputDir, guint numJobs);
+    virtual ~BatchDecoder ();
+
+    // runs the main loop until all inputs are done, false if any of them failed
+    bool run (GMainLoop *loop);
+
+    // local paths become file:// URIs, everything else is taken as is
+    static string toUri (const string &input);
+
+  private:
+    struct Job
+    {
+      BatchDecoder *owner;
+      size_t index;
+      string uri;
+      shared_ptr<Pipeline> pipeline;
+      thread reader;
+      int input;
+      int output;
+      gint64 startUs;
+      atomic<guint64> bytes;
+      atomic<bool> failed;
+      string error;
+    };
+
+    bool start (size_t index);
+    void startNext ();
+    void read (Job *job);
+    void report (const Job *job, gint64 elapsedUs) const;
+    string getOutputPath (size_t index) const;
+
+    static gboolean onJobDone (Job *job);
+    static gboolean onJobFailed (Job *job);
+
+    vector<string> m_inputs;
+    guint32 m_sampleRate;
+    guint32 m_channels;
+    string m_outputDir;
+    guint m_numJobs;
+
+    GMainLoop *m_loop = NULL;
+    vector<unique_ptr<Job>> m_jobs;
+    size_t m_next = 0;
+    guint m_running = 0;
+    guint m_succeeded = 0;
+    guint64 m_totalBytes = 0;
+    gint64 m_startUs = 0;
+};
@@ -0,0 +1,212 @@
+#include "CaptureFile.h"
+#include "Trace.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace
+{
+  const char MAGIC[] = "SDCAP";
+  const gsize MAGIC_SIZE = 5;
+  const guint8 VERSION = 1;
+
+  // no source delivers buffers this large, anything bigger is a corrupt file
+  const guint32 MAX_RECORD_SIZE = 16 * 1024 * 1024;
+}
+
+namespace CaptureFile
+{
+  Writer::Writer () :
+      m_file (NULL),
+      m_startUs (-1)
+  {
+  }
+
+  Writer::~Writer ()
+  {
+    if (m_file)
+      fclose (m_file);
+  }
+
+  bool Writer::open (const string &path, const string &caps)
+  {
+    m_file = fopen (path.c_str (), "wb");
+
+    if (!m_file)
+    {
+      Tracer::warning ("CaptureFile: cannot open", path, strerror (errno));
+      return false;
+    }
+
+    guint32 capsLength = caps.size ();
+
+    fwrite (MAGIC, 1, MAGIC_SIZE, m_file);
+    fwrite (&VERSION, 1, 1, m_file);
+    fwrite (&capsLength, sizeof (capsLength), 1, m_file);
+    fwrite (caps.data (), 1, capsLength, m_file);
+
+    Tracer::info ("CaptureFile: capturing into", path);
+    return true;
+  }
+
+  bool Writer::isOpen () const
+  {
+    return m_file != NULL;
+  }
+
+  void Writer::write (const void *data, gsize size)
+  {
+    if (!m_file)
+      return;
+
+    gint64 now = g_get_monotonic_time ();
+
+    if (m_startUs < 0)
+      m_startUs = now;
+
+    gint64 arrivalUs = now - m_startUs;
+    guint32 recordSize = size;
+
+    fwrite (&arrivalUs, sizeof (arrivalUs), 1, m_file);
+    fwrite (&recordSize, sizeof (recordSize), 1, m_file);
+
+    if (fwrite (data, 1, size, m_file) != size)
+    {
+      Tracer::warning ("CaptureFile: write failed, stopping capture,", strerror (errno));
+      fclose (m_file);
+      m_file = NULL;
+    }
+  }
+
+  Reader::Reader () :
+      m_file (NULL)
+  {
+  }
+
+  Reader::~Reader ()
+  {
+    if (m_file)
+      fclose (m_file);
+  }
+
+  bool Reader::open (const string &path)
+  {
+    m_file = fopen (path.c_str (), "rb");
+
+    if (!m_file)
+    {
+      Tracer::warning ("CaptureFile: cannot open", path, strerror (errno));
+      return false;
+    }
+
+    char magic[MAGIC_SIZE];
+    guint8 version = 0;
+    guint32 capsLength = 0;
+
+    if (fread (magic, 1, MAGIC_SIZE, m_file) != MAGIC_SIZE || memcmp (magic, MAGIC, MAGIC_SIZE) != 0
+        || fread (&version, 1, 1, m_file) != 1 || version != VERSION
+        || fread (&capsLength, sizeof (capsLength), 1, m_file) != 1 || capsLength > MAX_RECORD_SIZE)
+    {
+      Tracer::warning ("CaptureFile:", path, "is not a capture file");
+      fclose (m_file);
+      m_file = NULL;
+      return false;
+    }
+
+    m_caps.resize (capsLength);
+
+    if (capsLength && fread (&m_caps[0], 1, capsLength, m_file) != capsLength)
+    {
+      fclose (m_file);
+      m_file = NULL;
+      return false;
+    }
+
+    return true;
+  }
+
+  const string &Reader::getCaps () const
+  {
+    return m_caps;
+  }
+
+  bool Reader::read (gint64 &arrivalUs, vector<guint8> &data)
+  {
+    guint32 size = 0;
+
+    if (!m_file || fread (&arrivalUs, sizeof (arrivalUs), 1, m_file) != 1 || fread (&size, sizeof (size), 1, m_file) != 1
+        || size > MAX_RECORD_SIZE)
+      return false;
+
+    data.resize (size);
+    return fread (data.data (), 1, size, m_file) == size;
+  }
+
+  // a fresh name per run, so parallel runs and other users' leftovers don't get in the way
+  static gchar *createTestFile ()
+  {
+    gchar *path = NULL;
+    int fd = g_file_open_tmp ("stream-decoder-capture-XXXXXX", &path, NULL);
+
+    g_assert_cmpint (fd, >=, 0);
+    close (fd);
+    return path;
+  }
+
+  static void test_roundTrip ()
+  {
+    gchar *path = createTestFile ();
+
+    {
+      Writer writer;
+      g_assert (writer.open (path, "application/x-icy, metadata-interval=(int)16000"));
+      writer.write ("first", 5);
+      writer.write ("", 0);
+      writer.write ("third record", 12);
+    }
+
+    Reader reader;
+    g_assert (reader.open (path));
+    g_assert (reader.getCaps () == "application/x-icy, metadata-interval=(int)16000");
+
+    gint64 arrivalUs = -1;
+    vector<guint8> data;
+
+    g_assert (reader.read (arrivalUs, data));
+    g_assert_cmpint (arrivalUs, ==, 0);
+    g_assert_cmpuint (data.size (), ==, 5);
+    g_assert (memcmp (data.data (), "first", 5) == 0);
+
+    g_assert (reader.read (arrivalUs, data));
+    g_assert_cmpuint (data.size (), ==, 0);
+
+    g_assert (reader.read (arrivalUs, data));
+    g_assert_cmpint (arrivalUs, >=, 0);
+    g_assert (memcmp (data.data (), "third record", 12) == 0);
+
+    g_assert (!reader.read (arrivalUs, data));
+
+    remove (path);
+    g_free (path);
+  }
+
+  static void test_rejectsOtherFiles ()
+  {
+    gchar *path = createTestFile ();
+    FILE *file = fopen (path, "wb");
+    fputs ("RIFF....WAVEfmt ", file);
+    fclose (file);
+
+    Reader reader;
+    g_assert (!reader.open (path));
+
+    remove (path);
+    g_free (path);
+  }
+
+  void registerTests ()
+  {
+    g_test_add_func ("/CaptureFile/roundTrip", test_roundTrip);
+    g_test_add_func ("/CaptureFile/rejectsOtherFiles", test_rejectsOtherFiles);
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Capture files record the bytes a stream source delivered, with their
+ * arrival times, so a problem station can be replayed offline.
+ *
+ * Layout, in host byte order:
+ *   "SDCAP", version (8 bit), caps length (32 bit), caps string of the source pad
+ *   records: arrival time in us since the first record (64 bit), size (32 bit), bytes
+ */
+namespace CaptureFile
+{
+  class Writer
+  {
+    public:
+      Writer ();
+      virtual ~Writer ();
+
+      bool open (const string &path, const string &caps);
+      bool isOpen () const;
+      void write (const void *data, gsize size);
+
+    private:
+      FILE *m_file;
+      gint64 m_startUs;
+  };
+
+  class Reader
+  {
+    public:
+      Reader ();
+      virtual ~Reader ();
+
+      bool open (const string &path);
+      const string &getCaps () const;
+
+      // false at the end of the file or on a truncated record
+      bool read (gint64 &arrivalUs, vector<guint8> &data);
+
+    private:
+      FILE *m_file;
+      string m_caps;
+  };
+
+  void registerTests ();
+}
@@ -0,0 +1,199 @@
+#include "DecodeOptions.h"
+#include "StreamDecoder.h"
+#include "Trace.h"
+
+namespace
+{
+  // a second at 192 kHz, ALSA periods are far shorter
+  const guint32 MAX_PERIOD_FRAMES = 192000;
+
+  // the spool is allocated up front, a minute at 192 kHz is already ~90 MB for stereo
+  const guint32 MAX_AHEAD_WINDOW_MS = 60000;
+
+  // keeps the ring below 4 GB even at 192 kHz with 8 channels of 32 bit, so gsize holds it on 32 bit targets
+  const guint32 MAX_TIMESHIFT_MS = 600000;
+}
+
+DecodeOptions::DecodeOptions (GVariant *options)
+{
+  if (!options || !g_variant_is_of_type (options, G_VARIANT_TYPE_VARDICT))
+    return;
+
+  // explicit options below override what the profile chose
+  const gchar *profileName = NULL;
+
+  if (g_variant_lookup (options, "profile", "&s", &profileName) && !applyProfile (profileName))
+    Tracer::warning ("DecodeOptions: unknown profile", profileName, "using the defaults");
+
+  gboolean framedProtocol = FALSE;
+
+  if (g_variant_lookup (options, "framed", "b", &framedProtocol))
+    framed = framedProtocol;
+
+  if (g_variant_lookup (options, "channels", "u", &channels) && !isSupportedChannelCount (channels))
+  {
+    Tracer::warning ("DecodeOptions: cannot output", channels, "channels, using stereo");
+    channels = 2;
+  }
+
+  g_variant_lookup (options, "resampleBudget", "d", &resampleBudget);
+
+  gboolean adaptive = FALSE;
+
+  if (g_variant_lookup (options, "adaptiveResampling", "b", &adaptive))
+    adaptiveResampling = adaptive;
+
+  g_variant_lookup (options, "targetLatencyMs", "u", &targetLatencyMs);
+  g_variant_lookup (options, "priority", "i", &priority);
+
+  if (g_variant_lookup (options, "aheadWindowMs", "u", &aheadWindowMs) && aheadWindowMs > MAX_AHEAD_WINDOW_MS)
+  {
+    Tracer::warning ("DecodeOptions: ahead window of", aheadWindowMs, "ms is too large, using", MAX_AHEAD_WINDOW_MS, "ms");
+    aheadWindowMs = MAX_AHEAD_WINDOW_MS;
+  }
+
+  if (g_variant_lookup (options, "timeshiftMs", "u", &timeshiftMs) && timeshiftMs > MAX_TIMESHIFT_MS)
+  {
+    Tracer::warning ("DecodeOptions: timeshift window of", timeshiftMs, "ms is too large, using", MAX_TIMESHIFT_MS, "ms");
+    timeshiftMs = MAX_TIMESHIFT_MS;
+  }
+
+  const gchar *directory = NULL;
+
+  if (g_variant_lookup (options, "timeshiftDir", "&s", &directory))
+    timeshiftDir = directory;
+
+  g_variant_lookup (options, "sourceBlocksize", "u", &sourceBlocksize);
+  g_variant_lookup (options, "decoderQueueMs", "u", &decoderQueueMs);
+  g_variant_lookup (options, "outputBatchBytes", "u", &outputBatchBytes);
+
+  if (g_variant_lookup (options, "periodFrames", "u", &periodFrames) && periodFrames > MAX_PERIOD_FRAMES)
+  {
+    Tracer::warning ("DecodeOptions: period of", periodFrames, "frames is too large, passing on the decoder's buffers");
+    periodFrames = 0;
+  }
+
+  g_variant_lookup (options, "networkQueueBytes", "u", &networkQueueBytes);
+  g_variant_lookup (options, "outputQueueMs", "u", &outputQueueMs);
+  g_variant_lookup (options, "networkCpu", "i", &networkCpu);
+  g_variant_lookup (options, "decodeCpu", "i", &decodeCpu);
+  g_variant_lookup (options, "outputCpu", "i", &outputCpu);
+
+  const gchar *capture = NULL;
+
+  if (g_variant_lookup (options, "capturePath", "&s", &capture))
+    capturePath = capture;
+
+  gboolean fast = FALSE;
+
+  if (g_variant_lookup (options, "replayFast", "b", &fast))
+    replayFast = fast;
+
+  const gchar *mime = NULL;
+
+  if (g_variant_lookup (options, "mimeType", "&s", &mime))
+    mimeType = mime;
+
+  gchar **codecs = NULL;
+
+  if (g_variant_lookup (options, "passthroughCodecs", "^as", &codecs))
+  {
+    for (gchar **walker = codecs; *walker; walker++)
+    {
+      passthroughCodecs.push_back (*walker);
+      Tracer::overdose ("passthrough codec:", *walker);
+    }
+
+    g_strfreev (codecs);
+  }
+}
+
+bool DecodeOptions::applyProfile (const string &name)
+{
+  if (name == "low-latency")
+  {
+    // line-in and TV sync: small reads, no queues, every buffer written at once,
+    // and the resampler follows the renderer's clock with a shallow pipe
+    sourceBlocksize = 1024;
+    decoderQueueMs = 100;
+    outputBatchBytes = 0;
+    networkQueueBytes = 0;
+    outputQueueMs = 0;
+    adaptiveResampling = true;
+    targetLatencyMs = 40;
+  }
+  else if (name == "throughput")
+  {
+    // weak links: large reads, deep queues on separate threads and few big writes
+    sourceBlocksize = 16 * 1024;
+    decoderQueueMs = 2000;
+    outputBatchBytes = 64 * 1024;
+    networkQueueBytes = 1024 * 1024;
+    outputQueueMs = 1000;
+    adaptiveResampling = false;
+  }
+  else if (name != "default")
+  {
+    return false;
+  }
+
+  profile = name;
+  return true;
+}
+
+bool DecodeOptions::isPassthroughCodec (GstCaps *caps) const
+{
+  for (const string &codec : passthroughCodecs)
+  {
+    if (GstCaps *codecCaps = gst_caps_from_string (codec.c_str ()))
+    {
+      bool matches = gst_caps_can_intersect (caps, codecCaps);
+      gst_caps_unref (codecCaps);
+
+      if (matches)
+        return true;
+    }
+    else
+    {
+      Tracer::warning ("DecodeOptions: cannot parse passthrough codec", codec);
+    }
+  }
+
+  return false;
+}
+
+static void test_limits ()
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "aheadWindowMs", g_variant_new_uint32 (G_MAXUINT32));
+  g_variant_builder_add (&builder, "{sv}", "timeshiftMs", g_variant_new_uint32 (G_MAXUINT32));
+  g_variant_builder_add (&builder, "{sv}", "periodFrames", g_variant_new_uint32 (G_MAXUINT32));
+
+  GVariant *options = g_variant_ref_sink (g_variant_builder_end (&builder));
+  DecodeOptions clamped (options);
+  g_variant_unref (options);
+
+  // the spool would otherwise try to allocate gigabytes, the timeshift ring overflow gsize
+  g_assert_cmpuint (clamped.aheadWindowMs, ==, MAX_AHEAD_WINDOW_MS);
+  g_assert_cmpuint (clamped.timeshiftMs, ==, MAX_TIMESHIFT_MS);
+  g_assert_cmpuint (clamped.periodFrames, ==, 0);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "aheadWindowMs", g_variant_new_uint32 (30000));
+  g_variant_builder_add (&builder, "{sv}", "timeshiftMs", g_variant_new_uint32 (300000));
+  g_variant_builder_add (&builder, "{sv}", "periodFrames", g_variant_new_uint32 (1024));
+
+  options = g_variant_ref_sink (g_variant_builder_end (&builder));
+  DecodeOptions kept (options);
+  g_variant_unref (options);
+
+  g_assert_cmpuint (kept.aheadWindowMs, ==, 30000);
+  g_assert_cmpuint (kept.timeshiftMs, ==, 300000);
+  g_assert_cmpuint (kept.periodFrames, ==, 1024);
+}
+
+void DecodeOptions::registerTests ()
+{
+  g_test_add_func ("/DecodeOptions/limits", test_limits);
+}
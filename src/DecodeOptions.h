@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <list>
+#include <string>
+
+using namespace std;
+
+/**
+ * DecodeOptions holds the optional a{sv} arguments of DecodeWithOptions.
+ * Unknown keys are ignored, missing keys keep their defaults.
+ */
+class DecodeOptions
+{
+  public:
+    DecodeOptions (GVariant *options);
+
+    bool isPassthroughCodec (GstCaps *caps) const;
+
+    static void registerTests ();
+
+    // "low-latency", "throughput" or "default", sets the defaults of the buffering options below
+    string profile = "default";
+
+    // caps strings of the codecs the renderer can decode itself, e.g. "audio/mpeg, mpegversion=(int)1"
+    list<string> passthroughCodecs;
+
+    // use the chunked protocol from PipeProtocol.h instead of the leading sample rate
+    bool framed = false;
+
+    // interleaved channels written to the pipe, see isSupportedChannelCount
+    guint32 channels = 2;
+
+    // upper bound for SampleRateChooser::estimateCost, 0 means unlimited
+    double resampleBudget = 0;
+
+    // MIME type from the protocolInfo, lets the Pipeline skip typefinding
+    string mimeType;
+
+    // trim the resampling ratio to the renderer's clock, for live streams
+    bool adaptiveResampling = false;
+    guint32 targetLatencyMs = 500;
+
+    // for finite files: decode up to this far ahead of playback in bursts, so the network can idle
+    guint32 aheadWindowMs = 0;
+
+    // for live streams: keep this much PCM in a file-backed ring for Pause, Resume and Rewind
+    guint32 timeshiftMs = 0;
+
+    // where the ring's backing file is created, empty for the temp directory, which is often a tmpfs
+    string timeshiftDir;
+
+    // record the bytes delivered by souphttpsrc with their arrival times, see CaptureFile.h
+    string capturePath;
+
+    // replay:// URIs: push the capture as fast as possible instead of at the original timing
+    bool replayFast = false;
+
+    // souphttpsrc blocksize and decodebin queue depth, 0 keeps the element defaults
+    guint32 sourceBlocksize = 0;
+    guint32 decoderQueueMs = 0;
+
+    // collect this many bytes before writing to the pipe, 0 writes every buffer
+    guint32 outputBatchBytes = 0;
+
+    // write PCM in periods of exactly this many frames, 0 passes on the decoder's buffer sizes
+    guint32 periodFrames = 0;
+
+    // thread topology: queue2 between source and decoder, queue between decoder and output
+    guint32 networkQueueBytes = 0;
+    guint32 outputQueueMs = 0;
+
+    // CPU to pin the threads of each stage to, -1 for no affinity
+    gint32 networkCpu = -1;
+    gint32 decodeCpu = -1;
+    gint32 outputCpu = -1;
+
+    // streams with a lower priority are degraded first when the CPU budget runs out
+    gint32 priority = 0;
+
+  private:
+    bool applyProfile (const string &name);
+};
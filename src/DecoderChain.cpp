@@ -0,0 +1,57 @@
+#include "DecoderChain.h"
+#include "Trace.h"
+
+namespace
+{
+  struct MimeTypeMapping
+  {
+    const gchar *mimeType;
+    const gchar *caps;
+  };
+
+  const MimeTypeMapping s_mappings[] =
+  {
+    { "audio/mpeg", "audio/mpeg, mpegversion=(int)1" },
+    { "audio/mp3", "audio/mpeg, mpegversion=(int)1" },
+    { "audio/x-mpeg", "audio/mpeg, mpegversion=(int)1" },
+    { "audio/aac", "audio/mpeg, mpegversion=(int)4, stream-format=(string)adts" },
+    { "audio/aacp", "audio/mpeg, mpegversion=(int)4, stream-format=(string)adts" },
+    { "audio/x-aac", "audio/mpeg, mpegversion=(int)4, stream-format=(string)adts" },
+    { "audio/flac", "audio/x-flac" },
+    { "audio/x-flac", "audio/x-flac" },
+  };
+}
+
+GstCaps *DecoderChain::capsForMimeType (const string &mimeType)
+{
+  // protocolInfo may carry parameters, e.g. "audio/mpeg;DLNA.ORG_PN=MP3"
+  string type = mimeType.substr (0, mimeType.find (';'));
+
+  for (const MimeTypeMapping &mapping : s_mappings)
+  {
+    if (g_ascii_strcasecmp (type.c_str (), mapping.mimeType) == 0)
+      return gst_caps_from_string (mapping.caps);
+  }
+
+  return NULL;
+}
+
+GstElement *DecoderChain::createElement (GstCaps *caps, GstElementFactoryListType type)
+{
+  GList *factories = gst_element_factory_list_get_elements (type | GST_ELEMENT_FACTORY_TYPE_MEDIA_AUDIO, GST_RANK_MARGINAL);
+  GList *matching = gst_element_factory_list_filter (factories, caps, GST_PAD_SINK, FALSE);
+  matching = g_list_sort (matching, gst_plugin_feature_rank_compare_func);
+
+  GstElement *element = NULL;
+
+  if (matching)
+  {
+    element = gst_element_factory_create (GST_ELEMENT_FACTORY (matching->data), NULL);
+    Tracer::overdose ("DecoderChain: using", GST_OBJECT_NAME (matching->data));
+  }
+
+  gst_plugin_feature_list_free (matching);
+  gst_plugin_feature_list_free (factories);
+
+  return element;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <string>
+
+using namespace std;
+
+/**
+ * DecoderChain picks parser and decoder for a MIME type the control point already
+ * knows, so the Pipeline can skip the typefinding done by decodebin.
+ */
+class DecoderChain
+{
+  public:
+    // caps for elementary audio streams, NULL for containers and unknown types
+    static GstCaps *capsForMimeType (const string &mimeType);
+
+    // highest ranked element of the given type accepting caps, NULL if there is none
+    static GstElement *createElement (GstCaps *caps, GstElementFactoryListType type);
+};
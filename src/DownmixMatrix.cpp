@@ -0,0 +1,200 @@
+#include "DownmixMatrix.h"
+#include <math.h>
+
+namespace
+{
+  const float MINUS_3DB = M_SQRT1_2;
+
+  // left and right gain for every GstAudioChannelPosition up to SURROUND_RIGHT
+  const float STEREO_GAINS[][2] =
+  {
+    { 1, 0 },                     // front left
+    { 0, 1 },                     // front right
+    { MINUS_3DB, MINUS_3DB },     // front center
+    { 0, 0 },                     // LFE 1
+    { MINUS_3DB, 0 },             // rear left
+    { 0, MINUS_3DB },             // rear right
+    { 1, 0 },                     // front left of center
+    { 0, 1 },                     // front right of center
+    { 0.5, 0.5 },                 // rear center
+    { 0, 0 },                     // LFE 2
+    { MINUS_3DB, 0 },             // side left
+    { 0, MINUS_3DB },             // side right
+    { MINUS_3DB, 0 },             // top front left
+    { 0, MINUS_3DB },             // top front right
+    { 0.5, 0.5 },                 // top front center
+    { 0.5, 0.5 },                 // top center
+    { 0.5, 0 },                   // top rear left
+    { 0, 0.5 },                   // top rear right
+    { 0.5, 0 },                   // top side left
+    { 0, 0.5 },                   // top side right
+    { 0.5, 0.5 },                 // top rear center
+    { MINUS_3DB, MINUS_3DB },     // bottom front center
+    { MINUS_3DB, 0 },             // bottom front left
+    { 0, MINUS_3DB },             // bottom front right
+    { 1, 0 },                     // wide left
+    { 0, 1 },                     // wide right
+    { MINUS_3DB, 0 },             // surround left
+    { 0, MINUS_3DB },             // surround right
+  };
+
+  const int NUM_POSITIONS = G_N_ELEMENTS (STEREO_GAINS);
+
+  guint64 bit (DownmixMatrix::Position position)
+  {
+    return G_GUINT64_CONSTANT (1) << position;
+  }
+}
+
+guint64 DownmixMatrix::getFallbackMask (int numChannels)
+{
+  guint64 front = bit (FRONT_LEFT) | bit (FRONT_RIGHT);
+  guint64 rear = bit (REAR_LEFT) | bit (REAR_RIGHT);
+  guint64 fiveOne = front | bit (FRONT_CENTER) | bit (LFE1) | rear;
+
+  switch (numChannels)
+  {
+    case 2:
+      return front;
+    case 3:
+      return front | bit (LFE1);
+    case 4:
+      return front | rear;
+    case 5:
+      return front | bit (FRONT_CENTER) | rear;
+    case 6:
+      return fiveOne;
+    case 7:
+      return fiveOne | bit (REAR_CENTER);
+    case 8:
+      return fiveOne | bit (SIDE_LEFT) | bit (SIDE_RIGHT);
+    default:
+      return 0;
+  }
+}
+
+bool DownmixMatrix::build (guint64 channelMask, int numChannels, int outChannels)
+{
+  m_numChannels = 0;
+  m_coefficients.clear ();
+
+  if (numChannels <= outChannels || outChannels > 2 || outChannels < 1)
+    return false;
+
+  // some decoders leave out the mask, others send one that doesn't match the channel count
+  if (!channelMask || (channelMask >> NUM_POSITIONS) || __builtin_popcountll (channelMask) != numChannels)
+    channelMask = getFallbackMask (numChannels);
+
+  if (!channelMask)
+    return false;
+
+  vector<float> coefficients (outChannels * numChannels, 0);
+  int in = 0;
+
+  for (int position = 0; position < NUM_POSITIONS; position++)
+  {
+    if (!(channelMask & (G_GUINT64_CONSTANT (1) << position)))
+      continue;
+
+    const float *gains = STEREO_GAINS[position];
+
+    if (outChannels == 1)
+      coefficients[in] = (gains[0] + gains[1]) / 2;
+    else
+    {
+      coefficients[in] = gains[0];
+      coefficients[numChannels + in] = gains[1];
+    }
+
+    in++;
+  }
+
+  // the loudest row decides, so full scale on all channels stays in range
+  float maxSum = 0;
+
+  for (int out = 0; out < outChannels; out++)
+  {
+    float sum = 0;
+
+    for (int i = 0; i < numChannels; i++)
+      sum += coefficients[out * numChannels + i];
+
+    maxSum = MAX (maxSum, sum);
+  }
+
+  if (maxSum <= 0)
+    return false;
+
+  for (float &coefficient : coefficients)
+    coefficient /= maxSum;
+
+  m_numChannels = numChannels;
+  m_coefficients.swap (coefficients);
+  return true;
+}
+
+bool DownmixMatrix::isValid () const
+{
+  return !m_coefficients.empty ();
+}
+
+const float *DownmixMatrix::getCoefficients () const
+{
+  return m_coefficients.data ();
+}
+
+float DownmixMatrix::get (int out, int in) const
+{
+  return m_coefficients[out * m_numChannels + in];
+}
+
+static void test_fiveOneToStereo ()
+{
+  DownmixMatrix matrix;
+
+  g_assert (matrix.build (0, 6, 2));
+
+  // FL FR FC LFE RL RR
+  float scale = 1 / (1 + 2 * M_SQRT1_2);
+
+  g_assert_cmpfloat (fabs (matrix.get (0, 0) - scale), <, 1e-6);
+  g_assert_cmpfloat (matrix.get (0, 1), ==, 0);
+  g_assert_cmpfloat (fabs (matrix.get (0, 2) - M_SQRT1_2 * scale), <, 1e-6);
+  g_assert_cmpfloat (fabs (matrix.get (1, 2) - M_SQRT1_2 * scale), <, 1e-6);
+  g_assert_cmpfloat (matrix.get (0, 3), ==, 0);
+  g_assert_cmpfloat (matrix.get (1, 3), ==, 0);
+  g_assert_cmpfloat (fabs (matrix.get (0, 4) - M_SQRT1_2 * scale), <, 1e-6);
+  g_assert_cmpfloat (matrix.get (1, 4), ==, 0);
+  g_assert_cmpfloat (fabs (matrix.get (1, 5) - M_SQRT1_2 * scale), <, 1e-6);
+}
+
+static void test_channelMask ()
+{
+  DownmixMatrix matrix;
+
+  // FL FR FC SL SR, the sides are interleaved after the center
+  guint64 mask = (1 << DownmixMatrix::FRONT_LEFT) | (1 << DownmixMatrix::FRONT_RIGHT) | (1 << DownmixMatrix::FRONT_CENTER)
+                 | (1 << DownmixMatrix::SIDE_LEFT) | (1 << DownmixMatrix::SIDE_RIGHT);
+
+  g_assert (matrix.build (mask, 5, 2));
+  g_assert_cmpfloat (matrix.get (0, 3), >, 0);
+  g_assert_cmpfloat (matrix.get (1, 3), ==, 0);
+  g_assert_cmpfloat (matrix.get (1, 4), >, 0);
+
+  // a mask that doesn't match the channel count falls back to the default layout
+  g_assert (matrix.build (mask, 6, 1));
+  g_assert_cmpfloat (matrix.get (0, 3), ==, 0);
+  g_assert_cmpfloat (matrix.get (0, 0), ==, matrix.get (0, 1));
+
+  // nothing to fold
+  g_assert (!matrix.build (0, 2, 2));
+  g_assert (!matrix.build (0, 6, 6));
+  g_assert (!matrix.build (0, 9, 2));
+  g_assert (!matrix.isValid ());
+}
+
+void DownmixMatrix::registerTests ()
+{
+  g_test_add_func ("/DownmixMatrix/fiveOneToStereo", test_fiveOneToStereo);
+  g_test_add_func ("/DownmixMatrix/channelMask", test_channelMask);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glib.h>
+#include <vector>
+
+using namespace std;
+
+/**
+ * DownmixMatrix folds surround layouts into stereo or mono for renderers
+ * with fewer channels, instead of keeping only the first two channels.
+ *
+ * The source layout is the "channel-mask" of the caps, with the bits
+ * numbered like GstAudioChannelPosition and the samples interleaved in
+ * ascending bit order. Center and surround channels are mixed in at -3 dB,
+ * LFE is dropped, and the rows are scaled down so that a full-scale signal
+ * on every channel doesn't clip.
+ */
+class DownmixMatrix
+{
+  public:
+    enum Position
+    {
+      FRONT_LEFT = 0,
+      FRONT_RIGHT,
+      FRONT_CENTER,
+      LFE1,
+      REAR_LEFT,
+      REAR_RIGHT,
+      FRONT_LEFT_OF_CENTER,
+      FRONT_RIGHT_OF_CENTER,
+      REAR_CENTER,
+      LFE2,
+      SIDE_LEFT,
+      SIDE_RIGHT,
+      NUM_KNOWN_POSITIONS
+    };
+
+    // the layout GStreamer assumes for caps without a channel-mask, 0 if there is none
+    static guint64 getFallbackMask (int numChannels);
+
+    // false if no matrix is needed or the layout is unknown, the converter maps channels 1:1 then
+    bool build (guint64 channelMask, int numChannels, int outChannels);
+
+    bool isValid () const;
+
+    // outChannels rows of numChannels coefficients
+    const float *getCoefficients () const;
+    float get (int out, int in) const;
+
+    static void registerTests ();
+
+  private:
+    int m_numChannels = 0;
+    vector<float> m_coefficients;
+};
@@ -0,0 +1,100 @@
+#include "DriftController.h"
+#include <math.h>
+
+namespace
+{
+  // ppm per second of fill error, and per second squared of integrated error.
+  // Critically damped for a loop time constant of roughly 200 seconds.
+  const double PROPORTIONAL_GAIN = 10000;
+  const double INTEGRAL_GAIN = 25;
+
+  // real clocks are off by less than 100 ppm, anything beyond is a hiccup
+  const double MAX_CORRECTION_PPM = 1000;
+
+  // renderers read in periods, smooth the fill level over about a second
+  const double FILTER_TIME_CONSTANT = 1.0;
+}
+
+DriftController::DriftController (double targetFillSeconds) :
+    m_targetFill (targetFillSeconds),
+    m_filteredFill (0),
+    m_integral (0),
+    m_correctionPpm (0),
+    m_primed (false)
+{
+}
+
+double DriftController::update (double fillSeconds, double elapsedSeconds)
+{
+  if (!m_primed)
+  {
+    m_filteredFill = fillSeconds;
+    m_primed = true;
+  }
+  else
+  {
+    double alpha = elapsedSeconds / (FILTER_TIME_CONSTANT + elapsedSeconds);
+    m_filteredFill += alpha * (fillSeconds - m_filteredFill);
+  }
+
+  // too much buffered means the source runs faster than the renderer, so produce fewer frames
+  double error = m_filteredFill - m_targetFill;
+  double integral = m_integral + error * elapsedSeconds;
+  double correction = -(PROPORTIONAL_GAIN * error + INTEGRAL_GAIN * integral);
+
+  // don't wind up the integral while the correction is clamped
+  if (fabs (correction) <= MAX_CORRECTION_PPM)
+    m_integral = integral;
+
+  m_correctionPpm = CLAMP (correction, -MAX_CORRECTION_PPM, MAX_CORRECTION_PPM);
+  return m_correctionPpm;
+}
+
+double DriftController::getCorrectionPpm () const
+{
+  return m_correctionPpm;
+}
+
+double DriftController::getFilteredFill () const
+{
+  return m_filteredFill;
+}
+
+static void test_compensatesDrift ()
+{
+  const double sourceDriftPpm = 80;
+  const double target = 0.5;
+  const double step = 0.1;
+
+  DriftController controller (target);
+  double fill = 0.2;
+
+  for (int i = 0; i < 100000; i++)
+  {
+    double ppm = controller.update (fill, step);
+    fill += step * (sourceDriftPpm + ppm) / 1000000;
+  }
+
+  g_assert_cmpfloat (fabs (controller.getCorrectionPpm () + sourceDriftPpm), <, 1);
+  g_assert_cmpfloat (fabs (fill - target), <, 0.01);
+}
+
+static void test_clampsCorrection ()
+{
+  DriftController controller (0.5);
+
+  g_assert_cmpfloat (controller.update (10, 0.1), ==, -1000);
+  g_assert_cmpfloat (controller.update (10, 0.1), ==, -1000);
+
+  // a wound up integral would keep the correction at a few hundred ppm
+  for (int i = 0; i < 200; i++)
+    controller.update (0.5, 0.1);
+
+  g_assert_cmpfloat (fabs (controller.getCorrectionPpm ()), <, 10);
+}
+
+void DriftController::registerTests ()
+{
+  g_test_add_func ("/DriftController/compensatesDrift", test_compensatesDrift);
+  g_test_add_func ("/DriftController/clampsCorrection", test_clampsCorrection);
+}
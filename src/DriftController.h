@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * DriftController trims the resampling ratio of live streams, whose source
+ * clock differs from the renderer's clock.
+ *
+ * It is a PI controller on the low-pass filtered fill level of the output path.
+ * The result is a correction in ppm to apply to the Resampler.
+ */
+class DriftController
+{
+  public:
+    DriftController (double targetFillSeconds);
+
+    // fill level in seconds of audio, elapsed time since the last update in seconds
+    double update (double fillSeconds, double elapsedSeconds);
+
+    double getCorrectionPpm () const;
+    double getFilteredFill () const;
+
+    static void registerTests ();
+
+  private:
+    double m_targetFill;
+    double m_filteredFill;
+    double m_integral;
+    double m_correctionPpm;
+    bool m_primed;
+};
@@ -0,0 +1,111 @@
+#include "Histogram.h"
+
+Histogram::Histogram () :
+    m_count (0),
+    m_max (0)
+{
+  for (guint64 &bucket : m_buckets)
+    bucket = 0;
+}
+
+int Histogram::getBucket (gint64 value)
+{
+  if (value < SUB_BUCKETS)
+    return MAX (value, 0);
+
+  // the power of two selects the group, the next two bits the bucket within
+  int exponent = g_bit_storage (value) - 1;
+  int fraction = (value >> (exponent - 2)) & (SUB_BUCKETS - 1);
+  int bucket = (exponent - 1) * SUB_BUCKETS + fraction;
+
+  return MIN (bucket, NUM_BUCKETS - 1);
+}
+
+gint64 Histogram::getUpperBound (int bucket)
+{
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+
+  int exponent = bucket / SUB_BUCKETS + 1;
+  int fraction = bucket % SUB_BUCKETS;
+
+  return ((gint64) (SUB_BUCKETS + fraction + 1) << (exponent - 2)) - 1;
+}
+
+void Histogram::add (gint64 value)
+{
+  m_buckets[getBucket (value)]++;
+  m_count++;
+  m_max = MAX (m_max, value);
+}
+
+gint64 Histogram::getPercentile (double percentile) const
+{
+  if (!m_count)
+    return 0;
+
+  guint64 rank = MAX ((guint64) (percentile / 100.0 * m_count + 0.5), 1);
+  guint64 seen = 0;
+
+  for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+  {
+    seen += m_buckets[bucket];
+
+    if (seen >= rank)
+      return MIN (getUpperBound (bucket), m_max);
+  }
+
+  return m_max;
+}
+
+guint64 Histogram::getCount () const
+{
+  return m_count;
+}
+
+gint64 Histogram::getMax () const
+{
+  return m_max;
+}
+
+static void test_percentiles ()
+{
+  Histogram histogram;
+
+  g_assert_cmpint (histogram.getPercentile (50), ==, 0);
+
+  for (gint64 value = 1; value <= 1000; value++)
+    histogram.add (value);
+
+  g_assert_cmpuint (histogram.getCount (), ==, 1000);
+  g_assert_cmpint (histogram.getMax (), ==, 1000);
+
+  gint64 median = histogram.getPercentile (50);
+  g_assert_cmpint (median, >=, 500);
+  g_assert_cmpint (median, <=, 500 * 1.25);
+
+  gint64 p99 = histogram.getPercentile (99);
+  g_assert_cmpint (p99, >=, 990);
+  g_assert_cmpint (p99, <=, 1000);
+}
+
+static void test_bucketBounds ()
+{
+  // the percentile of a single value is never below it, and at most one bucket above
+  for (gint64 value = 1; value < 100000; value += 7)
+  {
+    Histogram histogram;
+    histogram.add (value);
+    histogram.add (G_GINT64_CONSTANT (1) << 50);
+
+    gint64 bound = histogram.getPercentile (50);
+    g_assert_cmpint (bound, >=, value);
+    g_assert_cmpint (bound, <=, value * 1.25);
+  }
+}
+
+void Histogram::registerTests ()
+{
+  g_test_add_func ("/Histogram/percentiles", test_percentiles);
+  g_test_add_func ("/Histogram/bucketBounds", test_bucketBounds);
+}
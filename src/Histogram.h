@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Histogram collects positive durations in logarithmic buckets, four per
+ * power of two, so percentiles are accurate to about 19% over any range
+ * while memory stays constant.
+ */
+class Histogram
+{
+  public:
+    Histogram ();
+
+    void add (gint64 value);
+
+    // upper bound of the bucket holding the given share of all values, 0 while empty
+    gint64 getPercentile (double percentile) const;
+
+    guint64 getCount () const;
+    gint64 getMax () const;
+
+    static void registerTests ();
+
+  private:
+    static const int SUB_BUCKETS = 4;
+    static const int NUM_BUCKETS = 40 * SUB_BUCKETS;
+
+    static int getBucket (gint64 value);
+    static gint64 getUpperBound (int bucket);
+
+    guint64 m_buckets[NUM_BUCKETS];
+    guint64 m_count;
+    gint64 m_max;
+};
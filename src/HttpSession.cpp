@@ -0,0 +1,323 @@
+#include "HttpSession.h"
+#include "Trace.h"
+#include <string.h>
+#include <condition_variable>
+#include <thread>
+
+namespace
+{
+  // parallel streams from one media server, e.g. in a multi-room group
+  const int MAX_CONNS_PER_HOST = 8;
+  const int MAX_CONNS = 32;
+
+  // idle connections are kept this long for the next track
+  const guint IDLE_TIMEOUT_SECONDS = 30;
+
+  // a server that stops answering fails the stream instead of stalling it, like souphttpsrc's own default
+  const guint TIMEOUT_SECONDS = 15;
+
+  // like souphttpsrc, libsoup appends its own version after the space
+  const gchar *USER_AGENT = "GStreamer souphttpsrc ";
+}
+
+const gchar *HttpSession::CONTEXT_TYPE = "gst.soup.session";
+
+HttpSession &HttpSession::get ()
+{
+  static HttpSession session;
+  return session;
+}
+
+HttpSession::HttpSession () :
+    m_session (soup_session_new_with_options (SOUP_SESSION_MAX_CONNS, MAX_CONNS,
+                                              SOUP_SESSION_MAX_CONNS_PER_HOST, MAX_CONNS_PER_HOST,
+                                              SOUP_SESSION_IDLE_TIMEOUT, IDLE_TIMEOUT_SECONDS,
+                                              SOUP_SESSION_TIMEOUT, TIMEOUT_SECONDS,
+                                              SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE, TRUE,
+                                              SOUP_SESSION_SSL_STRICT, TRUE,
+                                              SOUP_SESSION_USER_AGENT, USER_AGENT,
+                                              NULL)),
+    m_context (NULL)
+{
+  g_signal_connect (m_session, "request-queued", G_CALLBACK (&HttpSession::onRequestQueued), this);
+}
+
+HttpSession::~HttpSession ()
+{
+  if (m_context)
+    gst_context_unref (m_context);
+
+  g_object_unref (m_session);
+}
+
+SoupSession *HttpSession::getSession () const
+{
+  return m_session;
+}
+
+GstContext *HttpSession::getContext ()
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  if (!m_context)
+  {
+    // not forced, so a source with its own proxy or TLS settings keeps its own session
+    GstContext *context = gst_context_new (CONTEXT_TYPE, TRUE);
+    GstStructure *structure = gst_context_writable_structure (context);
+    gst_structure_set (structure, "session", SOUP_TYPE_SESSION, m_session, "force", G_TYPE_BOOLEAN, FALSE, NULL);
+
+    m_context = context;
+  }
+
+  return gst_context_ref (m_context);
+}
+
+void HttpSession::attach (GstElement *source)
+{
+  GstContext *context = getContext ();
+  gst_element_set_context (source, context);
+  gst_context_unref (context);
+}
+
+bool HttpSession::onContextMessage (GstMessage *message)
+{
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_NEED_CONTEXT)
+  {
+    const gchar *type = NULL;
+
+    if (!gst_message_parse_context_type (message, &type) || strcmp (type, CONTEXT_TYPE))
+      return false;
+
+    attach (GST_ELEMENT (GST_MESSAGE_SRC (message)));
+    return true;
+  }
+
+  if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_HAVE_CONTEXT)
+    return false;
+
+  GstContext *context = NULL;
+  gst_message_parse_have_context (message, &context);
+
+  if (strcmp (gst_context_get_context_type (context), CONTEXT_TYPE))
+  {
+    gst_context_unref (context);
+    return false;
+  }
+
+  // a plain SoupSession is ours, or one of a source that couldn't take ours
+  const GValue *session = gst_structure_get_value (gst_context_get_structure (context), "session");
+  bool foreign = session && !G_VALUE_HOLDS (session, SOUP_TYPE_SESSION);
+
+  lock_guard<mutex> lock (m_mutex);
+
+  if (foreign && m_context && m_context != context)
+  {
+    const GValue *current = gst_structure_get_value (gst_context_get_structure (m_context), "session");
+
+    if (current && G_VALUE_HOLDS (current, SOUP_TYPE_SESSION))
+    {
+      Tracer::info ("HttpSession: souphttpsrc brings its own session type, sharing that one");
+      gst_context_unref (m_context);
+      m_context = gst_context_ref (context);
+    }
+  }
+
+  gst_context_unref (context);
+  return true;
+}
+
+void HttpSession::onRequestQueued (SoupSession *session, SoupMessage *msg, HttpSession *pThis)
+{
+  pThis->m_requests++;
+  g_signal_connect (msg, "network-event", G_CALLBACK (&HttpSession::onNetworkEvent), pThis);
+}
+
+void HttpSession::onNetworkEvent (SoupMessage *msg, GSocketClientEvent event, GIOStream *connection, HttpSession *pThis)
+{
+  // only emitted while a new connection is set up, not for a reused one
+  switch (event)
+  {
+    case G_SOCKET_CLIENT_RESOLVING:
+      pThis->m_dnsLookups++;
+      break;
+
+    case G_SOCKET_CLIENT_CONNECTED:
+      pThis->m_connections++;
+      break;
+
+    case G_SOCKET_CLIENT_TLS_HANDSHAKED:
+      pThis->m_tlsHandshakes++;
+      break;
+
+    default:
+      break;
+  }
+}
+
+HttpSession::Stats HttpSession::getStats () const
+{
+  Stats stats;
+  stats.requests = m_requests;
+  stats.connections = m_connections;
+  stats.dnsLookups = m_dnsLookups;
+  stats.tlsHandshakes = m_tlsHandshakes;
+  return stats;
+}
+
+void HttpSession::Stats::addTo (GVariantBuilder *builder) const
+{
+  g_variant_builder_add (builder, "{sv}", "httpRequests", g_variant_new_uint64 (requests));
+  g_variant_builder_add (builder, "{sv}", "httpConnections", g_variant_new_uint64 (connections));
+  g_variant_builder_add (builder, "{sv}", "httpReused", g_variant_new_uint64 (requests > connections ? requests - connections : 0));
+  g_variant_builder_add (builder, "{sv}", "dnsLookups", g_variant_new_uint64 (dnsLookups));
+  g_variant_builder_add (builder, "{sv}", "tlsHandshakes", g_variant_new_uint64 (tlsHandshakes));
+}
+
+void HttpSession::Stats::addFrom (GVariant *dict)
+{
+  guint64 value = 0;
+
+  if (g_variant_lookup (dict, "httpRequests", "t", &value))
+    requests += value;
+
+  if (g_variant_lookup (dict, "httpConnections", "t", &value))
+    connections += value;
+
+  if (g_variant_lookup (dict, "dnsLookups", "t", &value))
+    dnsLookups += value;
+
+  if (g_variant_lookup (dict, "tlsHandshakes", "t", &value))
+    tlsHandshakes += value;
+}
+
+void HttpSession::Stats::add (const Stats &other)
+{
+  requests += other.requests;
+  connections += other.connections;
+  dnsLookups += other.dnsLookups;
+  tlsHandshakes += other.tlsHandshakes;
+}
+
+namespace
+{
+  // a local stand-in for a media server, on a thread with its own main loop
+  class TestServer
+  {
+    public:
+      TestServer ()
+      {
+        unique_lock<mutex> lock (m_mutex);
+
+        m_thread = thread ([this] ()
+        {
+          run ();
+        });
+
+        m_ready.wait (lock, [this] () { return m_loop != NULL; });
+      }
+
+      ~TestServer ()
+      {
+        g_main_loop_quit (m_loop);
+        m_thread.join ();
+        g_main_loop_unref (m_loop);
+      }
+
+      string getUri (const gchar *path) const
+      {
+        return m_uri + path;
+      }
+
+    private:
+      static void onRequest (SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, gpointer data)
+      {
+        soup_message_set_status (msg, SOUP_STATUS_OK);
+        soup_message_set_response (msg, "audio/L16", SOUP_MEMORY_STATIC, "\0\0\0\0", 4);
+      }
+
+      void run ()
+      {
+        GMainContext *context = g_main_context_new ();
+        g_main_context_push_thread_default (context);
+
+        SoupServer *server = soup_server_new (NULL, NULL);
+        soup_server_add_handler (server, NULL, &TestServer::onRequest, NULL, NULL);
+        gboolean listening = soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, NULL);
+        g_assert (listening);
+
+        GSList *uris = soup_server_get_uris (server);
+        gchar *uri = soup_uri_to_string ((SoupURI *) uris->data, FALSE);
+        g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+
+        GMainLoop *loop = g_main_loop_new (context, FALSE);
+
+        {
+          lock_guard<mutex> lock (m_mutex);
+          m_uri = uri;
+          m_loop = loop;
+          m_ready.notify_all ();
+        }
+
+        g_free (uri);
+        g_main_loop_run (loop);
+
+        soup_server_disconnect (server);
+        g_object_unref (server);
+        g_main_context_pop_thread_default (context);
+        g_main_context_unref (context);
+      }
+
+      mutex m_mutex;
+      condition_variable m_ready;
+      thread m_thread;
+      GMainLoop *m_loop = NULL;
+      string m_uri;
+  };
+}
+
+static void test_connectionReuse ()
+{
+  TestServer server;
+  HttpSession &session = HttpSession::get ();
+  HttpSession::Stats before = session.getStats ();
+
+  for (const gchar *path : { "track1.wav", "track2.wav", "track3.wav" })
+  {
+    SoupMessage *msg = soup_message_new ("GET", server.getUri (path).c_str ());
+    guint status = soup_session_send_message (session.getSession (), msg);
+    g_assert_cmpuint (status, ==, SOUP_STATUS_OK);
+    g_object_unref (msg);
+  }
+
+  HttpSession::Stats after = session.getStats ();
+
+  // one connection, kept alive for the following tracks
+  g_assert_cmpuint (after.requests - before.requests, ==, 3);
+  g_assert_cmpuint (after.connections - before.connections, ==, 1);
+  g_assert_cmpuint (after.tlsHandshakes - before.tlsHandshakes, ==, 0);
+
+  soup_session_abort (session.getSession ());
+}
+
+static void test_settings ()
+{
+  guint timeout = 0;
+  gboolean systemCa = FALSE;
+  gboolean strict = FALSE;
+
+  g_object_get (HttpSession::get ().getSession (),
+                SOUP_SESSION_TIMEOUT, &timeout,
+                SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE, &systemCa,
+                SOUP_SESSION_SSL_STRICT, &strict,
+                NULL);
+
+  g_assert_cmpuint (timeout, ==, 15);
+  g_assert (systemCa);
+  g_assert (strict);
+}
+
+void HttpSession::registerTests ()
+{
+  g_test_add_func ("/HttpSession/connectionReuse", test_connectionReuse);
+  g_test_add_func ("/HttpSession/settings", test_settings);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <libsoup/soup.h>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+/**
+ * HttpSession is the one SoupSession all streams of the process share, so
+ * consecutive tracks from the same media server and parallel streams reuse
+ * pooled keep-alive connections instead of paying for DNS, TCP and TLS
+ * setup every time.
+ *
+ * souphttpsrc takes it as a GstContext of type "gst.soup.session". Newer
+ * souphttpsrc versions wrap the session in a type of their own and ignore
+ * ours; the first of those sources shares its session with HAVE_CONTEXT, and
+ * that context is handed to all later sources instead.
+ */
+class HttpSession
+{
+  public:
+    struct Stats
+    {
+      guint64 requests = 0;
+      guint64 connections = 0;
+      guint64 dnsLookups = 0;
+      guint64 tlsHandshakes = 0;
+
+      // the counters below as httpRequests, httpConnections, httpReused, dnsLookups and tlsHandshakes
+      void addTo (GVariantBuilder *builder) const;
+      void addFrom (GVariant *dict);
+      void add (const Stats &other);
+    };
+
+    static HttpSession &get ();
+
+    // for plain libsoup requests, e.g. by RawPcmSource
+    SoupSession *getSession () const;
+
+    // before the source leaves the NULL state
+    void attach (GstElement *source);
+
+    // from a sync bus handler, answers NEED_CONTEXT and picks up HAVE_CONTEXT, true if handled
+    bool onContextMessage (GstMessage *message);
+
+    Stats getStats () const;
+
+    static void registerTests ();
+
+    static const gchar *CONTEXT_TYPE;
+
+  private:
+    HttpSession ();
+    ~HttpSession ();
+
+    GstContext *getContext ();
+
+    static void onRequestQueued (SoupSession *session, SoupMessage *msg, HttpSession *pThis);
+    static void onNetworkEvent (SoupMessage *msg, GSocketClientEvent event, GIOStream *connection, HttpSession *pThis);
+
+    SoupSession *m_session;
+
+    mutable mutex m_mutex;
+    GstContext *m_context;
+
+    atomic<guint64> m_requests { 0 };
+    atomic<guint64> m_connections { 0 };
+    atomic<guint64> m_dnsLookups { 0 };
+    atomic<guint64> m_tlsHandshakes { 0 };
+};
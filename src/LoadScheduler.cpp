@@ -0,0 +1,297 @@
+#include "LoadScheduler.h"
+#include "Trace.h"
+
+namespace
+{
+  // assumed load of the first stream, before anything has been measured
+  const double DEFAULT_STREAM_LOAD = 0.05;
+
+  // degrade above this share of the budget, restore below the other one
+  const double DEGRADE_THRESHOLD = 0.85;
+  const double RESTORE_THRESHOLD = 0.6;
+}
+
+LoadScheduler::LoadScheduler (double budget) :
+    m_budget (budget),
+    m_sequence (0)
+{
+}
+
+bool LoadScheduler::admit (uint64_t id, gint32 priority, string &reason)
+{
+  double total = getTotalLoad ();
+
+  if (m_budget > 0 && total + estimateNewStream () > m_budget)
+  {
+    gchar *msg = g_strdup_printf ("CPU budget exhausted, %.2f of %.2f cores in use by %u streams",
+                                  total, m_budget, (guint) m_streams.size ());
+    reason = msg;
+    g_free (msg);
+    return false;
+  }
+
+  Stream stream = { priority, m_sequence++, 0, QUALITY_FULL, QUALITY_LOW_RATE, false };
+  m_streams[id] = stream;
+  return true;
+}
+
+void LoadScheduler::remove (uint64_t id)
+{
+  m_streams.erase (id);
+}
+
+void LoadScheduler::report (uint64_t id, double load)
+{
+  auto it = m_streams.find (id);
+
+  if (it != m_streams.end ())
+  {
+    it->second.load = load;
+    it->second.pending = false;
+  }
+}
+
+void LoadScheduler::setLowestQuality (uint64_t id, Quality quality)
+{
+  auto it = m_streams.find (id);
+
+  if (it != m_streams.end ())
+    it->second.lowest = quality;
+}
+
+bool LoadScheduler::rebalance (uint64_t &id, Quality &quality)
+{
+  if (m_budget <= 0)
+    return false;
+
+  // the total still holds the load from before the last step
+  for (auto &stream : m_streams)
+  {
+    if (stream.second.pending)
+      return false;
+  }
+
+  double total = getTotalLoad ();
+  auto victim = m_streams.end ();
+
+  if (total > DEGRADE_THRESHOLD * m_budget)
+  {
+    // lowest priority first, the newest of those, skipping steps that wouldn't save anything
+    for (auto it = m_streams.begin (); it != m_streams.end (); ++it)
+    {
+      if (it->second.quality >= it->second.lowest)
+        continue;
+
+      if (victim == m_streams.end () || it->second.priority < victim->second.priority
+          || (it->second.priority == victim->second.priority && it->second.sequence > victim->second.sequence))
+        victim = it;
+    }
+
+    if (victim == m_streams.end ())
+      return false;
+
+    victim->second.quality = Quality (victim->second.quality + 1);
+  }
+  else if (total < RESTORE_THRESHOLD * m_budget)
+  {
+    // the reverse order: highest priority first, the oldest of those
+    for (auto it = m_streams.begin (); it != m_streams.end (); ++it)
+    {
+      if (it->second.quality == QUALITY_FULL)
+        continue;
+
+      if (victim == m_streams.end () || it->second.priority > victim->second.priority
+          || (it->second.priority == victim->second.priority && it->second.sequence < victim->second.sequence))
+        victim = it;
+    }
+
+    if (victim == m_streams.end ())
+      return false;
+
+    victim->second.quality = Quality (victim->second.quality - 1);
+  }
+  else
+  {
+    return false;
+  }
+
+  Tracer::info ("LoadScheduler: load", total, "of", m_budget, "cores, stream", victim->first, "now at quality", victim->second.quality);
+
+  victim->second.pending = true;
+  id = victim->first;
+  quality = victim->second.quality;
+  return true;
+}
+
+double LoadScheduler::getBudget () const
+{
+  return m_budget;
+}
+
+double LoadScheduler::getTotalLoad () const
+{
+  double total = 0;
+
+  for (auto &stream : m_streams)
+    total += stream.second.load;
+
+  return total;
+}
+
+double LoadScheduler::estimateNewStream () const
+{
+  double total = 0;
+  int measured = 0;
+
+  for (auto &stream : m_streams)
+  {
+    if (stream.second.load > 0)
+    {
+      total += stream.second.load;
+      measured++;
+    }
+  }
+
+  return measured ? total / measured : DEFAULT_STREAM_LOAD;
+}
+
+static void test_rejectsWhenExhausted ()
+{
+  LoadScheduler scheduler (1.0);
+  string reason;
+
+  g_assert (scheduler.admit (1, 0, reason));
+  scheduler.report (1, 0.3);
+  g_assert (scheduler.admit (2, 0, reason));
+  scheduler.report (2, 0.3);
+  g_assert (scheduler.admit (3, 0, reason));
+  scheduler.report (3, 0.3);
+
+  g_assert (!scheduler.admit (4, 0, reason));
+  g_assert (!reason.empty ());
+
+  scheduler.remove (3);
+  g_assert (scheduler.admit (4, 0, reason));
+}
+
+static void test_degradesNewestLowestPriority ()
+{
+  LoadScheduler scheduler (1.0);
+  string reason;
+  uint64_t id = 0;
+  LoadScheduler::Quality quality;
+
+  scheduler.admit (1, 0, reason);
+  scheduler.admit (2, 5, reason);
+  scheduler.admit (3, 0, reason);
+  scheduler.report (1, 0.3);
+  scheduler.report (2, 0.3);
+  scheduler.report (3, 0.3);
+
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 3);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_CHEAP_RESAMPLER);
+
+  scheduler.report (3, 0.3);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 3);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_LOW_RATE);
+
+  scheduler.report (3, 0.3);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 1);
+
+  // load dropped, the last degraded stream comes back first
+  scheduler.report (1, 0.3);
+  scheduler.report (3, 0.1);
+  scheduler.report (2, 0.1);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 1);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_FULL);
+}
+
+static void test_waitsForFreshReport ()
+{
+  LoadScheduler scheduler (1.0);
+  string reason;
+  uint64_t id = 0;
+  LoadScheduler::Quality quality;
+
+  scheduler.admit (1, 0, reason);
+  scheduler.admit (2, 0, reason);
+  scheduler.report (1, 0.5);
+  scheduler.report (2, 0.5);
+
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 2);
+
+  // the load of stream 2 is from before the step, another report of stream 1 doesn't count
+  scheduler.report (1, 0.5);
+  g_assert (!scheduler.rebalance (id, quality));
+
+  scheduler.report (2, 0.45);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 2);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_LOW_RATE);
+}
+
+static void test_skipsStepsWithoutEffect ()
+{
+  LoadScheduler scheduler (1.0);
+  string reason;
+  uint64_t id = 0;
+  LoadScheduler::Quality quality;
+
+  scheduler.admit (1, 0, reason);
+  scheduler.admit (2, 0, reason);
+  scheduler.admit (3, 0, reason);
+  scheduler.report (1, 0.3);
+  scheduler.report (2, 0.3);
+  scheduler.report (3, 0.3);
+
+  // 3 is passed on undecoded, 2 uses the legacy protocol which can't change the rate
+  scheduler.setLowestQuality (3, LoadScheduler::QUALITY_FULL);
+  scheduler.setLowestQuality (2, LoadScheduler::QUALITY_CHEAP_RESAMPLER);
+
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 2);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_CHEAP_RESAMPLER);
+
+  scheduler.report (2, 0.3);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 1);
+
+  scheduler.report (1, 0.3);
+  g_assert (scheduler.rebalance (id, quality));
+  g_assert_cmpuint (id, ==, 1);
+  g_assert_cmpint (quality, ==, LoadScheduler::QUALITY_LOW_RATE);
+
+  // nothing left that would help
+  scheduler.report (1, 0.3);
+  g_assert (!scheduler.rebalance (id, quality));
+}
+
+static void test_unlimitedBudget ()
+{
+  LoadScheduler scheduler (0);
+  string reason;
+  uint64_t id = 0;
+  LoadScheduler::Quality quality;
+
+  for (uint64_t i = 1; i <= 100; i++)
+  {
+    g_assert (scheduler.admit (i, 0, reason));
+    scheduler.report (i, 1.0);
+  }
+
+  g_assert (!scheduler.rebalance (id, quality));
+}
+
+void LoadScheduler::registerTests ()
+{
+  g_test_add_func ("/LoadScheduler/rejectsWhenExhausted", test_rejectsWhenExhausted);
+  g_test_add_func ("/LoadScheduler/degradesNewestLowestPriority", test_degradesNewestLowestPriority);
+  g_test_add_func ("/LoadScheduler/waitsForFreshReport", test_waitsForFreshReport);
+  g_test_add_func ("/LoadScheduler/skipsStepsWithoutEffect", test_skipsStepsWithoutEffect);
+  g_test_add_func ("/LoadScheduler/unlimitedBudget", test_unlimitedBudget);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glib.h>
+#include <cstdint>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * LoadScheduler keeps the measured CPU load of all streams within a budget.
+ *
+ * Loads are given in cores, i.e. CPU seconds per second of audio. New streams
+ * are rejected once the budget is exhausted. Near the limit, the streams with
+ * the lowest priority, and among those the newest, are degraded one step at a
+ * time. They are restored in reverse order when the load has dropped again.
+ * After every step, the next one waits for a fresh report of the stream that
+ * changed, so its old load isn't taken for the effect of the step.
+ */
+class LoadScheduler
+{
+  public:
+    enum Quality
+    {
+      QUALITY_FULL,
+      QUALITY_CHEAP_RESAMPLER,
+      QUALITY_LOW_RATE
+    };
+
+    // budget in cores, 0 means unlimited
+    LoadScheduler (double budget);
+
+    // false if the stream doesn't fit, reason tells why
+    bool admit (uint64_t id, gint32 priority, string &reason);
+    void remove (uint64_t id);
+
+    void report (uint64_t id, double load);
+
+    // the lowest quality that still saves CPU, e.g. QUALITY_FULL for a stream passed on undecoded
+    void setLowestQuality (uint64_t id, Quality quality);
+
+    // degrades or restores at most one stream, returns true and the new quality if it did
+    bool rebalance (uint64_t &id, Quality &quality);
+
+    double getBudget () const;
+    double getTotalLoad () const;
+
+    static void registerTests ();
+
+  private:
+    struct Stream
+    {
+      gint32 priority;
+      guint64 sequence;
+      double load;
+      Quality quality;
+      Quality lowest;
+      bool pending;   // changed since its last report
+    };
+
+    double estimateNewStream () const;
+
+    double m_budget;
+    guint64 m_sequence;
+    map<uint64_t, Stream> m_streams;
+};
@@ -0,0 +1,339 @@
+#include "OutputMultiplexer.h"
+#include "ThreadPolicy.h"
+#include "Trace.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace
+{
+  const int MAX_EVENTS = 64;
+
+  // give back memory once this much of the queue has been written
+  const gsize COMPACT_THRESHOLD = 64 * 1024;
+}
+
+OutputMultiplexer::Channel::Channel (OutputMultiplexer &owner, int fd, gsize capacity) :
+    m_owner (owner),
+    m_fd (fd),
+    m_capacity (capacity)
+{
+}
+
+bool OutputMultiplexer::Channel::write (const void *data, gsize size)
+{
+  unique_lock<mutex> lock (m_mutex);
+
+  if (m_queue.size () - m_head >= m_capacity && !m_stopped && !m_failed)
+  {
+    gint64 startUs = g_get_monotonic_time ();
+
+    m_canWrite.wait (lock, [this] ()
+    {
+      return m_stopped || m_failed || m_queue.size () - m_head < m_capacity;
+    });
+
+    m_blockedUs += g_get_monotonic_time () - startUs;
+  }
+
+  if (m_stopped || m_failed)
+    return false;
+
+  const guint8 *bytes = (const guint8 *) data;
+  m_queue.insert (m_queue.end (), bytes, bytes + size);
+  m_ends.push_back (m_queue.size ());
+
+  arm ();
+  return true;
+}
+
+void OutputMultiplexer::Channel::finish ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_finished = true;
+  arm ();
+}
+
+void OutputMultiplexer::Channel::discard ()
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  if (m_head > m_frontStart)
+  {
+    // the renderer has part of this write already, the rest has to follow
+    m_queue.resize (m_ends.front ());
+    m_ends.resize (1);
+  }
+  else
+  {
+    m_queue.clear ();
+    m_ends.clear ();
+    m_head = 0;
+    m_frontStart = 0;
+  }
+
+  m_canWrite.notify_all ();
+}
+
+void OutputMultiplexer::Channel::stop ()
+{
+  unique_lock<mutex> lock (m_mutex);
+  m_stopped = true;
+  m_queue.clear ();
+  m_ends.clear ();
+  m_head = 0;
+  m_frontStart = 0;
+  m_canWrite.notify_all ();
+
+  if (m_closed)
+    return;
+
+  // a renderer that stopped reading never makes a full pipe writable again, so don't wait for EPOLLOUT
+  m_closed = true;
+  lock.unlock ();
+  m_owner.remove (*this);
+}
+
+void OutputMultiplexer::Channel::arm ()
+{
+  // one shot, the output thread re-arms while something is left
+  if (m_armed || m_closed)
+    return;
+
+  struct epoll_event event;
+  event.events = EPOLLOUT | EPOLLONESHOT;
+  event.data.ptr = this;
+
+  if (epoll_ctl (m_owner.m_epoll, EPOLL_CTL_MOD, m_fd, &event) == 0)
+    m_armed = true;
+  else
+    Tracer::warning ("OutputMultiplexer: cannot watch pipe,", strerror (errno));
+}
+
+gsize OutputMultiplexer::Channel::getQueued () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_queue.size () - m_head;
+}
+
+gint64 OutputMultiplexer::Channel::getBlockedUs () const
+{
+  return m_blockedUs;
+}
+
+guint64 OutputMultiplexer::Channel::getFullCount () const
+{
+  return m_fullCount;
+}
+
+OutputMultiplexer &OutputMultiplexer::get ()
+{
+  static OutputMultiplexer multiplexer;
+  return multiplexer;
+}
+
+OutputMultiplexer::OutputMultiplexer () :
+    m_epoll (epoll_create1 (EPOLL_CLOEXEC)),
+    m_wakeUp (eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl (m_epoll, EPOLL_CTL_ADD, m_wakeUp, &event);
+
+  m_thread = thread ([this] ()
+  {
+    run ();
+  });
+}
+
+OutputMultiplexer::~OutputMultiplexer ()
+{
+  m_quit = true;
+  wakeUp ();
+
+  if (m_thread.joinable ())
+    m_thread.join ();
+
+  for (auto &channel : m_channels)
+    close (channel.first);
+
+  close (m_wakeUp);
+  close (m_epoll);
+}
+
+shared_ptr<OutputMultiplexer::Channel> OutputMultiplexer::open (int fd, gsize capacity)
+{
+  shared_ptr<Channel> channel (new Channel (*this, fd, capacity));
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  // registered without interest, write () and finish () arm it
+  struct epoll_event event;
+  event.events = EPOLLONESHOT;
+  event.data.ptr = channel.get ();
+
+  if (epoll_ctl (m_epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+  {
+    Tracer::alarm ("OutputMultiplexer: cannot add pipe,", strerror (errno));
+    return shared_ptr<Channel> ();
+  }
+
+  lock_guard<mutex> lock (m_mutex);
+  m_channels[fd] = channel;
+  return channel;
+}
+
+void OutputMultiplexer::run ()
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  // the pipes of all streams are written from here, so it's as much on the audio path as the decoders
+  string policy = ThreadPolicy::getDefault ().apply ();
+
+  if (!policy.empty ())
+    Tracer::info ("OutputMultiplexer: output thread runs as", policy);
+
+  while (!m_quit)
+  {
+    int numEvents = epoll_wait (m_epoll, events, MAX_EVENTS, -1);
+
+    if (numEvents < 0 && errno != EINTR)
+    {
+      Tracer::alarm ("OutputMultiplexer: epoll_wait failed,", strerror (errno));
+      break;
+    }
+
+    for (int i = 0; i < numEvents; i++)
+    {
+      if (Channel *channel = (Channel *) events[i].data.ptr)
+      {
+        flush (*channel);
+      }
+      else
+      {
+        guint64 count;
+
+        if (read (m_wakeUp, &count, sizeof (count)) < 0 && errno != EAGAIN)
+          Tracer::warning ("OutputMultiplexer: cannot read wake-up event,", strerror (errno));
+      }
+    }
+
+    vector<shared_ptr<Channel>> removed;
+
+    {
+      lock_guard<mutex> lock (m_mutex);
+      removed.swap (m_removed);
+    }
+
+    // may release the last references
+    removed.clear ();
+  }
+}
+
+void OutputMultiplexer::wakeUp ()
+{
+  guint64 one = 1;
+
+  if (::write (m_wakeUp, &one, sizeof (one)) < 0)
+    Tracer::warning ("OutputMultiplexer: cannot wake up output thread,", strerror (errno));
+}
+
+void OutputMultiplexer::flush (Channel &channel)
+{
+  unique_lock<mutex> lock (channel.m_mutex);
+  channel.m_armed = false;
+
+  // stop () closed the pipe after this event was reported
+  if (channel.m_closed)
+    return;
+
+  while (channel.m_head < channel.m_queue.size ())
+  {
+    ssize_t written = ::write (channel.m_fd, channel.m_queue.data () + channel.m_head, channel.m_queue.size () - channel.m_head);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+
+    if (written < 0 && errno == EAGAIN)
+    {
+      // the renderer is behind, wait for it to read
+      channel.m_fullCount++;
+      break;
+    }
+
+    if (written < 0)
+    {
+      if (!channel.m_stopped)
+        Tracer::warning ("OutputMultiplexer: write failed,", strerror (errno));
+
+      channel.m_failed = true;
+      break;
+    }
+
+    channel.m_head += written;
+  }
+
+  while (!channel.m_ends.empty () && channel.m_ends.front () <= channel.m_head)
+  {
+    channel.m_frontStart = channel.m_ends.front ();
+    channel.m_ends.pop_front ();
+  }
+
+  if (channel.m_head == channel.m_queue.size ())
+  {
+    channel.m_queue.clear ();
+    channel.m_head = 0;
+    channel.m_frontStart = 0;
+  }
+  else if (channel.m_frontStart >= COMPACT_THRESHOLD)
+  {
+    // only whole writes, discard () needs to know where the one in progress started
+    gsize written = channel.m_frontStart;
+    channel.m_queue.erase (channel.m_queue.begin (), channel.m_queue.begin () + written);
+    channel.m_head -= written;
+    channel.m_frontStart = 0;
+
+    for (gsize &end : channel.m_ends)
+      end -= written;
+  }
+
+  channel.m_canWrite.notify_all ();
+
+  bool drained = channel.m_queue.empty ();
+
+  if (channel.m_failed || channel.m_stopped || (channel.m_finished && drained))
+  {
+    channel.m_closed = true;
+    lock.unlock ();
+    remove (channel);
+    return;
+  }
+
+  if (!drained)
+    channel.arm ();
+}
+
+void OutputMultiplexer::remove (Channel &channel)
+{
+  {
+    // the descriptor may be reused by the next pipe as soon as it is closed
+    lock_guard<mutex> lock (m_mutex);
+    auto it = m_channels.find (channel.m_fd);
+
+    if (it != m_channels.end ())
+    {
+      m_removed.push_back (it->second);
+      m_channels.erase (it);
+    }
+
+    epoll_ctl (m_epoll, EPOLL_CTL_DEL, channel.m_fd, NULL);
+    close (channel.m_fd);
+  }
+
+  // an event already reported for the channel is flushed before the output thread releases it
+  wakeUp ();
+}
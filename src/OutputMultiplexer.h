@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * OutputMultiplexer writes the audio of all streams to the renderers' pipes
+ * from a single thread. The pipes are switched to non-blocking mode and
+ * driven by epoll, so the number of threads doesn't grow with the number of
+ * streams, and a renderer that stops reading shows up in the statistics of
+ * its own Channel instead of as a thread parked in write ().
+ */
+class OutputMultiplexer
+{
+  public:
+    class Channel
+    {
+      public:
+        // queues the data, blocks while more than the capacity is queued, false once failed or stopped
+        bool write (const void *data, gsize size);
+
+        // closes the pipe once everything queued is written
+        void finish ();
+
+        // drops what is not yet written, e.g. after a seek, unblocks a waiting writer; a write () the
+        // renderer got partly is completed, so it stays in sync with frames and chunk headers
+        void discard ();
+
+        // drops everything queued and closes the pipe right away, unblocks a waiting writer
+        void stop ();
+
+        gsize getQueued () const;
+
+        // how long writers waited for the renderer, and how often its pipe was full
+        gint64 getBlockedUs () const;
+        guint64 getFullCount () const;
+
+      private:
+        friend class OutputMultiplexer;
+
+        Channel (OutputMultiplexer &owner, int fd, gsize capacity);
+
+        void arm ();
+
+        OutputMultiplexer &m_owner;
+        int m_fd;
+        gsize m_capacity;
+
+        vector<guint8> m_queue;
+        gsize m_head = 0;
+
+        // where the queued writes end and the first of them starts, all offsets into m_queue
+        deque<gsize> m_ends;
+        gsize m_frontStart = 0;
+
+        bool m_armed = false;
+        bool m_finished = false;
+        bool m_stopped = false;
+        bool m_failed = false;
+        bool m_closed = false;
+
+        atomic<gint64> m_blockedUs { 0 };
+        atomic<guint64> m_fullCount { 0 };
+
+        mutable mutex m_mutex;
+        condition_variable m_canWrite;
+    };
+
+    static OutputMultiplexer &get ();
+
+    // takes over the write end of a pipe, which is closed by the channel
+    shared_ptr<Channel> open (int fd, gsize capacity);
+
+  private:
+    OutputMultiplexer ();
+    ~OutputMultiplexer ();
+
+    void run ();
+    void flush (Channel &channel);
+    void remove (Channel &channel);
+    void wakeUp ();
+
+    int m_epoll;
+    int m_wakeUp;
+    atomic<bool> m_quit { false };
+
+    // keeps every channel alive until its pipe is closed on the output thread
+    mutex m_mutex;
+    map<int, shared_ptr<Channel>> m_channels;
+
+    // removed channels, released by the output thread once no event of its last epoll_wait () refers to them
+    vector<shared_ptr<Channel>> m_removed;
+
+    thread m_thread;
+};
@@ -0,0 +1,220 @@
+#include "OutputSpool.h"
+#include "Trace.h"
+#include <string.h>
+
+namespace
+{
+  // refill once the spool has drained to a quarter
+  const gsize LOW_WATERMARK_DIVISOR = 4;
+
+  // the pipe takes 64 KiB at most anyway
+  const gsize DRAIN_CHUNK_SIZE = 16 * 1024;
+}
+
+OutputSpool::OutputSpool (GOutputStream *output, gsize capacity) :
+    m_output (G_OUTPUT_STREAM (g_object_ref (output))),
+    m_cancellable (g_cancellable_new ()),
+    m_ring (capacity)
+{
+  m_thread = thread ([this] ()
+  {
+    drain ();
+  });
+}
+
+OutputSpool::~OutputSpool ()
+{
+  stop ();
+
+  if (m_thread.joinable ())
+    m_thread.join ();
+
+  g_object_unref (m_cancellable);
+  g_object_unref (m_output);
+}
+
+bool OutputSpool::write (const void *data, gsize size)
+{
+  const guint8 *bytes = (const guint8 *) data;
+  unique_lock<mutex> lock (m_mutex);
+
+  guint64 end = m_queued + size;
+  m_ends.push_back (end);
+
+  while (size > 0)
+  {
+    if (m_fill == m_ring.size () && m_refilling)
+    {
+      // the network may go idle until the renderer has eaten most of the spool
+      m_refilling = false;
+      m_idleSinceUs = g_get_monotonic_time ();
+    }
+
+    m_canWrite.wait (lock, [this] ()
+    {
+      return m_stopped || (m_refilling && m_fill < m_ring.size ());
+    });
+
+    if (m_stopped)
+      return false;
+
+    // a clear () while waiting dropped this write
+    if (m_ends.empty () || m_ends.back () != end)
+      return true;
+
+    gsize writePos = (m_readPos + m_fill) % m_ring.size ();
+    gsize chunk = MIN (size, MIN (m_ring.size () - m_fill, m_ring.size () - writePos));
+
+    memcpy (m_ring.data () + writePos, bytes, chunk);
+    m_fill += chunk;
+    m_queued += chunk;
+    bytes += chunk;
+    size -= chunk;
+
+    m_canDrain.notify_one ();
+  }
+
+  return true;
+}
+
+void OutputSpool::finish ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_finished = true;
+  m_canDrain.notify_one ();
+}
+
+void OutputSpool::clear ()
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  // the bytes in flight are as good as written
+  guint64 readTotal = m_queued - m_fill;
+  guint64 position = readTotal + m_inFlight;
+  guint64 start = m_frontStart;
+  auto it = m_ends.begin ();
+
+  for (; it != m_ends.end () && *it <= position; ++it)
+    start = *it;
+
+  if (it != m_ends.end () && start < position)
+  {
+    // the renderer has part of this write already, the rest has to follow
+    m_queued = MIN (m_queued, *it);
+    ++it;
+  }
+  else
+  {
+    m_queued = position;
+  }
+
+  m_ends.erase (it, m_ends.end ());
+  m_fill = m_queued - readTotal;
+
+  // with the ring still full the drain thread resumes refilling at the low watermark
+  if (!m_refilling && m_fill < m_ring.size ())
+  {
+    m_refilling = true;
+    m_idleUs += g_get_monotonic_time () - m_idleSinceUs;
+  }
+
+  m_canWrite.notify_all ();
+}
+
+void OutputSpool::stop ()
+{
+  {
+    lock_guard<mutex> lock (m_mutex);
+    m_stopped = true;
+  }
+
+  g_cancellable_cancel (m_cancellable);
+  m_canWrite.notify_all ();
+  m_canDrain.notify_all ();
+}
+
+gsize OutputSpool::getFill () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_fill;
+}
+
+gsize OutputSpool::getCapacity () const
+{
+  return m_ring.size ();
+}
+
+gint64 OutputSpool::getIdleUs () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  gint64 idleUs = m_idleUs;
+
+  if (!m_refilling)
+    idleUs += g_get_monotonic_time () - m_idleSinceUs;
+
+  return idleUs;
+}
+
+void OutputSpool::drain ()
+{
+  vector<guint8> chunk (DRAIN_CHUNK_SIZE);
+  unique_lock<mutex> lock (m_mutex);
+
+  while (true)
+  {
+    m_canDrain.wait (lock, [this] ()
+    {
+      return m_stopped || m_fill > 0 || m_finished;
+    });
+
+    if (m_stopped)
+      break;
+
+    if (m_fill == 0)
+    {
+      // finished and drained
+      g_output_stream_close (m_output, m_cancellable, NULL);
+      break;
+    }
+
+    gsize size = MIN (m_fill, MIN (chunk.size (), m_ring.size () - m_readPos));
+    memcpy (chunk.data (), m_ring.data () + m_readPos, size);
+    m_inFlight = size;
+
+    lock.unlock ();
+
+    GError *error = NULL;
+    bool success = g_output_stream_write_all (m_output, chunk.data (), size, NULL, m_cancellable, &error);
+
+    lock.lock ();
+    m_inFlight = 0;
+
+    if (!success)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        Tracer::warning ("OutputSpool: write failed,", error->message);
+
+      g_error_free (error);
+      m_stopped = true;
+      m_canWrite.notify_all ();
+      break;
+    }
+
+    // clear () keeps the bytes in flight
+    m_readPos = (m_readPos + size) % m_ring.size ();
+    m_fill -= size;
+
+    while (!m_ends.empty () && m_ends.front () <= m_queued - m_fill)
+    {
+      m_frontStart = m_ends.front ();
+      m_ends.pop_front ();
+    }
+
+    if (!m_refilling && m_fill <= m_ring.size () / LOW_WATERMARK_DIVISOR)
+    {
+      m_refilling = true;
+      m_idleUs += g_get_monotonic_time () - m_idleSinceUs;
+      m_canWrite.notify_all ();
+    }
+  }
+}
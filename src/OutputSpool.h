@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * OutputSpool decouples decoding from the renderer's reading pace.
+ *
+ * The streaming thread fills a bounded ring at full speed. Once the ring is
+ * full, writing blocks until the drain thread has emptied it down to the low
+ * watermark, so the network can idle in between instead of trickling along
+ * with playback.
+ */
+class OutputSpool
+{
+  public:
+    OutputSpool (GOutputStream *output, gsize capacity);
+    virtual ~OutputSpool ();
+
+    // blocks while the spool waits for the low watermark, false once stopped
+    bool write (const void *data, gsize size);
+
+    // closes the output as soon as everything is drained
+    void finish ();
+
+    // drops what is not yet written, e.g. after a seek; a write () the renderer got
+    // partly is completed, so it stays in sync with frames and chunk headers
+    void clear ();
+
+    // unblocks writers and the drain thread, nothing is written afterwards
+    void stop ();
+
+    gsize getFill () const;
+    gsize getCapacity () const;
+    gint64 getIdleUs () const;
+
+  private:
+    void drain ();
+
+    GOutputStream *m_output;
+    GCancellable *m_cancellable;
+
+    vector<guint8> m_ring;
+    gsize m_readPos = 0;
+    gsize m_fill = 0;
+
+    // stream offsets: everything ever put into the ring, the bytes the drain thread is writing
+    // right now, where the pending writes end and where the first of them started
+    guint64 m_queued = 0;
+    gsize m_inFlight = 0;
+    deque<guint64> m_ends;
+    guint64 m_frontStart = 0;
+
+    bool m_refilling = true;
+    bool m_finished = false;
+    bool m_stopped = false;
+
+    gint64 m_idleSinceUs = 0;
+    atomic<gint64> m_idleUs { 0 };
+
+    mutable mutex m_mutex;
+    condition_variable m_canWrite;
+    condition_variable m_canDrain;
+    thread m_thread;
+};
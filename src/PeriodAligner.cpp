@@ -0,0 +1,136 @@
+#include "PeriodAligner.h"
+#include <string.h>
+
+namespace
+{
+  const gint64 NS_PER_SECOND = G_GINT64_CONSTANT (1000000000);
+}
+
+PeriodAligner::PeriodAligner (gsize frameSize, guint32 periodFrames) :
+    m_frameSize (frameSize), m_periodFrames (periodFrames), m_staging (frameSize * periodFrames)
+{
+}
+
+bool PeriodAligner::push (const void *data, gsize size, gint64 pts, guint32 sampleRate, const tWriter &write)
+{
+  const guint8 *bytes = (const guint8 *) data;
+  gsize periodBytes = m_staging.size ();
+  gsize offset = 0;
+
+  auto getPts = [&] (gsize at) -> gint64
+  {
+    return pts < 0 || !sampleRate ? -1 : pts + (gint64) (at / m_frameSize) * NS_PER_SECOND / sampleRate;
+  };
+
+  if (m_stagedBytes > 0)
+  {
+    offset = MIN (periodBytes - m_stagedBytes, size);
+    memcpy (m_staging.data () + m_stagedBytes, bytes, offset);
+    m_stagedBytes += offset;
+
+    if (m_stagedBytes < periodBytes)
+      return true;
+
+    m_stagedBytes = 0;
+
+    if (!write (m_staging.data (), m_periodFrames, m_stagedPts))
+      return false;
+  }
+
+  for (; size - offset >= periodBytes; offset += periodBytes)
+  {
+    if (!write (bytes + offset, m_periodFrames, getPts (offset)))
+      return false;
+  }
+
+  if (offset < size)
+  {
+    m_stagedBytes = size - offset;
+    m_stagedPts = getPts (offset);
+    memcpy (m_staging.data (), bytes + offset, m_stagedBytes);
+  }
+
+  return true;
+}
+
+bool PeriodAligner::flush (const tWriter &write)
+{
+  if (!m_stagedBytes)
+    return true;
+
+  guint32 numFrames = m_stagedBytes / m_frameSize;
+  m_stagedBytes = 0;
+  return write (m_staging.data (), numFrames, m_stagedPts);
+}
+
+void PeriodAligner::clear ()
+{
+  m_stagedBytes = 0;
+}
+
+guint32 PeriodAligner::getPeriodFrames () const
+{
+  return m_periodFrames;
+}
+
+guint32 PeriodAligner::getStagedFrames () const
+{
+  return m_stagedBytes / m_frameSize;
+}
+
+static void test_periods ()
+{
+  // one byte frames keep the numbers readable
+  PeriodAligner aligner (1, 4);
+  vector<guint8> written;
+  vector<guint32> frames;
+  vector<gint64> pts;
+
+  auto write = [&] (const void *data, guint32 numFrames, gint64 framePts)
+  {
+    written.insert (written.end (), (const guint8 *) data, (const guint8 *) data + numFrames);
+    frames.push_back (numFrames);
+    pts.push_back (framePts);
+    return true;
+  };
+
+  const guint8 first[] = { 0, 1, 2, 3, 4, 5 };
+  const guint8 second[] = { 6, 7, 8 };
+
+  // at 1000 Hz, a frame lasts one millisecond
+  g_assert (aligner.push (first, sizeof (first), 0, 1000, write));
+  g_assert_cmpuint (frames.size (), ==, 1);
+  g_assert_cmpuint (aligner.getStagedFrames (), ==, 2);
+
+  g_assert (aligner.push (second, sizeof (second), 6000000, 1000, write));
+  g_assert_cmpuint (frames.size (), ==, 2);
+  g_assert_cmpuint (frames[1], ==, 4);
+  g_assert_cmpint (pts[1], ==, 4000000);
+  g_assert_cmpuint (aligner.getStagedFrames (), ==, 1);
+
+  g_assert (aligner.flush (write));
+  g_assert_cmpuint (frames.size (), ==, 3);
+  g_assert_cmpuint (frames[2], ==, 1);
+  g_assert_cmpint (pts[2], ==, 8000000);
+  g_assert (aligner.flush (write));
+  g_assert_cmpuint (frames.size (), ==, 3);
+
+  for (guint8 i = 0; i < written.size (); i++)
+    g_assert_cmpuint (written[i], ==, i);
+
+  g_assert_cmpint (pts[0], ==, 0);
+
+  // unknown timestamps stay unknown, dropped frames don't come back
+  g_assert (aligner.push (first, sizeof (first), -1, 1000, write));
+  g_assert_cmpuint (frames.size (), ==, 4);
+  g_assert_cmpint (pts[3], ==, -1);
+
+  aligner.clear ();
+  g_assert (aligner.flush (write));
+  g_assert_cmpuint (frames.size (), ==, 4);
+}
+
+void PeriodAligner::registerTests ()
+{
+  g_test_add_func ("/PeriodAligner/periods", test_periods);
+}
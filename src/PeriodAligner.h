@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glib.h>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+/**
+ * PeriodAligner cuts the decoded PCM into the renderer's ALSA period size,
+ * whatever size the decoder produced (1152 frames for MP3, 1024 for AAC,
+ * the block size for FLAC), so every write carries exactly one period.
+ *
+ * Whole periods within a buffer are passed on in place; only the frames
+ * left over at its end are staged until the next buffer completes them.
+ */
+class PeriodAligner
+{
+  public:
+    // data, frames and pts of one period, false stops the current push
+    typedef function<bool (const void *data, guint32 numFrames, gint64 pts)> tWriter;
+
+    PeriodAligner (gsize frameSize, guint32 periodFrames);
+
+    // pts is the one of the first frame in data, -1 if unknown
+    bool push (const void *data, gsize size, gint64 pts, guint32 sampleRate, const tWriter &write);
+
+    // passes on the staged frames as a short period, before the end of the stream or a format change
+    bool flush (const tWriter &write);
+
+    // drops the staged frames, e.g. after a seek
+    void clear ();
+
+    guint32 getPeriodFrames () const;
+    guint32 getStagedFrames () const;
+
+    static void registerTests ();
+
+  private:
+    gsize m_frameSize;
+    guint32 m_periodFrames;
+    vector<guint8> m_staging;
+    gsize m_stagedBytes = 0;
+    gint64 m_stagedPts = -1;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Framed pipe protocol, negotiated with the "framed" option of DecodeWithOptions.
+ *
+ * Instead of the leading 4 byte sample rate, every chunk written to the pipe
+ * starts with a ChunkHeader in host byte order, followed by payloadSize bytes.
+ */
+namespace PipeProtocol
+{
+  const guint32 CHUNK_MAGIC = 0x52464453; // "SDFR" in little endian
+
+  enum Format
+  {
+    FORMAT_PCM = 1,         // interleaved tSample, see StreamDecoder.h
+    FORMAT_COMPRESSED = 2,  // one encoded frame, numFrames is 0
+    FORMAT_CAPS = 3         // caps string describing the following compressed frames
+  };
+
+  enum Flags
+  {
+    FLAG_NONE = 0,
+    FLAG_FORMAT_CHANGED = 1 << 0,   // sample rate, format or channels differ from the previous chunk
+    FLAG_DISCONT = 1 << 1           // the chunk does not continue the previous one
+  };
+
+  struct ChunkHeader
+  {
+    guint32 magic;
+    guint32 payloadSize;
+    guint32 numFrames;
+    guint32 sampleRate;
+    guint16 format;
+    guint16 channels;
+    guint16 bitsPerSample;
+    guint16 flags;
+    gint64 pts;             // nanoseconds, -1 if unknown
+  };
+
+  static_assert (sizeof (ChunkHeader) == 32, "ChunkHeader is part of the renderer ABI");
+}
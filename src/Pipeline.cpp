@@ -4,14 +4,65 @@
 #include <thread>
 #include <gio/gunixoutputstream.h>
 #include "Trace.h"
+#include "DecoderChain.h"
+#include "HttpSession.h"
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <time.h>
 
-Pipeline::Pipeline (uint64_t stream_id, const gchar* uri, GVariant *allowedSamplerates) :
-    m_id (stream_id), m_uri (uri), m_pipelineWatch(0), m_audioPipe(NULL), m_renderersPipe(0), m_close(false)
+namespace
+{
+  // room for the drift controller to keep the pipe half full
+  const int ADAPTIVE_PIPE_SIZE = 256 * 1024;
+  const gint64 DRIFT_UPDATE_INTERVAL_US = 100 * 1000;
+  const gint64 LATENCY_UPDATE_INTERVAL_US = 100 * 1000;
+
+  // queued for the output thread on top of what the pipe holds
+  const gsize OUTPUT_QUEUE_BYTES = 64 * 1024;
+
+  // only an exact match fits, otherwise the cheapest rate wins
+  const double DEGRADED_RESAMPLE_BUDGET = 1e-6;
+
+  gint64 getThreadCpuNs ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+  }
+}
+
+std::atomic<gint64> Pipeline::s_typefindAverageUs (0);
+
+Pipeline::Pipeline (uint64_t stream_id, const gchar* uri, GVariant *allowedSamplerates, const DecodeOptions &options, gint64 decodeStartUs) :
+    m_id (stream_id), m_uri (uri), m_options (options), m_pipeline(NULL), m_pipelineWatch(0), m_audioPipe(NULL), m_renderersPipe(0),
+    m_startup (decodeStartUs), m_close(false),
+    m_bytesWritten (0), m_sourceRate (0), m_targetRate (0), m_resampleCost (0), m_decodeStartUs (decodeStartUs)
 {
   m_cancellable = g_cancellable_new();
   setAllowedSamplerates (allowedSamplerates);
+
+  // without queues the source thread runs the whole chain
+  m_threads.setName (std::to_string (stream_id));
+  m_threads.assign ("httpsource", m_options.networkQueueBytes ? StreamingThreads::STAGE_NETWORK : StreamingThreads::STAGE_DECODE);
+  m_threads.assign ("networkqueue", StreamingThreads::STAGE_DECODE);
+  m_threads.assign ("outputqueue", StreamingThreads::STAGE_OUTPUT);
+  m_threads.setAffinity (StreamingThreads::STAGE_NETWORK, m_options.networkCpu);
+  m_threads.setAffinity (StreamingThreads::STAGE_DECODE, m_options.decodeCpu);
+  m_threads.setAffinity (StreamingThreads::STAGE_OUTPUT, m_options.outputCpu);
+
+  // the play position moves in whole PCM frames, chunk headers or encoded frames would break up
+  if (m_options.timeshiftMs > 0 && (m_options.framed || !m_options.passthroughCodecs.empty () || m_options.aheadWindowMs > 0))
+  {
+    Tracer::warning ("Pipeline: timeshift only works with plain PCM, ignoring framed, passthroughCodecs and aheadWindowMs");
+    m_options.framed = false;
+    m_options.passthroughCodecs.clear ();
+    m_options.aheadWindowMs = 0;
+  }
+
+  if (m_options.periodFrames)
+    m_periods.reset (new PeriodAligner (getFrameSize (), m_options.periodFrames));
 }
 
 Pipeline::~Pipeline ()
@@ -20,8 +71,33 @@ Pipeline::~Pipeline ()
 
   m_close = true;
 
+  if (m_spool)
+    m_spool->stop ();
+
+  if (m_output)
+    m_output->stop ();
+
+  if (m_replaySource)
+    m_replaySource->stop ();
+
+  if (m_timeshift)
+    m_timeshift->stop ();
+
   close(m_renderersPipe);
 
+  if (m_rawPcmSource)
+  {
+    g_cancellable_cancel(m_cancellable);
+    m_rawPcmSource.reset ();
+  }
+
+  // the source's thread is gone, a fallback or messages it posted are still pending
+  if (m_fallbackSource > 0)
+    g_source_remove (m_fallbackSource);
+
+  if (m_rawPcmMessageSource > 0)
+    g_source_remove (m_rawPcmMessageSource);
+
   if (m_pipelineWatch > 0)
     g_source_remove (m_pipelineWatch);
 
@@ -32,6 +108,10 @@ Pipeline::~Pipeline ()
     gst_object_unref (m_pipeline);
   }
 
+  m_replaySource.reset ();
+  m_spool.reset ();
+  m_timeshift.reset ();
+
   if(m_audioPipe)
     g_object_unref(m_audioPipe);
 
@@ -60,8 +140,25 @@ gint32 Pipeline::init ()
   {
     m_audioPipe = g_unix_output_stream_new (pipefd[1], TRUE);
     m_renderersPipe = pipefd[0];
-    setupGStreamer ();
 
+    if (m_options.adaptiveResampling && fcntl (pipefd[1], F_SETPIPE_SZ, ADAPTIVE_PIPE_SIZE) < 0)
+      Tracer::warning ("Pipeline: cannot resize pipe,", strerror (errno));
+
+    if (m_options.timeshiftMs > 0)
+      setupTimeshift ();
+    else if (m_options.aheadWindowMs > 0)
+      setupSpool ();
+
+    if (!m_spool && !m_timeshift)
+      setupOutputChannel ();
+
+    // captures record what souphttpsrc delivers, so they always take the GStreamer path
+    if (m_options.capturePath.empty () && RawPcmSource::isCandidate (m_uri, m_options.mimeType))
+      setupRawPcmSource ();
+    else
+      setupGStreamer ();
+
+    m_startup.mark (StartupTrace::PHASE_SETUP);
     return m_renderersPipe;
   }
   else {
@@ -72,21 +169,231 @@ gint32 Pipeline::init ()
   return -1;
 }
 
+void Pipeline::setupSpool ()
+{
+  guint32 maxRate = 48000;
+
+  for (guint32 rate : m_allowedSampleRates)
+    maxRate = MAX (maxRate, rate);
+
+  gsize capacity = (guint64) m_options.aheadWindowMs * maxRate * getFrameSize () / 1000;
+
+  Tracer::info ("Pipeline: decoding", m_options.aheadWindowMs, "ms ahead into a spool of", capacity, "bytes");
+  m_spool.reset (new OutputSpool (m_audioPipe, capacity));
+}
+
+void Pipeline::setupTimeshift ()
+{
+  guint32 maxRate = 48000;
+
+  for (guint32 rate : m_allowedSampleRates)
+    maxRate = MAX (maxRate, rate);
+
+  gsize frameSize = getFrameSize ();
+  gsize capacity = (guint64) m_options.timeshiftMs * maxRate / 1000 * frameSize;
+
+  Tracer::info ("Pipeline: timeshift window of", m_options.timeshiftMs, "ms in", capacity, "bytes");
+  m_timeshift.reset (new TimeshiftBuffer (m_audioPipe, capacity, frameSize, m_options.timeshiftDir));
+
+  if (!m_timeshift->isValid ())
+    m_timeshift.reset ();
+}
+
+void Pipeline::setupOutputChannel ()
+{
+  int fd = g_unix_output_stream_get_fd (G_UNIX_OUTPUT_STREAM (m_audioPipe));
+  m_output = OutputMultiplexer::get ().open (fd, OUTPUT_QUEUE_BYTES);
+
+  // the output thread closes the pipe from now on, blocking writes remain the fallback
+  if (m_output)
+    g_unix_output_stream_set_close_fd (G_UNIX_OUTPUT_STREAM (m_audioPipe), FALSE);
+}
+
+void Pipeline::closePipe ()
+{
+  // the last period of the stream may be a short one
+  flushPeriods ();
+
+  // spool and timeshift close the pipe after the renderer got everything
+  if (m_spool)
+    m_spool->finish ();
+  else if (m_timeshift)
+    m_timeshift->finish ();
+  else
+  {
+    flushOutputBatch ();
+
+    // the output thread closes the pipe once its queue is written
+    if (m_output)
+      m_output->finish ();
+    else
+      g_output_stream_close (m_audioPipe, m_cancellable, NULL);
+  }
+}
+
 void Pipeline::setMessageCallback(tMessageCallback cb)
 {
   m_messageCallback = cb;
 }
 
+void Pipeline::setStartupCallback (tStartupCallback cb)
+{
+  m_startupCallback = cb;
+}
+
 void Pipeline::resetStats()
 {
   m_stats = 0;
 }
 
+GVariant *Pipeline::getStreamStats () const
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  guint32 sourceRate = m_sourceRate;
+  guint32 targetRate = m_targetRate;
+
+  g_variant_builder_add (&builder, "{sv}", "bytesWritten", g_variant_new_uint64 (m_bytesWritten));
+  g_variant_builder_add (&builder, "{sv}", "sourceRate", g_variant_new_uint32 (sourceRate));
+  g_variant_builder_add (&builder, "{sv}", "targetRate", g_variant_new_uint32 (targetRate));
+  g_variant_builder_add (&builder, "{sv}", "resampleRatio", g_variant_new_double (sourceRate ? (double) targetRate / sourceRate : 0));
+  g_variant_builder_add (&builder, "{sv}", "resampleCost", g_variant_new_double (m_resampleCost));
+  g_variant_builder_add (&builder, "{sv}", "firstAudioUs", g_variant_new_int64 (m_firstAudioUs));
+  g_variant_builder_add (&builder, "{sv}", "typefindUs", g_variant_new_int64 (m_typefindUs));
+
+  if (m_spool)
+  {
+    g_variant_builder_add (&builder, "{sv}", "spoolFillBytes", g_variant_new_uint64 (m_spool->getFill ()));
+    g_variant_builder_add (&builder, "{sv}", "spoolCapacityBytes", g_variant_new_uint64 (m_spool->getCapacity ()));
+    g_variant_builder_add (&builder, "{sv}", "networkIdleMs", g_variant_new_int64 (m_spool->getIdleUs () / 1000));
+  }
+
+  if (m_timeshift)
+  {
+    g_variant_builder_add (&builder, "{sv}", "timeshiftPaused", g_variant_new_boolean (m_timeshift->isPaused ()));
+    g_variant_builder_add (&builder, "{sv}", "timeshiftBehindMs", g_variant_new_uint64 (bytesToMs (m_timeshift->getBehind ())));
+    g_variant_builder_add (&builder, "{sv}", "timeshiftAvailableMs", g_variant_new_uint64 (bytesToMs (m_timeshift->getAvailable ())));
+  }
+
+  if (m_output)
+  {
+    g_variant_builder_add (&builder, "{sv}", "outputQueuedBytes", g_variant_new_uint64 (m_output->getQueued ()));
+    g_variant_builder_add (&builder, "{sv}", "outputBlockedMs", g_variant_new_int64 (m_output->getBlockedUs () / 1000));
+    g_variant_builder_add (&builder, "{sv}", "outputFullCount", g_variant_new_uint64 (m_output->getFullCount ()));
+  }
+
+  m_threads.addStats (&builder);
+  addCpuStats (&builder);
+
+  g_variant_builder_add (&builder, "{sv}", "profile", g_variant_new_string (m_options.profile.c_str ()));
+  g_variant_builder_add (&builder, "{sv}", "latencyMs", g_variant_new_double (m_latencyMs));
+  g_variant_builder_add (&builder, "{sv}", "maxLatencyMs", g_variant_new_double (m_maxLatencyMs));
+
+  g_variant_builder_add (&builder, "{sv}", "cpuLoad", g_variant_new_double (m_cpuLoad));
+  g_variant_builder_add (&builder, "{sv}", "quality", g_variant_new_uint32 (m_quality));
+
+  if (m_options.adaptiveResampling)
+  {
+    g_variant_builder_add (&builder, "{sv}", "driftPpm", g_variant_new_double (m_driftPpm));
+    g_variant_builder_add (&builder, "{sv}", "outputFillMs", g_variant_new_double (m_outputFillMs));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock (m_statsMutex);
+    g_variant_builder_add (&builder, "{sv}", "decoderChain", g_variant_new_string (m_decoderChain.c_str ()));
+  }
+
+  // a hinted chain skips typefinding, this stream wasn't measured without it, so
+  // the recent decodebin average is only an estimate of what it saved
+  if (m_hintedChain)
+    g_variant_builder_add (&builder, "{sv}", "typefindSavedEstimateUs", g_variant_new_int64 (s_typefindAverageUs));
+
+  return g_variant_builder_end (&builder);
+}
+
+void Pipeline::addCpuStats (GVariantBuilder *builder) const
+{
+  gint64 convertNs = m_convertNs;
+  gint64 resampleNs = m_resampleNs;
+  gint64 writeNs = m_writeNs;
+
+  // the sink's streaming thread converts, resamples and writes, the rest of its time is decoding
+  gint64 networkNs = m_threads.getCpuNs (StreamingThreads::STAGE_NETWORK);
+  gint64 decodeNs = m_threads.getCpuNs (StreamingThreads::STAGE_DECODE);
+  gint64 outputNs = m_threads.getCpuNs (StreamingThreads::STAGE_OUTPUT);
+
+  if (m_options.outputQueueMs)
+    writeNs = MAX (outputNs - convertNs - resampleNs, writeNs);
+  else
+    decodeNs = MAX (decodeNs - convertNs - resampleNs - writeNs, 0);
+
+  g_variant_builder_add (builder, "{sv}", "networkCpuMs", g_variant_new_uint64 (networkNs / 1000000));
+  g_variant_builder_add (builder, "{sv}", "decodeCpuMs", g_variant_new_uint64 (decodeNs / 1000000));
+  g_variant_builder_add (builder, "{sv}", "convertCpuMs", g_variant_new_uint64 (convertNs / 1000000));
+  g_variant_builder_add (builder, "{sv}", "resampleCpuMs", g_variant_new_uint64 (resampleNs / 1000000));
+  g_variant_builder_add (builder, "{sv}", "writeCpuMs", g_variant_new_uint64 (writeNs / 1000000));
+}
+
+bool Pipeline::seek (guint64 positionNs)
+{
+  Tracer::info ("Pipeline: seeking stream", m_id, "to", positionNs, "ns");
+
+  if (!m_pipeline && !(m_rawPcmSource && m_rawPcmSource->canSeek ()))
+  {
+    Tracer::warning ("Pipeline: seek failed for stream", m_id);
+    return false;
+  }
+
+  // FLUSH_START doesn't wake a streaming thread blocked on a renderer that stopped reading,
+  // the flushing seek would wait for it on the main loop, so its output is dropped until the seek is done
+  m_seeking = true;
+  m_flushResampler = true;
+  m_pendingChunkFlags |= PipeProtocol::FLAG_DISCONT;
+
+  if (m_spool)
+    m_spool->clear ();
+
+  // what the renderer didn't read yet belongs to the old position
+  if (m_output)
+    m_output->discard ();
+
+  bool success = false;
+
+  if (m_pipeline)
+  {
+    success = gst_element_seek_simple (m_pipeline, GST_FORMAT_TIME,
+                                       GstSeekFlags (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), positionNs);
+    m_seeking = false;
+  }
+  else
+  {
+    // the old download is joined on the source's thread, output resumes once it's gone
+    success = m_rawPcmSource->seek (positionNs, [this] ()
+    {
+      m_flushResampler = true;
+      m_seeking = false;
+    });
+
+    if (!success)
+      m_seeking = false;
+  }
+
+  if (!success)
+    Tracer::warning ("Pipeline: seek failed for stream", m_id);
+
+  return success;
+}
+
 void Pipeline::setupGStreamer ()
 {
+  if (!m_options.mimeType.empty () && !m_hintFailed && setupHintedGStreamer ())
+    return;
+
+  setDecoderChain ("decodebin");
   m_pipeline = gst_pipeline_new ("pipeline");
 
-  if (GstElement* httpsource = gst_element_factory_make ("souphttpsrc", "httpsource"))
+  if (GstElement* httpsource = createSource ())
   {
     if (GstElement* decodebin = gst_element_factory_make ("decodebin", "decoder"))
     {
@@ -98,19 +405,23 @@ void Pipeline::setupGStreamer ()
           {
             if (gst_bin_add (GST_BIN (m_pipeline), sink))
             {
-              if (gst_element_link_many (httpsource, decodebin, NULL))
+              if (linkSource (httpsource, decodebin) && addOutputQueue (sink))
               {
+                if (m_options.decoderQueueMs)
+                  g_object_set (decodebin, "max-size-time", (guint64) m_options.decoderQueueMs * GST_MSECOND, NULL);
+
                 g_signal_connect (decodebin, "pad-added", G_CALLBACK (&Pipeline::onPadAdded), this);
-                g_object_set (G_OBJECT (sink), "signal-handoffs", TRUE, NULL);
-                g_signal_connect (sink, "handoff", G_CALLBACK (&Pipeline::onAudioDataDecoded), this);
 
-                GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (m_pipeline));
-                m_pipelineWatch = gst_bus_add_watch (bus, (GstBusFunc) (&Pipeline::onBusEvent), this);
-                gst_object_unref (bus);
-                gst_debug_set_default_threshold (GST_LEVEL_WARNING);
+                if (!m_options.passthroughCodecs.empty ())
+                  g_signal_connect (decodebin, "autoplug-continue", G_CALLBACK (&Pipeline::onAutoplugContinue), this);
 
-                g_object_set (httpsource, "location", m_uri.c_str(), NULL);
-                gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
+                if (GstElement *typefind = gst_bin_get_by_name (GST_BIN (decodebin), "typefind"))
+                {
+                  g_signal_connect (typefind, "have-type", G_CALLBACK (&Pipeline::onHaveType), this);
+                  gst_object_unref (typefind);
+                }
+
+                startPipeline (httpsource, sink);
                 return;
               }
               else
@@ -142,9 +453,370 @@ void Pipeline::setupGStreamer ()
   }
 }
 
+bool Pipeline::setupHintedGStreamer ()
+{
+  GstCaps *caps = DecoderChain::capsForMimeType (m_options.mimeType);
+
+  if (!caps)
+  {
+    Tracer::info ("Pipeline: no decoder chain for", m_options.mimeType, "using decodebin");
+    return false;
+  }
+
+  bool passthrough = m_options.isPassthroughCodec (caps);
+
+  GstElement *httpsource = createSource ();
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *parser = DecoderChain::createElement (caps, GST_ELEMENT_FACTORY_TYPE_PARSER);
+  GstElement *decoder = passthrough ? NULL : DecoderChain::createElement (caps, GST_ELEMENT_FACTORY_TYPE_DECODER);
+  GstElement *sink = gst_element_factory_make ("fakesink", "sink");
+
+  bool complete = httpsource && capsfilter && parser && sink && (passthrough || decoder);
+
+  if (complete)
+  {
+    string chain = string ("hint:") + GST_OBJECT_NAME (gst_element_get_factory (parser));
+
+    if (decoder)
+      chain += string ("!") + GST_OBJECT_NAME (gst_element_get_factory (decoder));
+
+    m_pipeline = gst_pipeline_new ("pipeline");
+    gst_bin_add_many (GST_BIN (m_pipeline), httpsource, capsfilter, parser, sink, NULL);
+
+    if (decoder)
+      gst_bin_add (GST_BIN (m_pipeline), decoder);
+
+    g_object_set (capsfilter, "caps", caps, NULL);
+
+    // without typefinding nobody would strip interleaved ICY metadata
+    if (!m_replaySource && !isLocalFile ())
+      g_object_set (httpsource, "iradio-mode", FALSE, NULL);
+
+    complete = linkSource (httpsource, capsfilter) && addOutputQueue (sink);
+
+    if (complete && decoder)
+      complete = gst_element_link_many (capsfilter, parser, decoder, NULL) && linkToOutput (decoder);
+    else if (complete)
+      complete = gst_element_link (capsfilter, parser) && linkToOutput (parser);
+
+    if (complete)
+    {
+      Tracer::info ("Pipeline: skipping typefinding,", chain);
+      setDecoderChain (chain);
+      m_hintedChain = true;
+      startPipeline (httpsource, sink);
+    }
+    else
+    {
+      Tracer::warning ("Pipeline: unable to link decoder chain for", m_options.mimeType);
+      gst_object_unref (m_pipeline);
+      m_pipeline = NULL;
+    }
+  }
+  else
+  {
+    for (GstElement *element : { httpsource, capsfilter, parser, decoder, sink })
+    {
+      if (element)
+        gst_object_unref (element);
+    }
+  }
+
+  gst_caps_unref (caps);
+  return complete;
+}
+
+bool Pipeline::linkSource (GstElement *source, GstElement *decoder)
+{
+  if (!m_options.networkQueueBytes)
+    return gst_element_link (source, decoder);
+
+  // a stalled HTTP read won't starve the decoder, nor a slow decoder the network
+  GstElement *queue = gst_element_factory_make ("queue2", "networkqueue");
+
+  if (!queue)
+    return false;
+
+  g_object_set (queue, "max-size-bytes", m_options.networkQueueBytes, "max-size-buffers", 0, "max-size-time", (guint64) 0, NULL);
+  gst_bin_add (GST_BIN (m_pipeline), queue);
+
+  return gst_element_link_many (source, queue, decoder, NULL);
+}
+
+bool Pipeline::addOutputQueue (GstElement *sink)
+{
+  if (!m_options.outputQueueMs)
+    return true;
+
+  // the blocking pipe write gets a thread of its own
+  GstElement *queue = gst_element_factory_make ("queue", "outputqueue");
+
+  if (!queue)
+    return false;
+
+  g_object_set (queue, "max-size-time", (guint64) m_options.outputQueueMs * GST_MSECOND, "max-size-buffers", 0, "max-size-bytes", 0, NULL);
+  gst_bin_add (GST_BIN (m_pipeline), queue);
+
+  return gst_element_link (queue, sink);
+}
+
+bool Pipeline::linkToOutput (GstElement *element)
+{
+  GstElement *entry = gst_bin_get_by_name (GST_BIN (m_pipeline), "outputqueue");
+
+  if (!entry)
+    entry = gst_bin_get_by_name (GST_BIN (m_pipeline), "sink");
+
+  bool linked = entry && gst_element_link (element, entry);
+
+  if (entry)
+    gst_object_unref (entry);
+
+  return linked;
+}
+
+bool Pipeline::isLocalFile () const
+{
+  return g_str_has_prefix (m_uri.c_str (), "file://");
+}
+
+GstElement *Pipeline::createSource ()
+{
+  // batch decoding reads local files, the source takes the URI itself
+  if (isLocalFile ())
+    return gst_element_make_from_uri (GST_URI_SRC, m_uri.c_str (), "httpsource", NULL);
+
+  if (!ReplaySource::isReplayUri (m_uri))
+  {
+    GstElement *source = gst_element_factory_make ("souphttpsrc", "httpsource");
+
+    if (source)
+    {
+      // the next track from the same server reuses the pooled connection
+      g_object_set (source, "keep-alive", TRUE, NULL);
+      HttpSession::get ().attach (source);
+    }
+
+    return source;
+  }
+
+  string path = m_uri.substr (strlen ("replay://"));
+  m_replaySource.reset (new ReplaySource (path, !m_options.replayFast));
+
+  GstElement *appsrc = m_replaySource->createElement ("httpsource");
+
+  if (!appsrc)
+  {
+    sendMessage ("error", "Cannot read capture file " + path);
+    m_replaySource.reset ();
+  }
+
+  return appsrc;
+}
+
+void Pipeline::startPipeline (GstElement *httpsource, GstElement *sink)
+{
+  g_object_set (G_OBJECT (sink), "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (&Pipeline::onAudioDataDecoded), this);
+
+  if (GstPad *srcpad = gst_element_get_static_pad (httpsource, "src"))
+  {
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) &Pipeline::onFirstSourceBuffer, this, NULL);
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback) &Pipeline::onSourceEvent, this, NULL);
+
+    if (!m_options.capturePath.empty () && !m_replaySource)
+    {
+      m_captureWriter.reset (new CaptureFile::Writer ());
+      gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback) &Pipeline::onCaptureBuffer, this, NULL);
+    }
+
+    gst_object_unref (srcpad);
+  }
+
+  GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (m_pipeline));
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler) &Pipeline::onSyncBusEvent, this, NULL);
+  m_pipelineWatch = gst_bus_add_watch (bus, (GstBusFunc) (&Pipeline::onBusEvent), this);
+  gst_object_unref (bus);
+  gst_debug_set_default_threshold (GST_LEVEL_WARNING);
+
+  if (!m_replaySource && !isLocalFile ())
+    g_object_set (httpsource, "location", m_uri.c_str(), NULL);
+
+  if (!m_replaySource && m_options.sourceBlocksize)
+    g_object_set (httpsource, "blocksize", m_options.sourceBlocksize, NULL);
+
+  gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
+
+  if (m_replaySource)
+    m_replaySource->start ();
+}
+
+void Pipeline::fallbackToDecodebin ()
+{
+  Tracer::warning ("Pipeline: decoder chain for", m_options.mimeType, "failed, falling back to decodebin");
+
+  m_hintFailed = true;
+  m_hintedChain = false;
+
+  if (m_pipelineWatch > 0)
+    g_source_remove (m_pipelineWatch);
+
+  m_pipelineWatch = 0;
+
+  if (m_replaySource)
+    m_replaySource->stop ();
+
+  gst_element_set_state (m_pipeline, GST_STATE_NULL);
+  gst_object_unref (m_pipeline);
+  m_pipeline = NULL;
+
+  m_replaySource.reset ();
+  m_captureWriter.reset ();
+
+  setupGStreamer ();
+}
+
+void Pipeline::setDecoderChain (const string &chain)
+{
+  std::lock_guard<std::mutex> lock (m_statsMutex);
+  m_decoderChain = chain;
+}
+
+GstPadProbeReturn Pipeline::onFirstSourceBuffer (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis)
+{
+  pThis->m_firstSourceBufferUs = g_get_monotonic_time ();
+  pThis->m_startup.mark (StartupTrace::PHASE_FIRST_BYTE);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+GstPadProbeReturn Pipeline::onSourceEvent (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+  // souphttpsrc forwards the response headers before the first buffer
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM_STICKY && gst_event_has_name (event, "http-headers"))
+  {
+    pThis->m_startup.mark (StartupTrace::PHASE_HEADERS);
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::onCaptureBuffer (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis)
+{
+  CaptureFile::Writer &writer = *pThis->m_captureWriter;
+
+  if (!writer.isOpen ())
+  {
+    // the caps tell the replay about ICY metadata interleaved by souphttpsrc
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+    gchar *capsString = caps ? gst_caps_to_string (caps) : g_strdup ("");
+
+    if (!writer.open (pThis->m_options.capturePath, capsString))
+    {
+      g_free (capsString);
+
+      if (caps)
+        gst_caps_unref (caps);
+
+      return GST_PAD_PROBE_REMOVE;
+    }
+
+    g_free (capsString);
+
+    if (caps)
+      gst_caps_unref (caps);
+  }
+
+  GstMapInfo map;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ))
+  {
+    writer.write (map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void Pipeline::onHaveType (GstElement *typefind, guint probability, GstCaps *caps, Pipeline *pThis)
+{
+  gint64 typefindUs = g_get_monotonic_time () - pThis->m_firstSourceBufferUs;
+  pThis->m_typefindUs = typefindUs;
+  pThis->m_startup.mark (StartupTrace::PHASE_TYPEFIND);
+
+  // moving average over the recent decodebin streams
+  gint64 average = s_typefindAverageUs;
+  s_typefindAverageUs = average ? (average * 7 + typefindUs) / 8 : typefindUs;
+}
+
+void Pipeline::setupRawPcmSource ()
+{
+  setDecoderChain ("raw");
+  m_rawPcmSource.reset (new RawPcmSource (m_uri,
+    [this] (GstCaps *caps, GstBuffer *buffer)
+    {
+      handOffData (caps, buffer);
+    },
+    [this] (const string &type, const string &msg)
+    {
+      // called on the source's thread, like bus messages they are handled on the main loop
+      std::lock_guard<std::mutex> lock (m_rawPcmMessagesMutex);
+      m_rawPcmMessages.push_back (std::make_pair (type, msg));
+
+      if (!m_rawPcmMessageSource)
+        m_rawPcmMessageSource = g_idle_add ((GSourceFunc) &Pipeline::onRawPcmMessages, this);
+    },
+    [this] ()
+    {
+      // called on the source's thread, the GStreamer graph is built on the main loop
+      m_fallbackSource = g_idle_add ((GSourceFunc) &Pipeline::onRawPcmFallback, this);
+    }));
+}
+
+gboolean Pipeline::onRawPcmFallback (Pipeline *pThis)
+{
+  // joins the source's thread, which returns right after posting this
+  pThis->m_rawPcmSource.reset ();
+  pThis->m_fallbackSource = 0;
+
+  if (!pThis->m_close)
+    pThis->setupGStreamer ();
+
+  return G_SOURCE_REMOVE;
+}
+
+gboolean Pipeline::onRawPcmMessages (Pipeline *pThis)
+{
+  std::deque<std::pair<string, string>> messages;
+
+  {
+    std::lock_guard<std::mutex> lock (pThis->m_rawPcmMessagesMutex);
+    messages.swap (pThis->m_rawPcmMessages);
+    pThis->m_rawPcmMessageSource = 0;
+  }
+
+  for (const auto &message : messages)
+  {
+    pThis->sendMessage (message.first, message.second);
+
+    if (message.first == "eos")
+      pThis->closePipe ();
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
 void Pipeline::onPadAdded (GstElement *element, GstPad *pad, Pipeline *pThis)
 {
-  if(GstElement *fakeSink = gst_bin_get_by_name (GST_BIN (pThis->m_pipeline), "sink"))
+  GstElement *fakeSink = gst_bin_get_by_name (GST_BIN (pThis->m_pipeline), "outputqueue");
+
+  if (!fakeSink)
+    fakeSink = gst_bin_get_by_name (GST_BIN (pThis->m_pipeline), "sink");
+
+  if(fakeSink)
   {
     if(GstPad *sinkpad = gst_element_get_static_pad (fakeSink, "sink"))
     {
@@ -160,6 +832,29 @@ void Pipeline::onPadAdded (GstElement *element, GstPad *pad, Pipeline *pThis)
   }
 }
 
+gboolean Pipeline::onAutoplugContinue (GstElement *decodebin, GstPad *pad, GstCaps *caps, Pipeline *pThis)
+{
+  GstStructure *structure = gst_caps_get_size (caps) ? gst_caps_get_structure (caps, 0) : NULL;
+
+  if (!structure)
+    return TRUE;
+
+  // stop autoplugging once a parser has framed one of the codecs the renderer
+  // decodes itself, decodebin will then expose the compressed stream
+  gboolean framed = FALSE;
+
+  if (!gst_structure_get_boolean (structure, "parsed", &framed))
+    gst_structure_get_boolean (structure, "framed", &framed);
+
+  if (framed && pThis->m_options.isPassthroughCodec (caps))
+  {
+    Tracer::info ("Pipeline: passing through compressed stream", gst_structure_get_name (structure));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 void Pipeline::onAudioDataDecoded (GstElement *fakesink, GstBuffer *buffer, GstPad *pad, Pipeline *pThis)
 {
   GstCaps *caps = pad ? gst_pad_get_current_caps (pad) : NULL;
@@ -169,11 +864,132 @@ void Pipeline::onAudioDataDecoded (GstElement *fakesink, GstBuffer *buffer, GstP
     gst_caps_unref (caps);
 }
 
+bool Pipeline::pause ()
+{
+  if (!m_timeshift)
+    return false;
+
+  Tracer::info ("Pipeline: pausing stream", m_id, "into the timeshift buffer");
+  m_timeshift->pause ();
+  return true;
+}
+
+bool Pipeline::resume ()
+{
+  if (!m_timeshift)
+    return false;
+
+  Tracer::info ("Pipeline: resuming stream", m_id, m_timeshift->getBehind (), "bytes behind live");
+  m_timeshift->resume ();
+  return true;
+}
+
+bool Pipeline::rewind (guint64 durationNs)
+{
+  if (!m_timeshift || !m_targetRate)
+    return false;
+
+  gsize bytes = gst_util_uint64_scale (durationNs, m_targetRate, GST_SECOND) * getFrameSize ();
+  gsize rewound = m_timeshift->rewind (bytes);
+
+  Tracer::info ("Pipeline: rewound stream", m_id, "by", bytesToMs (rewound), "ms");
+  return true;
+}
+
+gsize Pipeline::getFrameSize () const
+{
+  return m_options.channels * sizeof (tSample);
+}
+
+guint64 Pipeline::bytesToMs (gsize bytes) const
+{
+  guint32 rate = m_targetRate;
+  return rate ? gst_util_uint64_scale (bytes / getFrameSize (), 1000, rate) : 0;
+}
+
+double Pipeline::takeCpuLoad ()
+{
+  gint64 audioNs = m_audioNs.exchange (0);
+  gint64 cpuNs = m_cpuNs.exchange (0);
+
+  // all threads of the stream, including network and queues, unless it runs without GStreamer
+  gint64 threadCpuNs = m_threads.getCpuNs (StreamingThreads::STAGE_LAST);
+
+  if (threadCpuNs > 0)
+  {
+    cpuNs = threadCpuNs - m_lastThreadCpuNs;
+    m_lastThreadCpuNs = threadCpuNs;
+  }
+
+  // keep the last value while nothing is decoded, e.g. when the renderer is paused
+  if (audioNs > 0)
+    m_cpuLoad = (double) cpuNs / audioNs;
+
+  return m_cpuLoad;
+}
+
+void Pipeline::setQuality (LoadScheduler::Quality quality)
+{
+  m_quality = quality;
+}
+
+LoadScheduler::Quality Pipeline::getLowestQuality () const
+{
+  // passed on undecoded, there is no resampler to make cheaper
+  if (m_passthrough)
+    return LoadScheduler::QUALITY_FULL;
+
+  // the legacy protocol announces the target rate only once, so it can't be lowered
+  return m_options.framed ? LoadScheduler::QUALITY_LOW_RATE : LoadScheduler::QUALITY_CHEAP_RESAMPLER;
+}
+
 void Pipeline::handOffData (GstCaps *caps, GstBuffer *buffer)
 {
+  gint64 enterNs = getThreadCpuNs ();
+
+  // the streaming thread decoded this buffer since it left the last one
+  if (m_lastHandOffThread == std::this_thread::get_id ())
+    m_cpuNs += enterNs - m_lastHandOffCpuNs;
+
+  dispatchData (caps, buffer);
+
+  m_lastHandOffThread = std::this_thread::get_id ();
+  m_lastHandOffCpuNs = getThreadCpuNs ();
+  m_cpuNs += m_lastHandOffCpuNs - enterNs;
+}
+
+void Pipeline::dispatchData (GstCaps *caps, GstBuffer *buffer)
+{
+  if (!m_audioReceived.exchange (true))
+  {
+    m_firstAudioUs = g_get_monotonic_time () - m_decodeStartUs;
+    m_startup.mark (StartupTrace::PHASE_FIRST_DECODED);
+  }
+
+  // the first buffer after a seek, nothing held back from the old position may reach the renderer
+  if (m_flushResampler.exchange (false))
+  {
+    m_outputBatch.clear ();
+
+    if (m_resampler)
+      m_resampler->flush ();
+
+    if (m_periods)
+      m_periods->clear ();
+  }
+
+  if (caps && !m_close && !gst_structure_has_name (gst_caps_get_structure (caps, 0), "audio/x-raw"))
+  {
+    sendCompressedData (caps, buffer);
+    return;
+  }
+
   if (caps && !m_close)
     setupAudioProcessors (caps);
 
+  if (m_resampler && m_appliedQuality != m_quality)
+    applyQuality ();
+
   if (m_resampler && m_audioConverter && !m_close)
     processAndSendAudioData (buffer);
 }
@@ -186,8 +1002,11 @@ void Pipeline::setupAudioProcessors (GstCaps* caps)
 
 void Pipeline::setupAudioConverter (GstCaps* caps)
 {
+  // a decoder may switch format or channels mid-stream, e.g. between tracks of a playlist
   if (!m_audioConverter)
-    m_audioConverter.reset (new AudioConverter (caps));
+    m_audioConverter.reset (new AudioConverter (caps, m_options.channels));
+  else
+    m_audioConverter->setCaps (caps);
 }
 
 void Pipeline::setupResampler (GstCaps* caps)
@@ -200,26 +1019,179 @@ void Pipeline::setupResampler (GstCaps* caps)
   if (!m_resampler)
   {
     tgtSR = chooseSamplerate (srcSR);
-    m_resampler.reset (new Resampler (srcSR, tgtSR));
-    gsize bytesWritten = 0;
-    g_output_stream_write_all (m_audioPipe, &tgtSR, 4, &bytesWritten, m_cancellable, NULL);
+
+    if (!createResampler (srcSR, tgtSR))
+      return;
+
+    // protocol headers go out even during a seek, the renderer can't do without them
+    if (!m_options.framed)
+      sendToPipe (&tgtSR, 4);
   }
   else if (m_resampler->getSourceSR () != srcSR)
   {
     // some radio stations change the sample frequency in the middle of the stream due to ads
-    // in this case, resample to the sample rate transmitted to the renderer before
-    m_resampler.reset (new Resampler (srcSR, tgtSR));
+    if (m_options.framed)
+    {
+      // the renderer learns about the new rate from the next chunk header
+      tgtSR = chooseSamplerate (srcSR);
+      flushPeriods ();
+      m_pendingChunkFlags |= PipeProtocol::FLAG_FORMAT_CHANGED;
+    }
+    else
+    {
+      // resample to the sample rate transmitted to the renderer before
+      tgtSR = m_resampler->getTargetSR ();
+      m_sourceRate = srcSR;
+      m_resampleCost = SampleRateChooser::estimateCost (srcSR, tgtSR);
+    }
+
+    createResampler (srcSR, tgtSR);
   }
 }
 
+void Pipeline::applyQuality ()
+{
+  bool wasLowRate = m_appliedQuality == LoadScheduler::QUALITY_LOW_RATE;
+  m_appliedQuality = m_quality;
+
+  Tracer::info ("Pipeline: stream", m_id, "switches to quality", m_appliedQuality);
+  m_resampler->setInterpolation (m_appliedQuality == LoadScheduler::QUALITY_FULL);
+
+  // the legacy protocol announces the target rate only once
+  if (m_options.framed && wasLowRate != (m_appliedQuality == LoadScheduler::QUALITY_LOW_RATE))
+  {
+    int srcSR = m_resampler->getSourceSR ();
+    int tgtSR = chooseSamplerate (srcSR);
+
+    if (tgtSR != m_resampler->getTargetSR ())
+    {
+      flushPeriods ();
+      createResampler (srcSR, tgtSR);
+      m_pendingChunkFlags |= PipeProtocol::FLAG_FORMAT_CHANGED;
+    }
+  }
+}
+
+bool Pipeline::createResampler (int srcSR, int tgtSR)
+{
+  // reported once, every buffer of the stream would end up here
+  if (m_resamplerFailed)
+    return false;
+
+  m_resampler.reset (Resampler::create (srcSR, tgtSR, m_options.channels));
+
+  if (!m_resampler)
+  {
+    Tracer::alarm ("Pipeline: no resampler for", m_options.channels, "channels, stream", m_id, "stays silent");
+    sendMessage ("error", "Cannot resample " + std::to_string (m_options.channels) + " channels");
+    m_resamplerFailed = true;
+    return false;
+  }
+
+  m_resampler->setInterpolation (m_appliedQuality == LoadScheduler::QUALITY_FULL);
+
+  if (m_options.adaptiveResampling)
+    m_resampler->setDriftCorrection (m_driftPpm);
+
+  return true;
+}
+
+void Pipeline::updateDriftCorrection ()
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (now - m_lastDriftUpdateUs < DRIFT_UPDATE_INTERVAL_US)
+    return;
+
+  int queuedBytes = 0;
+
+  if (ioctl (m_renderersPipe, FIONREAD, &queuedBytes) < 0)
+    return;
+
+  double bytesPerSecond = m_resampler->getTargetSR () * getFrameSize ();
+
+  if (!m_driftController)
+  {
+    int pipeSize = fcntl (m_renderersPipe, F_GETPIPE_SZ);
+    double targetFill = m_options.targetLatencyMs / 1000.0;
+
+    if (pipeSize > 0)
+      targetFill = MIN (targetFill, 0.75 * pipeSize / bytesPerSecond);
+
+    Tracer::info ("Pipeline: adaptive resampling, keeping", targetFill, "seconds in the pipe");
+    m_driftController.reset (new DriftController (targetFill));
+  }
+
+  double elapsed = m_lastDriftUpdateUs ? (now - m_lastDriftUpdateUs) / 1000000.0 : 0;
+  m_lastDriftUpdateUs = now;
+
+  double ppm = m_driftController->update (queuedBytes / bytesPerSecond, elapsed);
+  m_resampler->setDriftCorrection (ppm);
+
+  m_driftPpm = ppm;
+  m_outputFillMs = m_driftController->getFilteredFill () * 1000;
+}
+
+void Pipeline::measureLatency ()
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (now - m_lastLatencyUpdateUs < LATENCY_UPDATE_INTERVAL_US)
+    return;
+
+  m_lastLatencyUpdateUs = now;
+
+  int queuedBytes = 0;
+
+  if (ioctl (m_renderersPipe, FIONREAD, &queuedBytes) < 0)
+    return;
+
+  // everything decoded but not yet read by the renderer
+  gsize pendingBytes = queuedBytes + m_outputBatch.size ();
+
+  if (m_output)
+    pendingBytes += m_output->getQueued ();
+
+  if (m_spool)
+    pendingBytes += m_spool->getFill ();
+
+  if (m_timeshift)
+    pendingBytes += m_timeshift->getBehind ();
+
+  double bytesPerSecond = m_resampler->getTargetSR () * getFrameSize ();
+  double latencyMs = pendingBytes * 1000.0 / bytesPerSecond;
+
+  // plus what waits in the queues between the streaming threads
+  for (const gchar *name : { "networkqueue", "outputqueue" })
+  {
+    if (GstElement *queue = m_pipeline ? gst_bin_get_by_name (GST_BIN (m_pipeline), name) : NULL)
+    {
+      guint64 levelNs = 0;
+      g_object_get (queue, "current-level-time", &levelNs, NULL);
+      latencyMs += levelNs / 1000000.0;
+      gst_object_unref (queue);
+    }
+  }
+
+  m_latencyMs = latencyMs;
+
+  if (latencyMs > m_maxLatencyMs)
+    m_maxLatencyMs = latencyMs;
+}
+
 void Pipeline::processAndSendAudioData (GstBuffer* buffer)
 {
   Tracer::overdose( __PRETTY_FUNCTION__ );
 
-  gsize bytesWritten = 0;
-
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  gint64 startNs = getThreadCpuNs ();
   GstBuffer* converted = m_audioConverter->eat (buffer);
+  gint64 convertedNs = getThreadCpuNs ();
   GstBuffer* resampled = m_resampler->eat (converted);
+  gint64 resampledNs = getThreadCpuNs ();
+
+  m_convertNs += convertedNs - startNs;
+  m_resampleNs += resampledNs - convertedNs;
 
   GstMapInfo info;
 
@@ -228,13 +1200,24 @@ void Pipeline::processAndSendAudioData (GstBuffer* buffer)
     if (info.size > 0)
     {
       m_stats += info.size;
+      m_startup.mark (StartupTrace::PHASE_FIRST_CONVERTED);
 
-      GError *error = nullptr;
-      if( !g_output_stream_write_all (m_audioPipe, info.data, info.size, &bytesWritten, m_cancellable, &error))
-      {
-        g_printerr ("g_output_stream_write_all failed: %s\n", error->message);
-        g_error_free (error);
-      }
+      guint32 sampleRate = m_resampler->getTargetSR ();
+      guint32 numFrames = info.size / getFrameSize ();
+      gint64 bufferPts = GST_CLOCK_TIME_IS_VALID (pts) ? (gint64) pts : -1;
+      m_audioNs += gst_util_uint64_scale (numFrames, GST_SECOND, sampleRate);
+
+      if (m_periods)
+        m_periods->push (info.data, info.size, bufferPts, sampleRate, getPeriodWriter (sampleRate));
+      else
+        writePcm (sampleRate, numFrames, bufferPts, info.data);
+
+      m_writeNs += getThreadCpuNs () - resampledNs;
+
+      if (m_options.adaptiveResampling)
+        updateDriftCorrection ();
+
+      measureLatency ();
     }
 
     gst_buffer_unmap (resampled, &info);
@@ -244,22 +1227,238 @@ void Pipeline::processAndSendAudioData (GstBuffer* buffer)
   gst_buffer_unref (converted);
 }
 
-guint32 Pipeline::chooseSamplerate (guint32 sourceRate) const
+void Pipeline::sendCompressedData (GstCaps *caps, GstBuffer* buffer)
 {
-  Tracer::overdose( __PRETTY_FUNCTION__, "sourcerate:", sourceRate );
+  gint rate = 0;
+  gst_structure_get_int (gst_caps_get_structure (caps, 0), "rate", &rate);
+
+  // compressed streams are announced by a target sample rate of 0, followed by
+  // the length prefixed caps string. Every encoded frame is length prefixed, too.
+  if (!m_passthrough)
+  {
+    gchar *capsAsString = gst_caps_to_string (caps);
+    guint32 capsLength = strlen (capsAsString);
 
-  guint32 chosenRate = 0;
+    Tracer::info ("Pipeline: sending compressed stream", capsAsString);
 
-  for (guint32 sr : m_allowedSampleRates)
+    if (m_options.framed)
+    {
+      sendChunk (PipeProtocol::FORMAT_CAPS, rate, 0, -1, capsAsString, capsLength);
+    }
+    else
+    {
+      guint32 header[] = { 0, capsLength };
+      sendToPipe (header, sizeof (header), capsAsString, capsLength);
+    }
+
+    g_free (capsAsString);
+    m_passthrough = true;
+  }
+
+  GstMapInfo info;
+
+  if (gst_buffer_map (buffer, &info, GST_MAP_READ))
   {
-    g_assert (chosenRate < sr); // rates have to be sorted!
+    if (info.size > 0)
+    {
+      guint32 frameLength = info.size;
+      GstClockTime pts = GST_BUFFER_PTS (buffer);
 
-    if (chosenRate < sourceRate && chosenRate < sr)
-      chosenRate = sr;
+      gint64 startNs = getThreadCpuNs ();
+
+      m_stats += info.size;
+
+      if (m_options.framed)
+        writeChunk (PipeProtocol::FORMAT_COMPRESSED, rate, 0, GST_CLOCK_TIME_IS_VALID (pts) ? (gint64) pts : -1, info.data, info.size);
+      else if (!m_seeking)
+        sendToPipe (&frameLength, 4, info.data, info.size);
+
+      m_writeNs += getThreadCpuNs () - startNs;
+    }
+
+    gst_buffer_unmap (buffer, &info);
   }
+}
 
-  Tracer::overdose( "chosenRate:", chosenRate );
-  return chosenRate;
+bool Pipeline::writePcm (guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data)
+{
+  if (m_options.framed)
+    return writeChunk (PipeProtocol::FORMAT_PCM, sampleRate, numFrames, pts, data, numFrames * getFrameSize ());
+
+  return writeToPipe (data, numFrames * getFrameSize ());
+}
+
+PeriodAligner::tWriter Pipeline::getPeriodWriter (guint32 sampleRate)
+{
+  return [this, sampleRate] (const void *data, guint32 numFrames, gint64 pts)
+  {
+    return writePcm (sampleRate, numFrames, pts, data);
+  };
+}
+
+void Pipeline::flushPeriods ()
+{
+  // the staged frames still belong to the current target rate
+  if (m_periods && m_resampler)
+    m_periods->flush (getPeriodWriter (m_resampler->getTargetSR ()));
+}
+
+bool Pipeline::writeChunk (PipeProtocol::Format format, guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data, gsize size)
+{
+  // keeps the pending flags for the first chunk after the seek
+  if (m_seeking)
+    return true;
+
+  return sendChunk (format, sampleRate, numFrames, pts, data, size);
+}
+
+bool Pipeline::sendChunk (PipeProtocol::Format format, guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data, gsize size)
+{
+  PipeProtocol::ChunkHeader header;
+  header.magic = PipeProtocol::CHUNK_MAGIC;
+  header.payloadSize = size;
+  header.numFrames = numFrames;
+  header.sampleRate = sampleRate;
+  header.format = format;
+  header.channels = m_options.channels;
+  header.bitsPerSample = sizeof (tSample) * 8;
+  header.flags = m_pendingChunkFlags.exchange (PipeProtocol::FLAG_NONE);
+  header.pts = pts;
+
+  return sendToPipe (&header, sizeof (header), data, size);
+}
+
+bool Pipeline::writeToPipe (const void *data, gsize size)
+{
+  if (m_seeking)
+    return true;
+
+  return sendToPipe (data, size);
+}
+
+bool Pipeline::sendToPipe (const void *header, gsize headerSize, const void *data, gsize size)
+{
+  // one write, so neither a seek nor a discard of the queued output can separate them
+  m_unit.resize (headerSize + size);
+  memcpy (m_unit.data (), header, headerSize);
+  memcpy (m_unit.data () + headerSize, data, size);
+  return sendToPipe (m_unit.data (), m_unit.size ());
+}
+
+bool Pipeline::sendToPipe (const void *data, gsize size)
+{
+  if (m_spool)
+  {
+    if (!m_spool->write (data, size))
+      return false;
+
+    m_bytesWritten += size;
+    onFirstWrite ();
+    return true;
+  }
+
+  if (m_timeshift)
+  {
+    // live streams keep coming while paused, the oldest audio is dropped
+    m_timeshift->write (data, size);
+    m_bytesWritten += size;
+    onFirstWrite ();
+    return true;
+  }
+
+  if (m_options.outputBatchBytes)
+  {
+    const guint8 *bytes = (const guint8 *) data;
+    m_outputBatch.insert (m_outputBatch.end (), bytes, bytes + size);
+
+    return m_outputBatch.size () < m_options.outputBatchBytes || flushOutputBatch ();
+  }
+
+  return writeAll (data, size);
+}
+
+bool Pipeline::flushOutputBatch ()
+{
+  if (m_outputBatch.empty ())
+    return true;
+
+  bool success = writeAll (m_outputBatch.data (), m_outputBatch.size ());
+  m_outputBatch.clear ();
+  return success;
+}
+
+bool Pipeline::writeAll (const void *data, gsize size)
+{
+  if (m_output)
+  {
+    if (!m_output->write (data, size))
+      return false;
+
+    m_bytesWritten += size;
+    onFirstWrite ();
+    return true;
+  }
+
+  gsize bytesWritten = 0;
+  GError *error = nullptr;
+
+  bool success = g_output_stream_write_all (m_audioPipe, data, size, &bytesWritten, m_cancellable, &error);
+  m_bytesWritten += bytesWritten;
+
+  if (bytesWritten)
+    onFirstWrite ();
+
+  if( !success )
+  {
+    g_printerr ("g_output_stream_write_all failed: %s\n", error->message);
+    g_error_free (error);
+    return false;
+  }
+
+  return true;
+}
+
+void Pipeline::onFirstWrite ()
+{
+  if (!m_startup.mark (StartupTrace::PHASE_FIRST_WRITE))
+    return;
+
+  string phases = m_startup.format ();
+  Tracer::info ("Pipeline: stream", m_id, "started,", phases);
+  sendMessage ("ttfb", phases);
+
+  if (m_startupCallback)
+    m_startupCallback (m_startup);
+}
+
+guint32 Pipeline::chooseSamplerate (guint32 sourceRate)
+{
+  Tracer::overdose( __PRETTY_FUNCTION__, "sourcerate:", sourceRate );
+
+  double budget = m_options.resampleBudget;
+
+  if (m_appliedQuality == LoadScheduler::QUALITY_LOW_RATE)
+    budget = DEGRADED_RESAMPLE_BUDGET;
+
+  SampleRateChooser::Choice choice = SampleRateChooser (m_allowedSampleRates, budget).choose (sourceRate);
+
+  m_sourceRate = sourceRate;
+  m_targetRate = choice.rate;
+  m_resampleCost = choice.cost;
+
+  Tracer::overdose( "chosenRate:", choice.rate, "ratio:", choice.ratio, "cost:", choice.cost );
+  return choice.rate;
+}
+
+GstBusSyncReply Pipeline::onSyncBusEvent (GstBus *bus, GstMessage *message, Pipeline *pThis)
+{
+  // posted on the streaming thread itself
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STREAM_STATUS)
+    pThis->m_threads.onStreamStatus (message);
+  else
+    HttpSession::get ().onContextMessage (message);
+
+  return GST_BUS_PASS;
 }
 
 gboolean Pipeline::onBusEvent (GstBus *bus, GstMessage *message, Pipeline *pThis)
@@ -276,10 +1475,16 @@ gboolean Pipeline::onBusEvent (GstBus *bus, GstMessage *message, Pipeline *pThis
 
     case GST_MESSAGE_EOS:
       pThis->sendMessage("eos", "End of stream");
-      g_output_stream_close (pThis->m_audioPipe, pThis->m_cancellable, NULL);
+      pThis->closePipe ();
       break;
 
     case GST_MESSAGE_ERROR:
+      if (pThis->m_hintedChain && !pThis->m_audioReceived)
+      {
+        pThis->fallbackToDecodebin ();
+        break;
+      }
+
       gst_message_parse_error (message, &error, &debugString);
 
       if (debugString)
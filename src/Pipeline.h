@@ -6,10 +6,29 @@
 #include <gst/gst.h>
 #include "stream-decoder-dbus-service.h"
 #include <list>
+#include <deque>
+#include <vector>
 #include <functional>
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include "AudioConverter.h"
 #include "Resampler.h"
+#include "DecodeOptions.h"
+#include "PipeProtocol.h"
+#include "SampleRateChooser.h"
+#include "RawPcmSource.h"
+#include "DriftController.h"
+#include "LoadScheduler.h"
+#include "OutputSpool.h"
+#include "OutputMultiplexer.h"
+#include "PeriodAligner.h"
+#include "TimeshiftBuffer.h"
+#include "CaptureFile.h"
+#include "ReplaySource.h"
+#include "StreamingThreads.h"
+#include "StartupTrace.h"
+#include <thread>
 
 using namespace std;
 
@@ -17,20 +36,57 @@ using namespace std;
 class Pipeline
 {
   public:
-    Pipeline (uint64_t stream_id, const gchar* uri, GVariant *allowed_samplerates);
+    // decodeStartUs is the monotonic time the Decode call came in, the startup trace counts from there
+    Pipeline (uint64_t stream_id, const gchar* uri, GVariant *allowed_samplerates, const DecodeOptions &options, gint64 decodeStartUs);
     virtual ~Pipeline ();
 
     typedef function<void (const std::string &type, const std::string &msg)> tMessageCallback;
+    typedef function<void (const StartupTrace &trace)> tStartupCallback;
     gint32 init ();
     void setMessageCallback (tMessageCallback cb);
 
+    // called once the first byte went to the pipe, from the writing thread
+    void setStartupCallback (tStartupCallback cb);
+
     unsigned int getStats() {
       return m_stats;
     }
     void resetStats();
 
+    GVariant *getStreamStats () const;
+
+    bool seek (guint64 positionNs);
+
+    // only for streams decoded with a timeshift window
+    bool pause ();
+    bool resume ();
+    bool rewind (guint64 durationNs);
+
+    // CPU seconds per second of audio since the last call, covering decoder, converter and resampler
+    double takeCpuLoad ();
+    void setQuality (LoadScheduler::Quality quality);
+
+    // the lowest quality that still saves CPU for this stream
+    LoadScheduler::Quality getLowestQuality () const;
+
   private:
     void setupGStreamer ();
+    bool setupHintedGStreamer ();
+    bool isLocalFile () const;
+    GstElement *createSource ();
+    bool linkSource (GstElement *source, GstElement *decoder);
+    bool addOutputQueue (GstElement *sink);
+    bool linkToOutput (GstElement *element);
+    void startPipeline (GstElement *httpsource, GstElement *sink);
+    void fallbackToDecodebin ();
+    void setupRawPcmSource ();
+    void setupSpool ();
+    void setupOutputChannel ();
+    void setupTimeshift ();
+    gsize getFrameSize () const;
+    guint64 bytesToMs (gsize bytes) const;
+    void closePipe ();
+    void setDecoderChain (const string &chain);
     void sendMessage(const string &type, const string &msg);
 
     static gint32 onDecode (gpointer instance, const gchar* uri, GVariant *allowed_samplerates, Pipeline *pThis);
@@ -38,38 +94,127 @@ class Pipeline
     static void onStop (gpointer instance, Pipeline *pThis);
     static void onDecodeDone (gpointer instance, Pipeline *pThis);
     static void onPadAdded (GstElement *element, GstPad *pad, Pipeline *pThis);
+    static gboolean onAutoplugContinue (GstElement *decodebin, GstPad *pad, GstCaps *caps, Pipeline *pThis);
     static void onAudioDataDecoded (GstElement *fakesink, GstBuffer *buffer, GstPad *pad, Pipeline *pThis);
     static gboolean onBusEvent (GstBus *bus, GstMessage *message, Pipeline *pThis);
+    static GstBusSyncReply onSyncBusEvent (GstBus *bus, GstMessage *message, Pipeline *pThis);
+    static GstPadProbeReturn onFirstSourceBuffer (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis);
+    static GstPadProbeReturn onSourceEvent (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis);
+    static GstPadProbeReturn onCaptureBuffer (GstPad *pad, GstPadProbeInfo *info, Pipeline *pThis);
+    static void onHaveType (GstElement *typefind, guint probability, GstCaps *caps, Pipeline *pThis);
+    static gboolean onRawPcmFallback (Pipeline *pThis);
+    static gboolean onRawPcmMessages (Pipeline *pThis);
 
     static gint32 getID();
 
     void handOffData (GstCaps *caps, GstBuffer *buffer);
+    void dispatchData (GstCaps *caps, GstBuffer *buffer);
+    void applyQuality ();
     void setupAudioProcessors (GstCaps* caps);
     void setupAudioConverter (GstCaps* caps);
     void setupResampler (GstCaps* caps);
+    // false and an error message if there's no resampler for the channel count
+    bool createResampler (int srcSR, int tgtSR);
+    void updateDriftCorrection ();
+    void measureLatency ();
+    void addCpuStats (GVariantBuilder *builder) const;
     void processAndSendAudioData (GstBuffer* buffer);
+    void sendCompressedData (GstCaps *caps, GstBuffer* buffer);
+    bool writePcm (guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data);
+    PeriodAligner::tWriter getPeriodWriter (guint32 sampleRate);
+    void flushPeriods ();
+    // dropped while seeking
+    bool writeToPipe (const void *data, gsize size);
+    // also while seeking, for protocol headers
+    bool sendToPipe (const void *data, gsize size);
+    bool sendToPipe (const void *header, gsize headerSize, const void *data, gsize size);
+    bool flushOutputBatch ();
+    bool writeAll (const void *data, gsize size);
+    void onFirstWrite ();
+    bool writeChunk (PipeProtocol::Format format, guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data, gsize size);
+    bool sendChunk (PipeProtocol::Format format, guint32 sampleRate, guint32 numFrames, gint64 pts, const void *data, gsize size);
 
     void setAllowedSamplerates (GVariant *allowed_samplerates);
-    guint32 chooseSamplerate (guint32 sourceRate) const;
+    guint32 chooseSamplerate (guint32 sourceRate);
 
 private:
     const uint64_t m_id = 0;
     std::string m_uri;
     std::list<guint32> m_allowedSampleRates;
+    DecodeOptions m_options;
 
     GstElement *m_pipeline;
     guint m_pipelineWatch;
+    guint m_fallbackSource = 0;
+
+    // messages of the raw PCM source's thread, waiting for the main loop
+    std::mutex m_rawPcmMessagesMutex;
+    std::deque<std::pair<std::string, std::string>> m_rawPcmMessages;
+    guint m_rawPcmMessageSource = 0;
 
     std::shared_ptr<AudioConverter> m_audioConverter;
     std::shared_ptr<Resampler> m_resampler;
+    bool m_resamplerFailed = false;
+    std::unique_ptr<RawPcmSource> m_rawPcmSource;
+    StreamingThreads m_threads;
+    std::unique_ptr<ReplaySource> m_replaySource;
+    std::unique_ptr<CaptureFile::Writer> m_captureWriter;
+    std::unique_ptr<OutputSpool> m_spool;
+    std::shared_ptr<OutputMultiplexer::Channel> m_output;
+    std::unique_ptr<TimeshiftBuffer> m_timeshift;
+    std::unique_ptr<DriftController> m_driftController;
+    gint64 m_lastDriftUpdateUs = 0;
+    std::atomic<double> m_driftPpm { 0 };
+    std::atomic<double> m_outputFillMs { 0 };
+    std::vector<guint8> m_outputBatch;
+    std::vector<guint8> m_unit;   // a header and its payload, see sendToPipe ()
+    std::unique_ptr<PeriodAligner> m_periods;
+    gint64 m_lastLatencyUpdateUs = 0;
+    std::atomic<double> m_latencyMs { 0 };
+    std::atomic<double> m_maxLatencyMs { 0 };
 
     GCancellable *m_cancellable;
     GOutputStream *m_audioPipe;
     int m_renderersPipe;
     tMessageCallback m_messageCallback;
+    tStartupCallback m_startupCallback;
+    StartupTrace m_startup;
 
     bool m_close;
+    std::atomic<bool> m_passthrough { false };
+    std::atomic<guint16> m_pendingChunkFlags { PipeProtocol::FLAG_NONE };
+    std::atomic<bool> m_flushResampler { false };
+    std::atomic<bool> m_seeking { false };
 
     unsigned int m_stats = 0;
+    std::atomic<guint64> m_bytesWritten;
+    std::atomic<guint32> m_sourceRate;
+    std::atomic<guint32> m_targetRate;
+    std::atomic<double> m_resampleCost;
+
+    gint64 m_decodeStartUs;
+    std::atomic<gint64> m_cpuNs { 0 };
+    std::atomic<gint64> m_audioNs { 0 };
+    std::atomic<double> m_cpuLoad { 0 };
+    gint64 m_lastThreadCpuNs = 0;
+    std::atomic<gint64> m_convertNs { 0 };
+    std::atomic<gint64> m_resampleNs { 0 };
+    std::atomic<gint64> m_writeNs { 0 };
+    std::thread::id m_lastHandOffThread;
+    gint64 m_lastHandOffCpuNs = 0;
+    std::atomic<int> m_quality { LoadScheduler::QUALITY_FULL };
+    int m_appliedQuality = LoadScheduler::QUALITY_FULL;
+
+    std::atomic<gint64> m_firstSourceBufferUs { 0 };
+    std::atomic<gint64> m_firstAudioUs { -1 };
+    std::atomic<gint64> m_typefindUs { -1 };
+    std::atomic<bool> m_audioReceived { false };
+    bool m_hintedChain = false;
+    bool m_hintFailed = false;
+
+    mutable std::mutex m_statsMutex;
+    string m_decoderChain;
+
+    static std::atomic<gint64> s_typefindAverageUs;
 };
 
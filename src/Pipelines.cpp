@@ -1,18 +1,32 @@
 #include "Pipelines.h"
 #include "Pipeline.h"
+#include "DecodeOptions.h"
 #include "SupportedProtocols.h"
+#include "HttpSession.h"
 #include <stdio.h>
 #include "Trace.h"
 
-Pipelines::Pipelines (StreamDecoderDBusService *service) :
-    m_service (service)
+namespace
+{
+  const guint LOAD_INTERVAL_SECONDS = 1;
+}
+
+Pipelines::Pipelines (StreamDecoderDBusService *service, double cpuBudget) :
+    m_service (service),
+    m_scheduler (cpuBudget),
+    m_loadTimer (0)
 {
   g_object_ref (m_service);
   connect ();
+
+  m_loadTimer = g_timeout_add_seconds (LOAD_INTERVAL_SECONDS, (GSourceFunc) &Pipelines::onLoadTimer, this);
 }
 
 Pipelines::~Pipelines ()
 {
+  if (m_loadTimer)
+    g_source_remove (m_loadTimer);
+
   g_object_unref (m_service);
 }
 
@@ -30,15 +44,38 @@ void Pipelines::connect ()
   g_signal_connect_swapped (m_service, "stop", G_CALLBACK (&Pipelines::onStop), this);
   g_signal_connect_swapped (m_service, "get-supported-protocols", G_CALLBACK (&Pipelines::getSupportedProtocols), this);
   g_signal_connect_swapped (m_service, "reset", G_CALLBACK (&Pipelines::reset), this);
+  g_signal_connect_swapped (m_service, "get-stream-stats", G_CALLBACK (&Pipelines::getStreamStats), this);
+  g_signal_connect_swapped (m_service, "get-startup-stats", G_CALLBACK (&Pipelines::getStartupStats), this);
+  g_signal_connect_swapped (m_service, "get-load", G_CALLBACK (&Pipelines::getLoad), this);
+  g_signal_connect_swapped (m_service, "seek", G_CALLBACK (&Pipelines::onSeek), this);
+  g_signal_connect_swapped (m_service, "pause", G_CALLBACK (&Pipelines::onPause), this);
+  g_signal_connect_swapped (m_service, "resume", G_CALLBACK (&Pipelines::onResume), this);
+  g_signal_connect_swapped (m_service, "rewind", G_CALLBACK (&Pipelines::onRewind), this);
 }
 
-bool Pipelines::onDecode (Pipelines *pThis, guint64 stream_id, const gchar* uri, GVariant *allowed_samplerates, gint32 *pipe)
+bool Pipelines::onDecode (Pipelines *pThis, guint64 stream_id, const gchar* uri, GVariant *allowed_samplerates, GVariant *options, gint32 *pipe, GError **error)
 {
-  tPipeline pipeline ( std::make_shared<Pipeline> (stream_id, uri, allowed_samplerates));
+  // the startup trace includes parsing the options and building the pipeline
+  gint64 decodeStartUs = g_get_monotonic_time ();
+  DecodeOptions decodeOptions (options);
+  std::string reason;
+
+  // a replaced stream frees its share before the new one is admitted
+  pThis->m_scheduler.remove (stream_id);
+
+  if (!pThis->m_scheduler.admit (stream_id, decodeOptions.priority, reason))
+  {
+    Tracer::warning ("Pipelines::onDecode, rejecting stream", stream_id, ":", reason);
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BUSY, reason.c_str ());
+    return false;
+  }
+
+  tPipeline pipeline ( std::make_shared<Pipeline> (stream_id, uri, allowed_samplerates, decodeOptions, decodeStartUs));
   gint32 pipe_fd = pipeline->init ();
   if( -1 == pipe_fd )
   {
     Tracer::alarm("Pipeline init failed");
+    pThis->m_scheduler.remove (stream_id);
     return false;
   }
 
@@ -54,6 +91,11 @@ bool Pipelines::onDecode (Pipelines *pThis, guint64 stream_id, const gchar* uri,
     stream_decoder_emit_message_signal (pThis->m_service, stream_id, type.c_str(), msg.c_str());
   });
 
+  pipeline->setStartupCallback([=](const StartupTrace &trace)
+  {
+    pThis->recordStartup (trace);
+  });
+
   pThis->m_pipelines[stream_id] = pipeline;
 
   return true;
@@ -72,6 +114,7 @@ void Pipelines::onStop (Pipelines *pThis, uint64_t stream_id)
 
   auto pipeline = it->second;
   pThis->m_pipelines.erase (it);
+  pThis->m_scheduler.remove (stream_id);
 
   Tracer::overdose( "pipeline.use_count():", pipeline.use_count());
 }
@@ -81,8 +124,138 @@ gchar ** Pipelines::getSupportedProtocols (Pipelines *pThis)
   return SupportedProtocols::get ().asArrayOfStrings ();
 }
 
+GVariant *Pipelines::getStreamStats (Pipelines *pThis, uint64_t stream_id)
+{
+  auto it = pThis->m_pipelines.find (stream_id);
+  if (it == pThis->m_pipelines.end ())
+  {
+    Tracer::alarm( "stats requested for unknown stream,", stream_id);
+    return NULL;
+  }
+
+  return it->second->getStreamStats ();
+}
+
+void Pipelines::recordStartup (const StartupTrace &trace)
+{
+  std::lock_guard<std::mutex> lock (m_startupMutex);
+
+  for (int phase = 0; phase < StartupTrace::PHASE_LAST; phase++)
+  {
+    gint64 us = trace.get (StartupTrace::Phase (phase));
+
+    if (us >= 0)
+      m_startupHistograms[phase].add (us);
+  }
+}
+
+GVariant *Pipelines::getStartupStats (Pipelines *pThis)
+{
+  std::lock_guard<std::mutex> lock (pThis->m_startupMutex);
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  for (int phase = 0; phase < StartupTrace::PHASE_LAST; phase++)
+  {
+    const Histogram &histogram = pThis->m_startupHistograms[phase];
+    GVariantBuilder percentiles;
+    g_variant_builder_init (&percentiles, G_VARIANT_TYPE_VARDICT);
+
+    g_variant_builder_add (&percentiles, "{sv}", "count", g_variant_new_uint64 (histogram.getCount ()));
+    g_variant_builder_add (&percentiles, "{sv}", "p50Us", g_variant_new_int64 (histogram.getPercentile (50)));
+    g_variant_builder_add (&percentiles, "{sv}", "p90Us", g_variant_new_int64 (histogram.getPercentile (90)));
+    g_variant_builder_add (&percentiles, "{sv}", "p99Us", g_variant_new_int64 (histogram.getPercentile (99)));
+    g_variant_builder_add (&percentiles, "{sv}", "maxUs", g_variant_new_int64 (histogram.getMax ()));
+
+    g_variant_builder_add (&builder, "{sv}", StartupTrace::getPhaseName (StartupTrace::Phase (phase)), g_variant_builder_end (&percentiles));
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+GVariant *Pipelines::getLoad (Pipelines *pThis)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  g_variant_builder_add (&builder, "{sv}", "streams", g_variant_new_uint32 (pThis->m_pipelines.size ()));
+  g_variant_builder_add (&builder, "{sv}", "cpuLoad", g_variant_new_double (pThis->m_scheduler.getTotalLoad ()));
+  g_variant_builder_add (&builder, "{sv}", "cpuBudget", g_variant_new_double (pThis->m_scheduler.getBudget ()));
+  HttpSession::get ().getStats ().addTo (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+bool Pipelines::onSeek (Pipelines *pThis, uint64_t stream_id, guint64 position_ns)
+{
+  auto it = pThis->m_pipelines.find (stream_id);
+  if (it == pThis->m_pipelines.end ())
+  {
+    Tracer::alarm( "trying to seek unknown stream,", stream_id);
+    return false;
+  }
+
+  return it->second->seek (position_ns);
+}
+
+Pipelines::tPipeline Pipelines::find (uint64_t stream_id) const
+{
+  auto it = m_pipelines.find (stream_id);
+  if (it == m_pipelines.end ())
+  {
+    Tracer::alarm( "unknown stream,", stream_id);
+    return tPipeline ();
+  }
+
+  return it->second;
+}
+
+bool Pipelines::onPause (Pipelines *pThis, uint64_t stream_id)
+{
+  tPipeline pipeline = pThis->find (stream_id);
+  return pipeline && pipeline->pause ();
+}
+
+bool Pipelines::onResume (Pipelines *pThis, uint64_t stream_id)
+{
+  tPipeline pipeline = pThis->find (stream_id);
+  return pipeline && pipeline->resume ();
+}
+
+bool Pipelines::onRewind (Pipelines *pThis, uint64_t stream_id, guint64 duration_ns)
+{
+  tPipeline pipeline = pThis->find (stream_id);
+  return pipeline && pipeline->rewind (duration_ns);
+}
+
 void Pipelines::reset (Pipelines* pThis)
 {
   Tracer::overdose( __PRETTY_FUNCTION__ );
+  for (auto &pipeline : pThis->m_pipelines)
+    pThis->m_scheduler.remove (pipeline.first);
+
   pThis->m_pipelines.clear();
 }
+
+gboolean Pipelines::onLoadTimer (Pipelines *pThis)
+{
+  for (auto &pipeline : pThis->m_pipelines)
+  {
+    pThis->m_scheduler.setLowestQuality (pipeline.first, pipeline.second->getLowestQuality ());
+    pThis->m_scheduler.report (pipeline.first, pipeline.second->takeCpuLoad ());
+  }
+
+  uint64_t stream_id = 0;
+  LoadScheduler::Quality quality;
+
+  if (pThis->m_scheduler.rebalance (stream_id, quality))
+  {
+    auto it = pThis->m_pipelines.find (stream_id);
+
+    if (it != pThis->m_pipelines.end ())
+      it->second->setQuality (quality);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
@@ -2,30 +2,51 @@
 
 #include "StreamDecoder.h"
 #include "stream-decoder-dbus-service.h"
+#include "LoadScheduler.h"
+#include "StartupTrace.h"
+#include "Histogram.h"
 #include <memory>
 #include <map>
 #include <cstdint>
+#include <mutex>
 
 class Pipeline;
 
 class Pipelines
 {
   public:
-    Pipelines (StreamDecoderDBusService *service);
+    Pipelines (StreamDecoderDBusService *service, double cpuBudget);
     virtual ~Pipelines ();
 
     void iteratePipelines (const std::function<void(uint64_t, std::shared_ptr<Pipeline>&)>& func );
 
   private:
     void connect();
+    void recordStartup (const StartupTrace &trace);
 
-    static bool onDecode (Pipelines *pThis, uint64_t stream_id, const gchar* uri, GVariant *allowed_samplerates, gint32* pipe);
+    static bool onDecode (Pipelines *pThis, uint64_t stream_id, const gchar* uri, GVariant *allowed_samplerates, GVariant *options, gint32* pipe, GError **error);
     static void onStop (Pipelines *pThis, uint64_t stream_id);
     static gchar ** getSupportedProtocols (Pipelines *pThis);
     static void reset (Pipelines *pThis);
+    static GVariant *getStreamStats (Pipelines *pThis, uint64_t stream_id);
+    static GVariant *getStartupStats (Pipelines *pThis);
+    static GVariant *getLoad (Pipelines *pThis);
+    static bool onSeek (Pipelines *pThis, uint64_t stream_id, guint64 position_ns);
+    static bool onPause (Pipelines *pThis, uint64_t stream_id);
+    static bool onResume (Pipelines *pThis, uint64_t stream_id);
+    static bool onRewind (Pipelines *pThis, uint64_t stream_id, guint64 duration_ns);
+    static gboolean onLoadTimer (Pipelines *pThis);
 
     typedef std::shared_ptr<Pipeline> tPipeline;
+    tPipeline find (uint64_t stream_id) const;
+
     std::map<uint64_t, tPipeline> m_pipelines;
     StreamDecoderDBusService *m_service;
+    LoadScheduler m_scheduler;
+    guint m_loadTimer;
+
+    // time to each startup phase over all streams, fed from the streaming threads
+    std::mutex m_startupMutex;
+    Histogram m_startupHistograms[StartupTrace::PHASE_LAST];
 };
 
@@ -0,0 +1,222 @@
+#include "RawPcmFormat.h"
+#include <string.h>
+#include <stdlib.h>
+
+namespace
+{
+  const guint16 WAVE_FORMAT_PCM = 0x0001;
+  const guint16 WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+  const guint16 WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+  inline guint16 readLE16 (const guint8 *p)
+  {
+    return p[0] | (p[1] << 8);
+  }
+
+  inline guint32 readLE32 (const guint8 *p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+  }
+
+  bool isSupportedWidth (gint width)
+  {
+    return width == 8 || width == 16 || width == 24 || width == 32;
+  }
+}
+
+RawPcmFormat::ParseResult RawPcmFormat::fromContentType (const gchar *mimeType, GHashTable *params, RawPcmFormat &format)
+{
+  if (!mimeType)
+    return PARSE_UNSUPPORTED;
+
+  gint bits = 0;
+
+  if (g_ascii_strcasecmp (mimeType, "audio/L16") == 0)
+    bits = 16;
+  else if (g_ascii_strcasecmp (mimeType, "audio/L24") == 0)
+    bits = 24;
+  else
+    return PARSE_UNSUPPORTED;
+
+  // RFC 2586: network byte order, one channel unless told otherwise
+  format.width = format.depth = bits;
+  format.isFloat = false;
+  format.isSigned = true;
+  format.isBigEndian = true;
+  format.channels = 1;
+  format.dataSize = 0;
+
+  if (params)
+  {
+    if (const gchar *rate = (const gchar *) g_hash_table_lookup (params, "rate"))
+      format.rate = atoi (rate);
+
+    if (const gchar *channels = (const gchar *) g_hash_table_lookup (params, "channels"))
+      format.channels = atoi (channels);
+  }
+
+  if (format.rate <= 0 || format.channels <= 0)
+    return PARSE_UNSUPPORTED;
+
+  return PARSE_OK;
+}
+
+RawPcmFormat::ParseResult RawPcmFormat::fromWavHeader (const guint8 *data, gsize size, RawPcmFormat &format, gsize &headerSize)
+{
+  if (memcmp (data, "RIFF", MIN (size, 4)) != 0)
+    return PARSE_UNSUPPORTED;
+
+  if (size < 12)
+    return PARSE_NEED_MORE_DATA;
+
+  if (memcmp (data + 8, "WAVE", 4) != 0)
+    return PARSE_UNSUPPORTED;
+
+  bool haveFormat = false;
+  gsize pos = 12;
+
+  while (pos + 8 <= size)
+  {
+    const guint8 *chunk = data + pos;
+    guint32 chunkSize = readLE32 (chunk + 4);
+
+    if (memcmp (chunk, "fmt ", 4) == 0)
+    {
+      if (chunkSize < 16)
+        return PARSE_UNSUPPORTED;
+
+      if (pos + 8 + chunkSize > size)
+        return PARSE_NEED_MORE_DATA;
+
+      guint16 tag = readLE16 (chunk + 8);
+      guint16 blockAlign = readLE16 (chunk + 20);
+
+      format.channels = readLE16 (chunk + 10);
+      format.rate = readLE32 (chunk + 12);
+      format.width = format.channels ? 8 * blockAlign / format.channels : 0;
+      format.isBigEndian = false;
+
+      // samples are left aligned in their container, so the padding bits are simply zero
+      format.depth = format.width;
+
+      // the sub format GUID starts with the format tag
+      if (tag == WAVE_FORMAT_EXTENSIBLE && chunkSize >= 40)
+        tag = readLE16 (chunk + 8 + 24);
+
+      if (tag == WAVE_FORMAT_PCM)
+      {
+        format.isFloat = false;
+        format.isSigned = format.width > 8;
+      }
+      else if (tag == WAVE_FORMAT_IEEE_FLOAT && format.width == 32)
+      {
+        format.isFloat = true;
+        format.isSigned = true;
+      }
+      else
+      {
+        return PARSE_UNSUPPORTED;
+      }
+
+      if (format.rate <= 0 || format.channels <= 0 || !isSupportedWidth (format.width))
+        return PARSE_UNSUPPORTED;
+
+      haveFormat = true;
+    }
+    else if (memcmp (chunk, "data", 4) == 0)
+    {
+      if (!haveFormat)
+        return PARSE_UNSUPPORTED;
+
+      // streaming servers don't know the size in advance
+      format.dataSize = (chunkSize == 0 || chunkSize == G_MAXUINT32) ? 0 : chunkSize;
+      headerSize = pos + 8;
+      return PARSE_OK;
+    }
+
+    pos += 8 + chunkSize + (chunkSize & 1);
+  }
+
+  return PARSE_NEED_MORE_DATA;
+}
+
+std::string RawPcmFormat::getFormatString () const
+{
+  if (isFloat)
+    return isBigEndian ? "F32BE" : "F32LE";
+
+  std::string str = isSigned ? "S" : "U";
+  str += std::to_string (depth);
+
+  if (width != depth)
+    str += "_" + std::to_string (width);
+
+  if (width > 8)
+    str += isBigEndian ? "BE" : "LE";
+
+  return str;
+}
+
+GstCaps *RawPcmFormat::toCaps () const
+{
+  return gst_caps_new_simple ("audio/x-raw",
+                              "format", G_TYPE_STRING, getFormatString ().c_str (),
+                              "layout", G_TYPE_STRING, "interleaved",
+                              "rate", G_TYPE_INT, rate,
+                              "channels", G_TYPE_INT, channels,
+                              NULL);
+}
+
+guint32 RawPcmFormat::getBytesPerFrame () const
+{
+  return channels * width / 8;
+}
+
+static void test_wavHeader ()
+{
+  const guint8 header[] =
+  {
+    'R', 'I', 'F', 'F', 0x24, 0x10, 0x00, 0x00, 'W', 'A', 'V', 'E',
+    'f', 'm', 't', ' ', 0x10, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x02, 0x00, 0x80, 0xBB, 0x00, 0x00, 0x00, 0xEE, 0x02, 0x00, 0x04, 0x00, 0x10, 0x00,
+    'd', 'a', 't', 'a', 0x00, 0x10, 0x00, 0x00
+  };
+
+  RawPcmFormat format;
+  gsize headerSize = 0;
+
+  g_assert_cmpint (RawPcmFormat::fromWavHeader (header, sizeof (header), format, headerSize), ==, RawPcmFormat::PARSE_OK);
+  g_assert_cmpuint (headerSize, ==, 44);
+  g_assert_cmpint (format.rate, ==, 48000);
+  g_assert_cmpint (format.channels, ==, 2);
+  g_assert_cmpuint (format.getBytesPerFrame (), ==, 4);
+  g_assert_cmpuint (format.dataSize, ==, 4096);
+  g_assert_true (format.getFormatString () == "S16LE");
+
+  g_assert_cmpint (RawPcmFormat::fromWavHeader (header, 30, format, headerSize), ==, RawPcmFormat::PARSE_NEED_MORE_DATA);
+  g_assert_cmpint (RawPcmFormat::fromWavHeader (header + 4, 40, format, headerSize), ==, RawPcmFormat::PARSE_UNSUPPORTED);
+}
+
+static void test_formatString ()
+{
+  RawPcmFormat format;
+
+  format.width = 32;
+  format.depth = 24;
+  g_assert_true (format.getFormatString () == "S24_32LE");
+
+  format.width = format.depth = 8;
+  format.isSigned = false;
+  g_assert_true (format.getFormatString () == "U8");
+
+  format.width = format.depth = 24;
+  format.isSigned = true;
+  format.isBigEndian = true;
+  g_assert_true (format.getFormatString () == "S24BE");
+}
+
+void RawPcmFormat::registerTests ()
+{
+  g_test_add_func ("/RawPcmFormat/wavHeader", test_wavHeader);
+  g_test_add_func ("/RawPcmFormat/formatString", test_formatString);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <string>
+
+/**
+ * RawPcmFormat describes uncompressed audio as announced by an audio/L16
+ * content type or a RIFF/WAVE header, so it can be fed to the AudioConverter
+ * without a GStreamer parser.
+ */
+class RawPcmFormat
+{
+  public:
+    enum ParseResult
+    {
+      PARSE_OK,
+      PARSE_NEED_MORE_DATA,
+      PARSE_UNSUPPORTED
+    };
+
+    // audio/L16;rate=44100;channels=2 and audio/L24
+    static ParseResult fromContentType (const gchar *mimeType, GHashTable *params, RawPcmFormat &format);
+
+    // on PARSE_OK, headerSize is the offset of the first sample
+    static ParseResult fromWavHeader (const guint8 *data, gsize size, RawPcmFormat &format, gsize &headerSize);
+
+    GstCaps *toCaps () const;
+    std::string getFormatString () const;
+    guint32 getBytesPerFrame () const;
+
+    static void registerTests ();
+
+    gint rate = 44100;
+    gint channels = 2;
+    gint width = 16;    // container size in bits
+    gint depth = 16;    // significant bits
+    bool isFloat = false;
+    bool isSigned = true;
+    bool isBigEndian = false;
+
+    // bytes of sample data announced by the header, 0 if unknown
+    guint64 dataSize = 0;
+};
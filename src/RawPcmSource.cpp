@@ -0,0 +1,316 @@
+#include "RawPcmSource.h"
+#include "Trace.h"
+#include "HttpSession.h"
+#include <string.h>
+
+namespace
+{
+  const gsize READ_SIZE = 16 * 1024;
+  const gsize MAX_HEADER_SIZE = 64 * 1024;
+}
+
+RawPcmSource::RawPcmSource (const string &uri, tDataCallback onData, tMessageCallback onMessage, tFallbackCallback onFallback) :
+    m_uri (uri),
+    m_onData (onData),
+    m_onMessage (onMessage),
+    m_onFallback (onFallback),
+    m_cancellable (g_cancellable_new ()),
+    m_formatKnown (false)
+{
+  start ();
+}
+
+RawPcmSource::~RawPcmSource ()
+{
+  {
+    // a restart waiting for the old download must not run afterwards
+    lock_guard<mutex> lock (m_mutex);
+    m_serial++;
+    g_cancellable_cancel (m_cancellable);
+  }
+
+  if (m_thread.joinable ())
+    m_thread.join ();
+
+  g_object_unref (m_cancellable);
+}
+
+bool RawPcmSource::isCandidate (const string &uri, const string &mimeType)
+{
+  if (!g_str_has_prefix (uri.c_str (), "http://") && !g_str_has_prefix (uri.c_str (), "https://"))
+    return false;
+
+  string type = mimeType.substr (0, mimeType.find (';'));
+
+  for (const gchar *rawType : { "audio/L16", "audio/L24", "audio/wav", "audio/x-wav", "audio/wave" })
+  {
+    if (g_ascii_strcasecmp (type.c_str (), rawType) == 0)
+      return true;
+  }
+
+  string path = uri.substr (0, uri.find_first_of ("?#"));
+  gchar *lower = g_ascii_strdown (path.c_str (), -1);
+
+  bool candidate = g_str_has_suffix (lower, ".wav") || g_str_has_suffix (lower, ".wave") ||
+                   g_str_has_suffix (lower, ".l16") || g_str_has_suffix (lower, ".pcm");
+
+  g_free (lower);
+  return candidate;
+}
+
+bool RawPcmSource::canSeek () const
+{
+  return m_formatKnown;
+}
+
+bool RawPcmSource::seek (guint64 positionNs, tRestartCallback onRestart)
+{
+  if (!m_formatKnown)
+    return false;
+
+  guint64 serial;
+
+  {
+    lock_guard<mutex> lock (m_mutex);
+    serial = ++m_serial;
+    g_cancellable_cancel (m_cancellable);
+  }
+
+  guint64 startFrame = gst_util_uint64_scale (positionNs, m_format.rate, GST_SECOND);
+  Tracer::info ("RawPcmSource: seeking to frame", startFrame);
+
+  // the old download may still be writing to the renderer, it's joined on the new thread instead of the main loop
+  thread previous = move (m_thread);
+  m_thread = thread (&RawPcmSource::restart, this, move (previous), serial, startFrame, onRestart);
+  return true;
+}
+
+void RawPcmSource::restart (thread previous, guint64 serial, guint64 startFrame, tRestartCallback onRestart)
+{
+  if (previous.joinable ())
+    previous.join ();
+
+  {
+    lock_guard<mutex> lock (m_mutex);
+
+    // a later seek or the destructor took over
+    if (serial != m_serial)
+      return;
+
+    g_cancellable_reset (m_cancellable);
+  }
+
+  m_pending.clear ();
+  m_startFrame = startFrame;
+  onRestart ();
+  run ();
+}
+
+void RawPcmSource::start ()
+{
+  m_thread = thread ([=] ()
+  {
+    run ();
+  });
+}
+
+void RawPcmSource::run ()
+{
+  SoupSession *session = HttpSession::get ().getSession ();
+  SoupMessage *msg = soup_message_new ("GET", m_uri.c_str ());
+
+  if (!msg)
+  {
+    m_onFallback ();
+    return;
+  }
+
+  guint64 startOffset = m_formatKnown ? m_headerSize + m_startFrame * m_format.getBytesPerFrame () : 0;
+
+  if (startOffset > 0)
+    soup_message_headers_set_range (msg->request_headers, startOffset, -1);
+
+  GError *error = NULL;
+  GInputStream *stream = soup_session_send (session, msg, m_cancellable, &error);
+
+  if (!stream)
+  {
+    reportError (error);
+  }
+  else if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code))
+  {
+    m_onMessage ("error", msg->reason_phrase ? msg->reason_phrase : "HTTP request failed");
+  }
+  else if (m_formatKnown)
+  {
+    // servers ignoring the range send everything from the start
+    if (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT || skipTo (stream, startOffset))
+      streamSamples (stream, m_format);
+  }
+  else
+  {
+    RawPcmFormat format;
+
+    if (detectFormat (stream, msg, format))
+    {
+      Tracer::info ("RawPcmSource: decoding without GStreamer,", format.getFormatString (), format.rate, "Hz", format.channels, "channels");
+      m_format = format;
+      m_formatKnown = true;
+      streamSamples (stream, format);
+    }
+    else if (!g_cancellable_is_cancelled (m_cancellable))
+    {
+      Tracer::info ("RawPcmSource: not raw PCM, falling back to decodebin");
+      g_input_stream_close (stream, NULL, NULL);
+      m_onFallback ();
+    }
+  }
+
+  if (stream)
+    g_object_unref (stream);
+
+  g_object_unref (msg);
+}
+
+bool RawPcmSource::detectFormat (GInputStream *stream, SoupMessage *msg, RawPcmFormat &format)
+{
+  GHashTable *params = NULL;
+  const char *contentType = soup_message_headers_get_content_type (msg->response_headers, &params);
+  RawPcmFormat::ParseResult result = RawPcmFormat::fromContentType (contentType, params, format);
+
+  if (params)
+    g_hash_table_destroy (params);
+
+  if (result == RawPcmFormat::PARSE_OK)
+  {
+    m_headerSize = 0;
+    return true;
+  }
+
+  while (m_pending.size () < MAX_HEADER_SIZE)
+  {
+    if (readMore (stream) <= 0)
+      return false;
+
+    gsize headerSize = 0;
+    result = RawPcmFormat::fromWavHeader (m_pending.data (), m_pending.size (), format, headerSize);
+
+    if (result == RawPcmFormat::PARSE_OK)
+    {
+      m_headerSize = headerSize;
+      m_pending.erase (m_pending.begin (), m_pending.begin () + headerSize);
+      return true;
+    }
+
+    if (result == RawPcmFormat::PARSE_UNSUPPORTED)
+      return false;
+  }
+
+  return false;
+}
+
+void RawPcmSource::streamSamples (GInputStream *stream, const RawPcmFormat &format)
+{
+  GstCaps *caps = format.toCaps ();
+  const gsize bytesPerFrame = format.getBytesPerFrame ();
+  guint64 framesSent = m_startFrame;
+  guint64 remaining = G_MAXUINT64;
+
+  if (format.dataSize)
+    remaining = format.dataSize > framesSent * bytesPerFrame ? format.dataSize - framesSent * bytesPerFrame : 0;
+
+  while (remaining > 0)
+  {
+    gsize usable = MIN ((guint64) m_pending.size (), remaining);
+    usable -= usable % bytesPerFrame;
+
+    // samples of the old position read before a seek cancelled the download
+    if (g_cancellable_is_cancelled (m_cancellable))
+      break;
+
+    if (usable > 0)
+    {
+      GstBuffer *buffer = gst_buffer_new_allocate (NULL, usable, NULL);
+      gst_buffer_fill (buffer, 0, m_pending.data (), usable);
+      GST_BUFFER_PTS (buffer) = gst_util_uint64_scale (framesSent, GST_SECOND, format.rate);
+
+      m_onData (caps, buffer);
+
+      gst_buffer_unref (buffer);
+      m_pending.erase (m_pending.begin (), m_pending.begin () + usable);
+      framesSent += usable / bytesPerFrame;
+      remaining -= usable;
+
+      if (remaining == 0)
+        break;
+    }
+
+    gssize numRead = readMore (stream);
+
+    if (numRead == 0)
+    {
+      m_onMessage ("eos", "End of stream");
+      break;
+    }
+
+    if (numRead < 0)
+      break;
+  }
+
+  if (remaining == 0)
+    m_onMessage ("eos", "End of stream");
+
+  gst_caps_unref (caps);
+}
+
+bool RawPcmSource::skipTo (GInputStream *stream, guint64 offset)
+{
+  while (offset > 0)
+  {
+    GError *error = NULL;
+    gssize skipped = g_input_stream_skip (stream, MIN (offset, (guint64) G_MAXSSIZE), m_cancellable, &error);
+
+    if (skipped < 0)
+    {
+      reportError (error);
+      return false;
+    }
+
+    if (skipped == 0)
+    {
+      m_onMessage ("eos", "End of stream");
+      return false;
+    }
+
+    offset -= skipped;
+  }
+
+  return true;
+}
+
+gssize RawPcmSource::readMore (GInputStream *stream)
+{
+  gsize oldSize = m_pending.size ();
+  m_pending.resize (oldSize + READ_SIZE);
+
+  GError *error = NULL;
+  gssize numRead = g_input_stream_read (stream, m_pending.data () + oldSize, READ_SIZE, m_cancellable, &error);
+
+  m_pending.resize (oldSize + MAX (numRead, 0));
+
+  if (numRead < 0)
+    reportError (error);
+
+  return numRead;
+}
+
+void RawPcmSource::reportError (GError *error)
+{
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  {
+    Tracer::warning ("RawPcmSource:", error->message);
+    m_onMessage ("error", error->message);
+  }
+
+  g_error_free (error);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <libsoup/soup.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "RawPcmFormat.h"
+
+using namespace std;
+
+/**
+ * RawPcmSource fetches WAV and audio/L16 streams with libsoup on its own thread
+ * and hands the samples to the Pipeline without building a GStreamer graph.
+ *
+ * If neither the content type nor the first bytes identify raw PCM, the
+ * fallback callback is invoked and the source stops.
+ */
+class RawPcmSource
+{
+  public:
+    typedef function<void (GstCaps *caps, GstBuffer *buffer)> tDataCallback;
+    typedef function<void (const string &type, const string &msg)> tMessageCallback;
+    typedef function<void ()> tFallbackCallback;
+    typedef function<void ()> tRestartCallback;
+
+    RawPcmSource (const string &uri, tDataCallback onData, tMessageCallback onMessage, tFallbackCallback onFallback);
+    virtual ~RawPcmSource ();
+
+    // only URIs looking like raw PCM are probed, everything else goes to decodebin directly
+    static bool isCandidate (const string &uri, const string &mimeType);
+
+    // false until the format is known
+    bool canSeek () const;
+
+    // restarts the download with a range request, false if the format is not known yet,
+    // onRestart is called on the new thread once the old download is gone
+    bool seek (guint64 positionNs, tRestartCallback onRestart);
+
+  private:
+    void start ();
+    void restart (thread previous, guint64 serial, guint64 startFrame, tRestartCallback onRestart);
+    void run ();
+    bool skipTo (GInputStream *stream, guint64 offset);
+    bool detectFormat (GInputStream *stream, SoupMessage *msg, RawPcmFormat &format);
+    void streamSamples (GInputStream *stream, const RawPcmFormat &format);
+    gssize readMore (GInputStream *stream);
+    void reportError (GError *error);
+
+    string m_uri;
+    tDataCallback m_onData;
+    tMessageCallback m_onMessage;
+    tFallbackCallback m_onFallback;
+
+    // a seek cancels the download and bumps the serial, restarts of superseded seeks don't run
+    mutex m_mutex;
+    guint64 m_serial = 0;
+    GCancellable *m_cancellable;
+    vector<guint8> m_pending;
+
+    RawPcmFormat m_format;
+    atomic<bool> m_formatKnown;
+    gsize m_headerSize = 0;
+    guint64 m_startFrame = 0;
+    thread m_thread;
+};
@@ -0,0 +1,109 @@
+#include "ReplaySource.h"
+#include "Trace.h"
+#include <gst/app/gstappsrc.h>
+#include <chrono>
+
+namespace
+{
+  const gchar REPLAY_SCHEME[] = "replay://";
+
+  // keeps the fast mode from reading the whole capture into memory
+  const guint64 MAX_QUEUED_BYTES = 64 * 1024;
+}
+
+ReplaySource::ReplaySource (const string &path, bool realtime) :
+    m_valid (false),
+    m_realtime (realtime),
+    m_appsrc (NULL),
+    m_stopped (false)
+{
+  m_valid = m_reader.open (path);
+
+  if (m_valid)
+    Tracer::info ("ReplaySource: replaying", path, realtime ? "at the original timing" : "as fast as possible");
+}
+
+ReplaySource::~ReplaySource ()
+{
+  stop ();
+
+  if (m_thread.joinable ())
+    m_thread.join ();
+
+  if (m_appsrc)
+    gst_object_unref (m_appsrc);
+}
+
+bool ReplaySource::isReplayUri (const string &uri)
+{
+  return g_str_has_prefix (uri.c_str (), REPLAY_SCHEME);
+}
+
+GstElement *ReplaySource::createElement (const gchar *name)
+{
+  GstElement *appsrc = m_valid ? gst_element_factory_make ("appsrc", name) : NULL;
+
+  if (!appsrc)
+    return NULL;
+
+  g_object_set (appsrc, "block", TRUE, "max-bytes", MAX_QUEUED_BYTES, "format", GST_FORMAT_BYTES, NULL);
+
+  if (!m_reader.getCaps ().empty ())
+  {
+    GstCaps *caps = gst_caps_from_string (m_reader.getCaps ().c_str ());
+    gst_app_src_set_caps (GST_APP_SRC (appsrc), caps);
+    gst_caps_unref (caps);
+  }
+
+  m_appsrc = GST_ELEMENT (gst_object_ref (appsrc));
+  return appsrc;
+}
+
+void ReplaySource::start ()
+{
+  m_thread = thread ([this] ()
+  {
+    run ();
+  });
+}
+
+void ReplaySource::stop ()
+{
+  {
+    lock_guard<mutex> lock (m_mutex);
+    m_stopped = true;
+  }
+
+  m_wakeUp.notify_all ();
+}
+
+void ReplaySource::run ()
+{
+  auto start = chrono::steady_clock::now ();
+  gint64 arrivalUs = 0;
+  vector<guint8> data;
+
+  while (!m_stopped && m_reader.read (arrivalUs, data))
+  {
+    if (m_realtime)
+    {
+      unique_lock<mutex> lock (m_mutex);
+
+      if (m_wakeUp.wait_until (lock, start + chrono::microseconds (arrivalUs), [this] () { return m_stopped.load (); }))
+        break;
+    }
+
+    if (data.empty ())
+      continue;
+
+    GstBuffer *buffer = gst_buffer_new_allocate (NULL, data.size (), NULL);
+    gst_buffer_fill (buffer, 0, data.data (), data.size ());
+
+    // blocks while the queue is full, fails once the pipeline is shut down
+    if (gst_app_src_push_buffer (GST_APP_SRC (m_appsrc), buffer) != GST_FLOW_OK)
+      return;
+  }
+
+  if (!m_stopped)
+    gst_app_src_end_of_stream (GST_APP_SRC (m_appsrc));
+}
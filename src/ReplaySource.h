@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "CaptureFile.h"
+
+using namespace std;
+
+/**
+ * ReplaySource feeds a capture file into an appsrc, which takes the place of
+ * souphttpsrc, so the recorded bytes run through the same decoder chain,
+ * AudioConverter and Resampler as they did in the field.
+ *
+ * Records are pushed at their original arrival times, or as fast as the
+ * pipeline takes them.
+ */
+class ReplaySource
+{
+  public:
+    ReplaySource (const string &path, bool realtime);
+    virtual ~ReplaySource ();
+
+    // replay:///path/to/capture
+    static bool isReplayUri (const string &uri);
+
+    // appsrc with the caps of the captured source pad, NULL if the file can't be read
+    GstElement *createElement (const gchar *name);
+
+    void start ();
+    void stop ();
+
+  private:
+    void run ();
+
+    CaptureFile::Reader m_reader;
+    bool m_valid;
+    bool m_realtime;
+    GstElement *m_appsrc;
+
+    atomic<bool> m_stopped;
+    mutex m_mutex;
+    condition_variable m_wakeUp;
+    thread m_thread;
+};
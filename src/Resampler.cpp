@@ -2,11 +2,11 @@
 #include <gst/gst.h>
 
 #include "Resampler.h"
+#include "RingBuffer.h"
 #include "StreamDecoder.h"
 
 const int FP_PRE = (5);
 const int FP_POST = (32 - FP_PRE);
-const int numChannels = 2;
 
 template<typename tIn>
   inline tIn interpolate (tIn prev, tIn next, guint32 frac);
@@ -46,13 +46,61 @@ template<>
     return (next * fracBig + prev * (one - fracBig)) >> 32;
   }
 
+namespace
+{
+  template<int numChannels>
+  class ChannelResampler : public Resampler
+  {
+    public:
+      ChannelResampler (int srcSR, int tgtSR);
+
+      GstBuffer *eat (GstBuffer *in);
+      void flush ();
+
+    private:
+      typedef tFrame<numChannels> Frame;
+
+      void calcInterpolatedFrame (Frame &target) const;
+
+      void writeToScratch (GstBuffer* in);
+      GstBuffer* createOutBuffer (size_t numOutFrames) const;
+      void doResampling (GstMapInfo outInfo, size_t numOutFrames);
+      gint64 getNumFramesAvailable () const;
+      GstBuffer* produceResampledBuffer ();
+
+      RingBuffer<Frame> m_scratchBuffer;
+  };
+}
+
+Resampler *Resampler::create (int srcSR, int tgtSR, int numChannels)
+{
+  switch (numChannels)
+  {
+    case 1:
+      return new ChannelResampler<1> (srcSR, tgtSR);
+
+    case 2:
+      return new ChannelResampler<2> (srcSR, tgtSR);
+
+    case 6:
+      return new ChannelResampler<6> (srcSR, tgtSR);
+
+    case 8:
+      return new ChannelResampler<8> (srcSR, tgtSR);
+
+    default:
+      return NULL;
+  }
+}
+
 Resampler::Resampler (int srcSR, int tgtSR) :
     m_sourceSR (srcSR),
     m_targetSR (tgtSR),
-    m_scratchBuffer (std::max (srcSR, tgtSR)),
     m_srcPositionFracFP (0),
     m_srcIncrementFP (0),
-    m_srcPositionInt (0)
+    m_srcPositionInt (0),
+    m_adaptive (false),
+    m_interpolate (true)
 {
   m_srcIncrementFP = (1 << FP_POST) * 1 / getRatio ();
 }
@@ -66,6 +114,11 @@ int Resampler::getSourceSR () const
   return m_sourceSR;
 }
 
+int Resampler::getTargetSR () const
+{
+  return m_targetSR;
+}
+
 double Resampler::getRatio () const
 {
   double inRate = m_sourceSR;
@@ -73,9 +126,28 @@ double Resampler::getRatio () const
   return outRate / inRate;
 }
 
-GstBuffer *Resampler::eat (GstBuffer *in)
+void Resampler::setDriftCorrection (double ppm)
+{
+  m_adaptive = true;
+  m_srcIncrementFP = (1 << FP_POST) / (getRatio () * (1 + ppm / 1000000));
+}
+
+void Resampler::setInterpolation (bool enabled)
+{
+  m_interpolate = enabled;
+}
+
+template<int numChannels>
+ChannelResampler<numChannels>::ChannelResampler (int srcSR, int tgtSR) :
+    Resampler (srcSR, tgtSR),
+    m_scratchBuffer (std::max (srcSR, tgtSR))
+{
+}
+
+template<int numChannels>
+GstBuffer *ChannelResampler<numChannels>::eat (GstBuffer *in)
 {
-  if (m_sourceSR == m_targetSR)
+  if (m_sourceSR == m_targetSR && !m_adaptive)
   {
     gst_buffer_ref (in);
     return in;
@@ -85,7 +157,15 @@ GstBuffer *Resampler::eat (GstBuffer *in)
   return produceResampledBuffer ();
 }
 
-void Resampler::writeToScratch (GstBuffer* in)
+template<int numChannels>
+void ChannelResampler<numChannels>::flush ()
+{
+  m_srcPositionInt = m_scratchBuffer.getWriteHead ();
+  m_srcPositionFracFP = 0;
+}
+
+template<int numChannels>
+void ChannelResampler<numChannels>::writeToScratch (GstBuffer* in)
 {
   GstMapInfo inInfo;
   if (gst_buffer_map (in, &inInfo, GST_MAP_READ))
@@ -97,20 +177,23 @@ void Resampler::writeToScratch (GstBuffer* in)
   }
 }
 
-gint64 Resampler::getNumFramesAvailable () const
+template<int numChannels>
+gint64 ChannelResampler<numChannels>::getNumFramesAvailable () const
 {
   gint64 numFramesAvailable = m_scratchBuffer.getWriteHead () - m_srcPositionInt;
   numFramesAvailable--; // need one more to interpolate
   return numFramesAvailable;
 }
 
-GstBuffer* Resampler::produceResampledBuffer ()
+template<int numChannels>
+GstBuffer* ChannelResampler<numChannels>::produceResampledBuffer ()
 {
   gint64 numFramesAvailable = getNumFramesAvailable ();
-  size_t numOutFrames = numFramesAvailable * m_targetSR / m_sourceSR;
+  size_t numOutFrames = 0;
 
-  if (numFramesAvailable <= 0)
-    numOutFrames = 0;
+  // count the steps that fit, the increment may be trimmed by a drift correction
+  if (numFramesAvailable > 0)
+    numOutFrames = (((guint64) numFramesAvailable << FP_POST) - m_srcPositionFracFP) / m_srcIncrementFP;
 
   GstBuffer* out = createOutBuffer (numOutFrames);
   GstMapInfo outInfo;
@@ -122,13 +205,15 @@ GstBuffer* Resampler::produceResampledBuffer ()
   return out;
 }
 
-GstBuffer* Resampler::createOutBuffer (size_t numOutFrames) const
+template<int numChannels>
+GstBuffer* ChannelResampler<numChannels>::createOutBuffer (size_t numOutFrames) const
 {
   const int neededSize = numChannels * sizeof(tSample) * numOutFrames;
   return gst_buffer_new_allocate (NULL, neededSize, NULL);
 }
 
-void Resampler::doResampling (GstMapInfo outInfo, size_t numOutFrames)
+template<int numChannels>
+void ChannelResampler<numChannels>::doResampling (GstMapInfo outInfo, size_t numOutFrames)
 {
   Frame* outData = (Frame*) (outInfo.data);
   for (size_t i = 0; i < numOutFrames; i++)
@@ -146,12 +231,13 @@ void Resampler::doResampling (GstMapInfo outInfo, size_t numOutFrames)
   }
 }
 
-inline void Resampler::calcInterpolatedFrame (Frame &target) const
+template<int numChannels>
+inline void ChannelResampler<numChannels>::calcInterpolatedFrame (Frame &target) const
 {
   guint32 prevFramePos = m_srcPositionInt;
   guint32 frac = m_srcPositionFracFP & ((1 << FP_POST) - 1);
 
-  if (frac == 0)
+  if (frac == 0 || !m_interpolate)
   {
     target = m_scratchBuffer.peek (prevFramePos);
   }
@@ -162,7 +248,58 @@ inline void Resampler::calcInterpolatedFrame (Frame &target) const
     const Frame &prev = m_scratchBuffer.peek (prevFramePos);
     const Frame &next = m_scratchBuffer.peek (nextFramePos);
 
+    // the channel count is a constant, so the compiler unrolls this
     for(size_t i = 0; i < numChannels; i++)
       target.samples[i] = interpolate (prev.samples[i], next.samples[i], frac);
   }
 }
+
+static void test_resampleSurround ()
+{
+  const int numChannels = 6;
+  const int numInFrames = 441;
+
+  Resampler *resampler = Resampler::create (44100, 48000, numChannels);
+  g_assert (resampler != NULL);
+
+  // every channel holds its own constant, interpolation must neither change nor mix them
+  GstBuffer *in = gst_buffer_new_allocate (NULL, numInFrames * numChannels * sizeof (tSample), NULL);
+
+  GstMapInfo info;
+  g_assert (gst_buffer_map (in, &info, GST_MAP_WRITE));
+
+  tSample *samples = (tSample *) info.data;
+
+  for (int frame = 0; frame < numInFrames; frame++)
+    for (int c = 0; c < numChannels; c++)
+      samples[frame * numChannels + c] = (c + 1) * 1000;
+
+  gst_buffer_unmap (in, &info);
+
+  // eat () doesn't take the input, the caller still owns it
+  GstBuffer *out = resampler->eat (in);
+  g_assert (out != in);
+
+  g_assert (gst_buffer_map (out, &info, GST_MAP_READ));
+
+  const size_t numOutFrames = info.size / sizeof (tSample) / numChannels;
+  g_assert_cmpuint (numOutFrames, >, 0);
+  g_assert_cmpuint (numOutFrames, <=, 480);
+
+  samples = (tSample *) info.data;
+
+  for (size_t frame = 0; frame < numOutFrames; frame++)
+    for (int c = 0; c < numChannels; c++)
+      g_assert_cmpint (samples[frame * numChannels + c], ==, (c + 1) * 1000);
+
+  gst_buffer_unmap (out, &info);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  delete resampler;
+}
+
+void Resampler::registerTests ()
+{
+  g_test_add_func ("/Resampler/resampleSurround", test_resampleSurround);
+}
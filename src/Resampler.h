@@ -26,38 +26,48 @@
 #include "StreamDecoder.h"
 #include "RingBuffer.h"
 
+/**
+ * Resampler is the interface to the linear interpolating resampler, which
+ * is a template on the channel count so every layout gets its own inner
+ * loop. create () picks one of the instances for 1, 2, 6 and 8 channels.
+ */
 class Resampler
 {
   public:
-    Resampler (int srcSR, int tgtSR);
-    ~Resampler();
+    // NULL for channel counts without an instance, see isSupportedChannelCount
+    static Resampler *create (int srcSR, int tgtSR, int numChannels);
+
+    virtual ~Resampler();
+
+    virtual GstBuffer *eat (GstBuffer *in) = 0;
+
+    // drop buffered frames and restart the interpolation phase, e.g. after a seek
+    virtual void flush () = 0;
+
+    // trims the ratio by the given ppm, the resampler won't pass through any more
+    void setDriftCorrection (double ppm);
+
+    // nearest neighbour instead of linear interpolation, for overloaded systems
+    void setInterpolation (bool enabled);
 
-    GstBuffer *eat (GstBuffer *in);
     int getSourceSR () const;
+    int getTargetSR () const;
 
-  private:
-    struct Frame
-    {
-      tSample samples[2];
-    };
+    static void registerTests ();
 
-    double getRatio () const;
-    void calcInterpolatedFrame (Frame &target) const;
+  protected:
+    Resampler (int srcSR, int tgtSR);
 
-    void writeToScratch (GstBuffer* in);
-    GstBuffer* createOutBuffer (size_t numOutFrames) const;
-    void doResampling (GstMapInfo outInfo, size_t numOutFrames);
-    gint64 getNumFramesAvailable () const;
-    GstBuffer* produceResampledBuffer ();
+    double getRatio () const;
 
     int m_sourceSR;
     int m_targetSR;
 
-    RingBuffer<Frame> m_scratchBuffer;
-
     guint32 m_srcPositionFracFP;
     guint32 m_srcIncrementFP;
     guint64 m_srcPositionInt;
+    bool m_adaptive;
+    bool m_interpolate;
 };
 
 #endif /* RESAMPLER_H_ */
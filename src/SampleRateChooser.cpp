@@ -0,0 +1,150 @@
+#include "SampleRateChooser.h"
+#include "Trace.h"
+
+namespace
+{
+  // relative cost of copying a frame compared to interpolating it
+  const double COPY_COST = 0.25;
+
+  enum Tier
+  {
+    TIER_EXACT,
+    TIER_INTEGER_UP,
+    TIER_FRACTIONAL_UP,
+    TIER_INTEGER_DOWN,
+    TIER_FRACTIONAL_DOWN
+  };
+
+  Tier classify (guint32 sourceRate, guint32 targetRate)
+  {
+    if (sourceRate == targetRate)
+      return TIER_EXACT;
+
+    if (targetRate > sourceRate)
+      return (targetRate % sourceRate == 0) ? TIER_INTEGER_UP : TIER_FRACTIONAL_UP;
+
+    return (sourceRate % targetRate == 0) ? TIER_INTEGER_DOWN : TIER_FRACTIONAL_DOWN;
+  }
+
+  bool isBetter (guint32 sourceRate, const SampleRateChooser::Choice &candidate, const SampleRateChooser::Choice &best)
+  {
+    Tier candidateTier = classify (sourceRate, candidate.rate);
+    Tier bestTier = classify (sourceRate, best.rate);
+
+    if (candidateTier != bestTier)
+      return candidateTier < bestTier;
+
+    // below the source rate, keep as much bandwidth as possible
+    if (candidateTier == TIER_INTEGER_DOWN || candidateTier == TIER_FRACTIONAL_DOWN)
+      return candidate.rate > best.rate;
+
+    return candidate.cost < best.cost;
+  }
+}
+
+SampleRateChooser::SampleRateChooser (const list<guint32> &allowedRates, double budget) :
+    m_allowedRates (allowedRates),
+    m_budget (budget)
+{
+}
+
+double SampleRateChooser::estimateCost (guint32 sourceRate, guint32 targetRate)
+{
+  if (sourceRate == 0 || targetRate == 0 || sourceRate == targetRate)
+    return 0;
+
+  // every source frame is copied into the scratch buffer
+  double frames = sourceRate * COPY_COST;
+
+  if (sourceRate % targetRate == 0)
+  {
+    // the read position always hits a source frame
+    frames += targetRate * COPY_COST;
+  }
+  else if (targetRate % sourceRate == 0)
+  {
+    // every (targetRate / sourceRate)th frame hits a source frame
+    double hits = (double) sourceRate / targetRate;
+    frames += targetRate * (hits * COPY_COST + (1 - hits));
+  }
+  else
+  {
+    frames += targetRate;
+  }
+
+  return frames / 1000000;
+}
+
+SampleRateChooser::Choice SampleRateChooser::choose (guint32 sourceRate) const
+{
+  Choice best = { sourceRate, 1.0, 0 };
+  Choice cheapest = best;
+  bool haveBest = false;
+  bool haveCheapest = false;
+
+  for (guint32 rate : m_allowedRates)
+  {
+    if (rate == 0)
+      continue;
+
+    Choice candidate = { rate, (double) rate / sourceRate, estimateCost (sourceRate, rate) };
+
+    if (!haveCheapest || candidate.cost < cheapest.cost)
+    {
+      cheapest = candidate;
+      haveCheapest = true;
+    }
+
+    if (m_budget > 0 && candidate.cost > m_budget)
+      continue;
+
+    if (!haveBest || isBetter (sourceRate, candidate, best))
+    {
+      best = candidate;
+      haveBest = true;
+    }
+  }
+
+  if (!haveBest && haveCheapest)
+  {
+    Tracer::info ("SampleRateChooser: no rate fits into the budget of", m_budget);
+    return cheapest;
+  }
+
+  return best;
+}
+
+static void test_exactMatch ()
+{
+  SampleRateChooser chooser ({ 48000, 44100, 96000 });
+  SampleRateChooser::Choice choice = chooser.choose (44100);
+
+  g_assert_cmpuint (choice.rate, ==, 44100);
+  g_assert_cmpfloat (choice.cost, ==, 0);
+}
+
+static void test_preferIntegerRatio ()
+{
+  g_assert_cmpuint (SampleRateChooser ({ 48000, 88200, 96000 }).choose (44100).rate, ==, 88200);
+  g_assert_cmpuint (SampleRateChooser ({ 48000, 96000 }).choose (44100).rate, ==, 48000);
+  g_assert_cmpuint (SampleRateChooser ({ 22050, 32000 }).choose (44100).rate, ==, 22050);
+  g_assert_cmpuint (SampleRateChooser ({ 24000, 32000 }).choose (96000).rate, ==, 32000);
+}
+
+static void test_budget ()
+{
+  double cost48k = SampleRateChooser::estimateCost (44100, 48000);
+  double cost96k = SampleRateChooser::estimateCost (44100, 96000);
+
+  g_assert_cmpfloat (cost48k, <, cost96k);
+  g_assert_cmpuint (SampleRateChooser ({ 96000 }, cost48k).choose (44100).rate, ==, 96000);
+  g_assert_cmpuint (SampleRateChooser ({ 48000, 88200 }).choose (44100).rate, ==, 88200);
+  g_assert_cmpuint (SampleRateChooser ({ 48000, 88200 }, cost48k).choose (44100).rate, ==, 48000);
+}
+
+void SampleRateChooser::registerTests ()
+{
+  g_test_add_func ("/SampleRateChooser/exactMatch", test_exactMatch);
+  g_test_add_func ("/SampleRateChooser/preferIntegerRatio", test_preferIntegerRatio);
+  g_test_add_func ("/SampleRateChooser/budget", test_budget);
+}
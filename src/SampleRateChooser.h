@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glib.h>
+#include <list>
+
+using namespace std;
+
+/**
+ * SampleRateChooser picks the target sample rate out of the rates a renderer allows.
+ *
+ * Preference: exact match, integer ratio at or above the source rate, cheapest
+ * fractional ratio at or above the source rate, and only then rates below it.
+ * If a budget is given, candidates estimated to be more expensive are skipped
+ * as long as there is a cheaper one.
+ */
+class SampleRateChooser
+{
+  public:
+    struct Choice
+    {
+      guint32 rate;
+      double ratio;   // target / source
+      double cost;    // see estimateCost
+    };
+
+    SampleRateChooser (const list<guint32> &allowedRates, double budget = 0);
+
+    Choice choose (guint32 sourceRate) const;
+
+    // estimated Resampler work in millions of frame operations per second
+    static double estimateCost (guint32 sourceRate, guint32 targetRate);
+
+    static void registerTests ();
+
+  private:
+    list<guint32> m_allowedRates;
+    double m_budget;
+};
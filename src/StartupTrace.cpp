@@ -0,0 +1,61 @@
+#include "StartupTrace.h"
+
+StartupTrace::StartupTrace (gint64 startUs) :
+    m_startUs (startUs)
+{
+  for (atomic<gint64> &phase : m_phases)
+    phase = -1;
+}
+
+bool StartupTrace::mark (Phase phase)
+{
+  gint64 unmarked = -1;
+  return m_phases[phase].compare_exchange_strong (unmarked, g_get_monotonic_time () - m_startUs);
+}
+
+gint64 StartupTrace::get (Phase phase) const
+{
+  return m_phases[phase];
+}
+
+string StartupTrace::format () const
+{
+  string result;
+
+  for (int phase = 0; phase < PHASE_LAST; phase++)
+  {
+    gint64 us = m_phases[phase];
+
+    if (us < 0)
+      continue;
+
+    gchar *entry = g_strdup_printf ("%s%s=%" G_GINT64_FORMAT, result.empty () ? "" : " ", getPhaseName (Phase (phase)), us);
+    result += entry;
+    g_free (entry);
+  }
+
+  return result;
+}
+
+const gchar *StartupTrace::getPhaseName (Phase phase)
+{
+  switch (phase)
+  {
+    case PHASE_SETUP:
+      return "setup";
+    case PHASE_HEADERS:
+      return "headers";
+    case PHASE_FIRST_BYTE:
+      return "firstByte";
+    case PHASE_TYPEFIND:
+      return "typefind";
+    case PHASE_FIRST_DECODED:
+      return "firstDecoded";
+    case PHASE_FIRST_CONVERTED:
+      return "firstConverted";
+    case PHASE_FIRST_WRITE:
+      return "firstWrite";
+    default:
+      return "unknown";
+  }
+}
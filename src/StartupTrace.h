@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glib.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+/**
+ * StartupTrace records when a Decode passed each phase on its way to the
+ * first byte in the pipe, in microseconds since the Decode call came in.
+ * Phases are marked from the main loop and the streaming threads alike,
+ * only the first mark of each phase counts.
+ */
+class StartupTrace
+{
+  public:
+    enum Phase
+    {
+      PHASE_SETUP,            // pipeline built and set to PLAYING
+      PHASE_HEADERS,          // HTTP response headers, includes DNS and connect
+      PHASE_FIRST_BYTE,       // first buffer from the source
+      PHASE_TYPEFIND,         // decodebin found the stream type
+      PHASE_FIRST_DECODED,    // first decoded buffer at the sink
+      PHASE_FIRST_CONVERTED,  // first non-empty output of converter and resampler
+      PHASE_FIRST_WRITE,      // first byte handed to the pipe
+      PHASE_LAST
+    };
+
+    // startUs is the monotonic time the Decode call came in
+    explicit StartupTrace (gint64 startUs);
+
+    // true if this call recorded the phase
+    bool mark (Phase phase);
+
+    // -1 if the phase was not reached, e.g. typefinding for hinted chains
+    gint64 get (Phase phase) const;
+
+    // "setup=812 headers=40211 ..." for the Message signal
+    string format () const;
+
+    static const gchar *getPhaseName (Phase phase);
+
+  private:
+    gint64 m_startUs;
+    atomic<gint64> m_phases[PHASE_LAST];
+};
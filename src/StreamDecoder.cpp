@@ -1,15 +1,51 @@
 #include <glib.h>
 #include <atomic>
+#include <errno.h>
+#include <string.h>
 #include <gst/gst.h>
 #include "StreamDecoder.h"
 #include "WatchDog.h"
 #include "Pipelines.h"
 #include "Pipeline.h"
+#include "Supervisor.h"
+#include "BatchDecoder.h"
+#include "ThreadPolicy.h"
 #include "Trace.h"
 
 static GMainLoop *s_theMainLoop = NULL;
 static std::atomic<bool> s_bQuit(false);
 
+// keep some headroom for the renderer running on the same box
+static gdouble s_cpuBudget = -1;
+static const gdouble DEFAULT_CPU_SHARE = 0.8;
+
+static gint s_numWorkers = 0;
+static gint s_workerFd = -1;
+
+static gchar *s_schedPolicy = NULL;
+static gchar *s_audioCpus = NULL;
+
+static gboolean s_batch = FALSE;
+static gint s_batchRate = 44100;
+static gint s_batchChannels = 2;
+static gint s_batchJobs = 0;
+static gchar *s_batchOutput = NULL;
+
+static GOptionEntry s_options[] =
+{
+  { "cpu-budget", 0, 0, G_OPTION_ARG_DOUBLE, &s_cpuBudget, "Cores available for decoding, 0 for unlimited (default: 80% of all cores)", "CORES" },
+  { "workers", 0, 0, G_OPTION_ARG_INT, &s_numWorkers, "Decode in this many worker processes, pinned to one core each (default: 0, decode in this process)", "N" },
+  { "sched-policy", 0, 0, G_OPTION_ARG_STRING, &s_schedPolicy, "Scheduling of the streaming and output threads, alternatives tried in order (e.g. fifo:40,nice:-10)", "POLICY" },
+  { "audio-cpus", 0, 0, G_OPTION_ARG_STRING, &s_audioCpus, "Restrict the streaming and output threads to these CPUs (e.g. 2-3)", "CPUS" },
+  { "batch", 0, 0, G_OPTION_ARG_NONE, &s_batch, "Decode the URIs or files given as arguments as fast as possible and exit, - reads them from stdin", NULL },
+  { "batch-rate", 0, 0, G_OPTION_ARG_INT, &s_batchRate, "Target sample rate of --batch (default: 44100)", "HZ" },
+  { "batch-channels", 0, 0, G_OPTION_ARG_INT, &s_batchChannels, "Output channels of --batch: 1, 2, 6 or 8 (default: 2)", "N" },
+  { "batch-jobs", 0, 0, G_OPTION_ARG_INT, &s_batchJobs, "Inputs decoded in parallel by --batch (default: one per core)", "N" },
+  { "batch-output", 0, 0, G_OPTION_ARG_FILENAME, &s_batchOutput, "Write what --batch decodes into this directory (default: discard it)", "DIR" },
+  { "worker-fd", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &s_workerFd, "Serve the supervisor connected at this descriptor", "FD" },
+  { NULL }
+};
+
 static void quit (int sig)
 {
   if (!s_bQuit.exchange(true))
@@ -21,6 +57,94 @@ static void sigPipe (int sig)
   Tracer::alarm( "sigPipe:", sig);
 }
 
+static void onSupervisorGone (GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data)
+{
+  quit (0);
+}
+
+static int runBatch (int numArgs, char *argv[])
+{
+  vector<string> inputs;
+
+  for (int i = 1; i < numArgs; i++)
+  {
+    if (strcmp (argv[i], "-"))
+    {
+      inputs.push_back (argv[i]);
+      continue;
+    }
+
+    char line[4096];
+
+    while (fgets (line, sizeof (line), stdin))
+    {
+      g_strstrip (line);
+
+      if (*line)
+        inputs.push_back (line);
+    }
+  }
+
+  if (inputs.empty () || s_batchRate <= 0 || !isSupportedChannelCount (s_batchChannels))
+  {
+    g_printerr ("--batch needs URIs or files, a positive --batch-rate and 1, 2, 6 or 8 --batch-channels\n");
+    return 1;
+  }
+
+  if (s_batchOutput && g_mkdir_with_parents (s_batchOutput, 0755) < 0)
+  {
+    g_printerr ("Cannot create %s: %s\n", s_batchOutput, strerror (errno));
+    return 1;
+  }
+
+  guint numJobs = s_batchJobs > 0 ? s_batchJobs : g_get_num_processors ();
+  BatchDecoder batch (inputs, s_batchRate, s_batchChannels, s_batchOutput ? s_batchOutput : "", numJobs);
+
+  return batch.run (s_theMainLoop) ? 0 : 1;
+}
+
+static int runWorker ()
+{
+  GError *error = NULL;
+  GSocket *socket = g_socket_new_from_fd (s_workerFd, &error);
+
+  if (!socket)
+  {
+    g_printerr ("->Worker: %s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  GSocketConnection *stream = g_socket_connection_factory_create_connection (socket);
+  gchar *guid = g_dbus_generate_guid ();
+  GDBusConnection *connection = g_dbus_connection_new_sync (G_IO_STREAM (stream), guid, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER,
+                                                            NULL, NULL, &error);
+  g_free (guid);
+  g_object_unref (stream);
+  g_object_unref (socket);
+
+  if (!connection)
+  {
+    g_printerr ("->Worker: cannot connect to supervisor: %s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  g_signal_connect (connection, "closed", G_CALLBACK (onSupervisorGone), NULL);
+
+  {
+    WatchDog watchdog;
+    StreamDecoderDBusService *service = stream_decoder_dbus_service_new_for_peer (connection);
+    Pipelines pipelines (service, s_cpuBudget);
+
+    g_main_loop_run (s_theMainLoop);
+    g_object_unref (service);
+  }
+
+  g_object_unref (connection);
+  return 0;
+}
+
 int main (int numArgs, char *argv[])
 {
 //  Tracer::minLevel = Tracer::TRACELEVEL_OVERDOSE;
@@ -32,15 +156,69 @@ int main (int numArgs, char *argv[])
 
   Tracer::info( "StreamDecoder is configured to output %ld bit audio data", sizeof(tSample) * 8 );
 
-  gst_init (&numArgs, &argv);
+  GOptionContext *context = g_option_context_new ("- decode audio streams for the renderer");
+  GError *error = NULL;
+
+  g_option_context_add_main_entries (context, s_options, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+
+  if (!g_option_context_parse (context, &numArgs, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+
+  g_option_context_free (context);
+
+  ThreadPolicy &policy = ThreadPolicy::getDefault ();
+
+  if ((s_schedPolicy && !ThreadPolicy::fromString (s_schedPolicy, policy)) || (s_audioCpus && !ThreadPolicy::parseCpus (s_audioCpus, policy)))
+  {
+    g_printerr ("Invalid --sched-policy or --audio-cpus\n");
+    return 1;
+  }
+
+  if (!policy.isEmpty ())
+    Tracer::info( "Audio threads:", policy.toString (), "on", policy.cpus.size (), "cpus" );
+
+  if (s_cpuBudget < 0)
+    s_cpuBudget = DEFAULT_CPU_SHARE * g_get_num_processors ();
+
+  Tracer::info( "CPU budget:", s_cpuBudget, "cores" );
 
   s_theMainLoop = g_main_loop_new (NULL, TRUE);
 
+  if (s_batch)
+  {
+    int result = runBatch (numArgs, argv);
+    g_main_loop_unref (s_theMainLoop);
+    return result;
+  }
+
+  if (s_workerFd >= 0)
+  {
+    int result = runWorker ();
+    g_main_loop_unref (s_theMainLoop);
+    return result;
+  }
+
+  while (!s_bQuit && s_numWorkers > 0)
+  {
+    WatchDog watchdog;
+    StreamDecoderDBusService *service = stream_decoder_dbus_service_new ();
+    Supervisor supervisor (service, s_numWorkers, s_cpuBudget);
+
+    g_main_loop_run (s_theMainLoop);
+    g_object_unref(service);
+  }
+
   while (!s_bQuit)
   {
     WatchDog watchdog;
     StreamDecoderDBusService *service = stream_decoder_dbus_service_new ();
-    Pipelines pipeline (service);
+    Pipelines pipeline (service, s_cpuBudget);
 
 #ifdef DESKTOP_BUILD
     bool doStats = true;
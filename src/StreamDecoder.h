@@ -13,3 +13,16 @@ typedef gint16 tSample;
 typedef gint32 dSample;
 #define BITDEPTH 16
 #endif
+
+// one interleaved sample per channel
+template<int numChannels>
+struct tFrame
+{
+  tSample samples[numChannels];
+};
+
+// the output layouts AudioConverter and Resampler have instances for
+inline bool isSupportedChannelCount (int numChannels)
+{
+  return numChannels == 1 || numChannels == 2 || numChannels == 6 || numChannels == 8;
+}
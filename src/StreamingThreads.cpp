@@ -0,0 +1,281 @@
+#include "StreamingThreads.h"
+#include "ThreadPolicy.h"
+#include "Trace.h"
+#include <sched.h>
+#include <string.h>
+
+namespace
+{
+  // what a thread from GStreamer's pool brought along, put back before it serves someone else
+  struct SavedThread
+  {
+    bool valid;
+    ThreadPolicy::Saved scheduling;   // policy, priority, nice value and CPU mask
+    bool nameSaved;
+    char name[16];    // the kernel keeps 15 characters
+  };
+
+  thread_local SavedThread s_saved;
+
+  void saveThread ()
+  {
+    if (s_saved.valid)
+      return;
+
+    s_saved.valid = true;
+    s_saved.scheduling = ThreadPolicy::save ();
+    s_saved.nameSaved = pthread_getname_np (pthread_self (), s_saved.name, sizeof (s_saved.name)) == 0;
+  }
+
+  void restoreThread ()
+  {
+    if (!s_saved.valid)
+      return;
+
+    // a real-time priority left behind would carry over to GIO's work and could starve the main loop
+    ThreadPolicy::restore (s_saved.scheduling);
+
+    // otherwise top and schedstats would charge the next user's work to this stream
+    if (s_saved.nameSaved)
+      pthread_setname_np (pthread_self (), s_saved.name);
+
+    s_saved.valid = false;
+  }
+
+  gint64 readClockNs (clockid_t clock)
+  {
+    struct timespec ts;
+
+    if (clock_gettime (clock, &ts) != 0)
+      return -1;
+
+    return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+  }
+}
+
+StreamingThreads::StreamingThreads ()
+{
+  for (int &cpu : m_affinity)
+    cpu = -1;
+
+  memset (&m_finished, 0, sizeof (m_finished));
+}
+
+void StreamingThreads::setName (const string &name)
+{
+  m_name = name;
+}
+
+void StreamingThreads::setAffinity (Stage stage, int cpu)
+{
+  m_affinity[stage] = cpu;
+}
+
+void StreamingThreads::assign (const gchar *elementName, Stage stage)
+{
+  m_assignments.push_back (make_pair (string (elementName), stage));
+}
+
+const gchar *StreamingThreads::getStageName (Stage stage)
+{
+  switch (stage)
+  {
+    case STAGE_NETWORK:
+      return "network";
+    case STAGE_DECODE:
+      return "decode";
+    case STAGE_OUTPUT:
+      return "output";
+    default:
+      return "unknown";
+  }
+}
+
+StreamingThreads::Stage StreamingThreads::getStage (GstElement *owner) const
+{
+  for (auto &assignment : m_assignments)
+  {
+    if (owner && assignment.first == GST_OBJECT_NAME (owner))
+      return assignment.second;
+  }
+
+  // e.g. the multiqueue inside decodebin for demuxed formats
+  return STAGE_DECODE;
+}
+
+void StreamingThreads::onStreamStatus (GstMessage *message)
+{
+  GstStreamStatusType type;
+  GstElement *owner = NULL;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+
+  if (type == GST_STREAM_STATUS_TYPE_ENTER)
+    enter (getStage (owner));
+  else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+    leave ();
+}
+
+void StreamingThreads::enter (Stage stage)
+{
+  Thread thread;
+  thread.stage = stage;
+  thread.id = pthread_self ();
+  thread.hasClock = pthread_getcpuclockid (thread.id, &thread.clock) == 0;
+  thread.enteredUs = g_get_monotonic_time ();
+  thread.cpuStartNs = readClockNs (CLOCK_THREAD_CPUTIME_ID);
+  thread.tid = ThreadPolicy::getThreadId ();
+  thread.runDelayStartNs = 0;
+  thread.slicesStart = 0;
+
+  ThreadPolicy::readSchedStat (thread.tid, thread.runDelayStartNs, thread.slicesStart);
+  saveThread ();
+
+  // the policy's CPU set first, a CPU given for this stream and stage overrides it
+  string policy = ThreadPolicy::getDefault ().apply ();
+
+  if (m_affinity[stage] >= 0)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (m_affinity[stage], &cpus);
+
+    int error = pthread_setaffinity_np (thread.id, sizeof (cpus), &cpus);
+
+    if (error)
+      Tracer::warning ("StreamingThreads: cannot pin", getStageName (stage), "thread to cpu", m_affinity[stage], strerror (error));
+  }
+
+  if (!m_name.empty ())
+  {
+    // the kernel keeps 15 characters
+    string name = string (getStageName (stage)) + ":" + m_name;
+    pthread_setname_np (thread.id, name.substr (0, 15).c_str ());
+  }
+
+  Tracer::info ("StreamingThreads:", getStageName (stage), "thread entered");
+
+  lock_guard<mutex> lock (m_mutex);
+  m_threads.push_back (thread);
+
+  if (!policy.empty ())
+    m_policy = policy;
+}
+
+void StreamingThreads::leave ()
+{
+  pthread_t self = pthread_self ();
+  lock_guard<mutex> lock (m_mutex);
+
+  // the pool hands threads from one pipeline to the next, so the entry goes and only its numbers stay
+  for (auto it = m_threads.begin (); it != m_threads.end ();)
+  {
+    const Thread &thread = *it;
+
+    if (!pthread_equal (thread.id, self))
+    {
+      ++it;
+      continue;
+    }
+
+    guint64 runDelayNs = 0;
+    guint64 slices = 0;
+
+    if (ThreadPolicy::readSchedStat (thread.tid, runDelayNs, slices))
+    {
+      m_finished.runDelayNs[thread.stage] += runDelayNs - thread.runDelayStartNs;
+      m_finished.slices[thread.stage] += slices - thread.slicesStart;
+    }
+
+    gint64 cpu = readClockNs (CLOCK_THREAD_CPUTIME_ID) - thread.cpuStartNs;
+
+    m_finished.cpuNs[thread.stage] += MAX (cpu, 0);
+    m_finished.wallUs[thread.stage] += g_get_monotonic_time () - thread.enteredUs;
+    m_finished.seen[thread.stage] = true;
+
+    it = m_threads.erase (it);
+  }
+
+  restoreThread ();
+}
+
+void StreamingThreads::collect (Totals &totals, bool withSchedStats) const
+{
+  gint64 now = g_get_monotonic_time ();
+  lock_guard<mutex> lock (m_mutex);
+
+  totals = m_finished;
+
+  for (const Thread &thread : m_threads)
+  {
+    gint64 cpu = thread.hasClock ? readClockNs (thread.clock) - thread.cpuStartNs : 0;
+    guint64 runDelayNs = 0;
+    guint64 slices = 0;
+
+    if (withSchedStats && ThreadPolicy::readSchedStat (thread.tid, runDelayNs, slices))
+    {
+      totals.runDelayNs[thread.stage] += runDelayNs - thread.runDelayStartNs;
+      totals.slices[thread.stage] += slices - thread.slicesStart;
+    }
+
+    totals.cpuNs[thread.stage] += MAX (cpu, 0);
+    totals.wallUs[thread.stage] += now - thread.enteredUs;
+    totals.seen[thread.stage] = true;
+  }
+}
+
+gint64 StreamingThreads::getCpuNs (Stage stage) const
+{
+  Totals totals;
+  collect (totals, false);
+
+  if (stage != STAGE_LAST)
+    return totals.cpuNs[stage];
+
+  gint64 total = 0;
+
+  for (gint64 ns : totals.cpuNs)
+    total += ns;
+
+  return total;
+}
+
+void StreamingThreads::addStats (GVariantBuilder *builder) const
+{
+  Totals totals;
+  collect (totals, true);
+
+  for (int stage = 0; stage < STAGE_LAST; stage++)
+  {
+    if (!totals.seen[stage])
+      continue;
+
+    const gchar *name = getStageName (Stage (stage));
+    guint64 busyMs = totals.cpuNs[stage] / 1000000;
+    guint64 wallMs = totals.wallUs[stage] / 1000;
+
+    // average wait per timeslice, i.e. the wake-up latency on a loaded box
+    guint64 slices = totals.slices[stage];
+    guint64 waitUs = slices ? totals.runDelayNs[stage] / slices / 1000 : 0;
+
+    gchar *busyKey = g_strdup_printf ("%sBusyMs", name);
+    gchar *blockedKey = g_strdup_printf ("%sBlockedMs", name);
+    gchar *runDelayKey = g_strdup_printf ("%sRunDelayMs", name);
+    gchar *waitKey = g_strdup_printf ("%sSchedWaitUs", name);
+
+    g_variant_builder_add (builder, "{sv}", busyKey, g_variant_new_uint64 (busyMs));
+    g_variant_builder_add (builder, "{sv}", blockedKey, g_variant_new_uint64 (wallMs > busyMs ? wallMs - busyMs : 0));
+    g_variant_builder_add (builder, "{sv}", runDelayKey, g_variant_new_uint64 (totals.runDelayNs[stage] / 1000000));
+    g_variant_builder_add (builder, "{sv}", waitKey, g_variant_new_uint64 (waitUs));
+
+    g_free (busyKey);
+    g_free (blockedKey);
+    g_free (runDelayKey);
+    g_free (waitKey);
+  }
+
+  lock_guard<mutex> lock (m_mutex);
+
+  if (!m_policy.empty ())
+    g_variant_builder_add (builder, "{sv}", "schedPolicy", g_variant_new_string (m_policy.c_str ()));
+}
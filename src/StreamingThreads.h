@@ -0,0 +1,99 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+#include <mutex>
+#include <list>
+#include <string>
+
+using namespace std;
+
+/**
+ * StreamingThreads keeps track of the GStreamer streaming threads of one
+ * Pipeline. They announce themselves with STREAM_STATUS messages, which are
+ * delivered synchronously on the thread in question, so it can be pinned to
+ * a CPU, get the ThreadPolicy applied, and its CPU clock and scheduling
+ * delay can be sampled later on.
+ *
+ * The threads come from a pool GLib shares with GIO and other streams, so
+ * whatever was changed on ENTER is put back on LEAVE.
+ */
+class StreamingThreads
+{
+  public:
+    enum Stage
+    {
+      STAGE_NETWORK,
+      STAGE_DECODE,
+      STAGE_OUTPUT,
+      STAGE_LAST
+    };
+
+    StreamingThreads ();
+
+    // threads are named "<stage>:<name>", e.g. "decode:42" in top -H
+    void setName (const string &name);
+
+    // -1 leaves the threads of this stage to the scheduler
+    void setAffinity (Stage stage, int cpu);
+
+    // the task started by this element runs the given stage
+    void assign (const gchar *elementName, Stage stage);
+
+    // from a sync bus handler
+    void onStreamStatus (GstMessage *message);
+
+    // CPU and wall clock time of all threads per stage, the difference is time spent blocked,
+    // and how long they waited for a CPU after becoming runnable
+    void addStats (GVariantBuilder *builder) const;
+
+    // cumulative over all threads of the stage, or of all stages with STAGE_LAST
+    gint64 getCpuNs (Stage stage) const;
+
+    static const gchar *getStageName (Stage stage);
+
+  private:
+    struct Thread
+    {
+      Stage stage;
+      pthread_t id;
+      clockid_t clock;
+      bool hasClock;
+      gint64 enteredUs;
+      gint64 cpuStartNs;   // threads from GStreamer's pool may have worked for others before
+      pid_t tid;
+      guint64 runDelayStartNs;
+      guint64 slicesStart;
+    };
+
+    struct Totals
+    {
+      gint64 cpuNs[STAGE_LAST];
+      gint64 wallUs[STAGE_LAST];
+      guint64 runDelayNs[STAGE_LAST];
+      guint64 slices[STAGE_LAST];
+      bool seen[STAGE_LAST];
+    };
+
+    Stage getStage (GstElement *owner) const;
+    // reading the scheduler statistics of running threads costs a file per thread
+    void collect (Totals &totals, bool withSchedStats) const;
+    void enter (Stage stage);
+    void leave ();
+
+    string m_name;
+    int m_affinity[STAGE_LAST];
+    list<pair<string, Stage>> m_assignments;
+
+    // what ThreadPolicy::apply () achieved on the last thread
+    string m_policy;
+
+    mutable mutex m_mutex;
+
+    // threads that are still in this pipeline, the ones that left only count in m_finished
+    list<Thread> m_threads;
+    Totals m_finished;
+};
@@ -0,0 +1,887 @@
+#include "Supervisor.h"
+#include "SupportedProtocols.h"
+#include "ThreadPolicy.h"
+#include "Trace.h"
+#include <gio/gunixfdlist.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+namespace
+{
+  const guint LOAD_INTERVAL_SECONDS = 1;
+  const guint RESPAWN_DELAY_SECONDS = 1;
+
+  // a stuck worker must not keep the renderer waiting forever
+  const gint CALL_TIMEOUT_MS = 5000;
+
+  // how long workers get to exit on SIGTERM before they are killed
+  const gint64 EXIT_TIMEOUT_US = 1000000;
+
+  // counts for streams whose load the worker hasn't measured yet
+  const double STREAM_WEIGHT = 0.05;
+
+  struct ChildSetup
+  {
+    int fd;
+    int cpu;
+  };
+}
+
+Supervisor::Supervisor (StreamDecoderDBusService *service, int numWorkers, double cpuBudget) :
+    m_service (service),
+    m_workerBudget (cpuBudget / numWorkers),
+    m_loadTimer (0),
+    m_cancellable (g_cancellable_new ())
+{
+  g_object_ref (m_service);
+  connect ();
+
+  int numCpus = g_get_num_processors ();
+
+  for (int i = 0; i < numWorkers; i++)
+  {
+    Worker *worker = new Worker ();
+    worker->supervisor = this;
+    worker->index = i;
+    worker->cpu = i % numCpus;
+
+    m_workers.push_back (shared_ptr<Worker> (worker));
+    spawn (worker);
+  }
+
+  Tracer::info ("Supervisor:", numWorkers, "workers with", m_workerBudget, "cores each");
+
+  m_loadTimer = g_timeout_add_seconds (LOAD_INTERVAL_SECONDS, (GSourceFunc) &Supervisor::onLoadTimer, this);
+}
+
+Supervisor::~Supervisor ()
+{
+  if (m_loadTimer)
+    g_source_remove (m_loadTimer);
+
+  for (auto &worker : m_workers)
+  {
+    if (worker->respawnSource)
+      g_source_remove (worker->respawnSource);
+
+    if (worker->childWatch)
+      g_source_remove (worker->childWatch);
+
+    release (worker.get ());
+
+    if (worker->pid)
+      kill (worker->pid, SIGTERM);
+  }
+
+  // the child watches are gone, so the workers are waited for here
+  for (auto &worker : m_workers)
+  {
+    if (worker->pid)
+    {
+      reap (worker->pid);
+      g_spawn_close_pid (worker->pid);
+    }
+  }
+
+  for (auto &pipe : m_pipes)
+    close (pipe.second);
+
+  g_cancellable_cancel (m_cancellable);
+  g_object_unref (m_cancellable);
+  g_object_unref (m_service);
+}
+
+void Supervisor::reap (GPid pid)
+{
+  gint64 deadline = g_get_monotonic_time () + EXIT_TIMEOUT_US;
+
+  while (g_get_monotonic_time () < deadline)
+  {
+    pid_t reaped = waitpid (pid, NULL, WNOHANG);
+
+    if (reaped == pid || (reaped < 0 && errno != EINTR))
+      return;
+
+    g_usleep (10000);
+  }
+
+  Tracer::warning ("Supervisor: worker with pid", pid, "ignored SIGTERM, killing it");
+  kill (pid, SIGKILL);
+
+  while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+}
+
+void Supervisor::connect ()
+{
+  // calls answered by the workers are completed asynchronously, the main loop keeps running meanwhile
+  g_signal_connect_swapped (m_service, "forward", G_CALLBACK (&Supervisor::onForward), this);
+  g_signal_connect_swapped (m_service, "stop", G_CALLBACK (&Supervisor::onStop), this);
+  g_signal_connect_swapped (m_service, "get-supported-protocols", G_CALLBACK (&Supervisor::getSupportedProtocols), this);
+  g_signal_connect_swapped (m_service, "reset", G_CALLBACK (&Supervisor::reset), this);
+  g_signal_connect_swapped (m_service, "get-load", G_CALLBACK (&Supervisor::getLoad), this);
+}
+
+void Supervisor::onChildSetup (gpointer data)
+{
+  // runs in the forked child before exec, async-signal-safe calls only
+  ChildSetup *setup = (ChildSetup *) data;
+
+  if (setup->fd != WORKER_FD)
+    dup2 (setup->fd, WORKER_FD);
+
+  fcntl (WORKER_FD, F_SETFD, 0);
+
+  cpu_set_t cpus;
+  CPU_ZERO (&cpus);
+  CPU_SET (setup->cpu, &cpus);
+  sched_setaffinity (0, sizeof (cpus), &cpus);
+
+  // don't outlive the supervisor
+  prctl (PR_SET_PDEATHSIG, SIGTERM);
+}
+
+void Supervisor::spawn (Worker *worker)
+{
+  int fds[2];
+
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+  {
+    Tracer::alarm ("Supervisor: cannot create socketpair,", strerror (errno));
+    return;
+  }
+
+  gchar *executable = g_file_read_link ("/proc/self/exe", NULL);
+  gchar budget[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar *budgetArg = g_strconcat ("--cpu-budget=", g_ascii_dtostr (budget, sizeof (budget), m_workerBudget), NULL);
+  gchar *fdArg = g_strdup_printf ("--worker-fd=%d", WORKER_FD);
+
+  // the worker is pinned as a whole, so only the scheduling policy is passed on
+  string policy = ThreadPolicy::getDefault ().toString ();
+  gchar *policyArg = policy.empty () ? NULL : g_strconcat ("--sched-policy=", policy.c_str (), NULL);
+  gchar *argv[] = { executable, fdArg, budgetArg, policyArg, NULL };
+
+  ChildSetup setup = { fds[1], worker->cpu };
+  GError *error = NULL;
+
+  bool spawned = executable && g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, &Supervisor::onChildSetup, &setup, &worker->pid, &error);
+
+  g_free (fdArg);
+  g_free (budgetArg);
+  g_free (policyArg);
+  g_free (executable);
+  close (fds[1]);
+
+  if (!spawned)
+  {
+    Tracer::alarm ("Supervisor: cannot start worker", worker->index, error ? error->message : "");
+    g_clear_error (&error);
+    close (fds[0]);
+    return;
+  }
+
+  Tracer::info ("Supervisor: worker", worker->index, "started with pid", worker->pid, "on cpu", worker->cpu);
+  worker->childWatch = g_child_watch_add (worker->pid, (GChildWatchFunc) &Supervisor::onWorkerExited, worker);
+
+  GSocket *socket = g_socket_new_from_fd (fds[0], &error);
+
+  if (!socket)
+  {
+    Tracer::alarm ("Supervisor: cannot use socket of worker", worker->index, error->message);
+    g_error_free (error);
+    close (fds[0]);
+    return;
+  }
+
+  // the worker is the server side of the peer-to-peer connection
+  GSocketConnection *stream = g_socket_connection_factory_create_connection (socket);
+  g_dbus_connection_new (G_IO_STREAM (stream), NULL, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT, NULL, NULL,
+                         (GAsyncReadyCallback) &Supervisor::onConnected, worker);
+
+  g_object_unref (stream);
+  g_object_unref (socket);
+}
+
+void Supervisor::release (Worker *worker)
+{
+  if (worker->proxy)
+  {
+    g_signal_handlers_disconnect_by_data (worker->proxy, worker);
+    g_clear_object (&worker->proxy);
+  }
+
+  if (worker->connection)
+  {
+    g_dbus_connection_close (worker->connection, NULL, NULL, NULL);
+    g_clear_object (&worker->connection);
+  }
+
+  // the respawned worker counts from zero again
+  m_retiredHttp.add (worker->http);
+  worker->streams = 0;
+  worker->cpuLoad = 0;
+  worker->http = HttpSession::Stats ();
+}
+
+void Supervisor::onConnected (GObject *source, GAsyncResult *result, Worker *worker)
+{
+  GError *error = NULL;
+  worker->connection = g_dbus_connection_new_finish (result, &error);
+
+  if (!worker->connection)
+  {
+    // the child watch starts it again
+    Tracer::alarm ("Supervisor: cannot connect to worker", worker->index, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  worker->proxy = stream_decoder_proxy_new_sync (worker->connection, G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES, NULL,
+                                                 "/com/raumfeld/StreamDecoder", NULL, &error);
+
+  if (!worker->proxy)
+  {
+    Tracer::alarm ("Supervisor: no proxy for worker", worker->index, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (worker->proxy), CALL_TIMEOUT_MS);
+  g_signal_connect (worker->proxy, "message", G_CALLBACK (&Supervisor::onWorkerMessage), worker);
+
+  Tracer::info ("Supervisor: worker", worker->index, "connected");
+}
+
+void Supervisor::onWorkerExited (GPid pid, gint status, Worker *worker)
+{
+  Supervisor *pThis = worker->supervisor;
+
+  Tracer::alarm ("Supervisor: worker", worker->index, "exited with status", status);
+
+  g_spawn_close_pid (pid);
+  worker->pid = 0;
+  worker->childWatch = 0;
+
+  // the renderers see the end of their pipes, tell them why
+  vector<uint64_t> lost;
+
+  for (auto &stream : pThis->m_streams)
+  {
+    if (stream.second == worker)
+      lost.push_back (stream.first);
+  }
+
+  for (uint64_t stream_id : lost)
+  {
+    stream_decoder_emit_message_signal (pThis->m_service, stream_id, "error", "Decoder process died");
+    pThis->forget (stream_id);
+  }
+
+  pThis->release (worker);
+  worker->respawnSource = g_timeout_add_seconds (RESPAWN_DELAY_SECONDS, (GSourceFunc) &Supervisor::onRespawn, worker);
+}
+
+gboolean Supervisor::onRespawn (Worker *worker)
+{
+  worker->respawnSource = 0;
+  worker->supervisor->spawn (worker);
+  return G_SOURCE_REMOVE;
+}
+
+void Supervisor::onWorkerMessage (StreamDecoder *proxy, const gchar *type, const gchar *content, guint64 stream_id, Worker *worker)
+{
+  stream_decoder_emit_message_signal (worker->supervisor->m_service, stream_id, type, content);
+}
+
+gboolean Supervisor::onLoadTimer (Supervisor *pThis)
+{
+  for (auto &worker : pThis->m_workers)
+  {
+    if (worker->proxy)
+      stream_decoder_call_get_load (worker->proxy, pThis->m_cancellable, (GAsyncReadyCallback) &Supervisor::onLoadReply,
+                                    new shared_ptr<Worker> (worker));
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+void Supervisor::onLoadReply (GObject *source, GAsyncResult *result, shared_ptr<Worker> *reference)
+{
+  // keeps the worker alive if the Supervisor went away meanwhile, the reply is cancelled then
+  shared_ptr<Worker> worker (*reference);
+  delete reference;
+
+  GVariant *load = NULL;
+
+  if (!stream_decoder_call_get_load_finish (STREAM_DECODER (source), &load, result, NULL))
+    return;
+
+  // the reply may come from a proxy released in the meantime
+  if (worker->proxy == STREAM_DECODER (source))
+  {
+    g_variant_lookup (load, "cpuLoad", "d", &worker->cpuLoad);
+
+    // totals since the worker started
+    worker->http = HttpSession::Stats ();
+    worker->http.addFrom (load);
+  }
+
+  g_variant_unref (load);
+}
+
+vector<Supervisor::Worker *> Supervisor::getCandidates () const
+{
+  vector<Worker *> candidates;
+
+  for (auto &worker : m_workers)
+  {
+    if (worker->proxy)
+      candidates.push_back (worker.get ());
+  }
+
+  // least loaded first, new streams count before their load is measured
+  std::stable_sort (candidates.begin (), candidates.end (), [] (const Worker *a, const Worker *b)
+  {
+    return a->cpuLoad + a->streams * STREAM_WEIGHT < b->cpuLoad + b->streams * STREAM_WEIGHT;
+  });
+
+  return candidates;
+}
+
+Supervisor::Worker *Supervisor::find (uint64_t stream_id) const
+{
+  auto it = m_streams.find (stream_id);
+  if (it == m_streams.end () || !it->second->proxy)
+  {
+    Tracer::alarm( "unknown stream,", stream_id);
+    return NULL;
+  }
+
+  return it->second;
+}
+
+void Supervisor::forget (uint64_t stream_id)
+{
+  auto it = m_streams.find (stream_id);
+
+  if (it != m_streams.end ())
+  {
+    if (it->second->streams > 0)
+      it->second->streams--;
+
+    m_streams.erase (it);
+  }
+
+  auto pipe = m_pipes.find (stream_id);
+
+  if (pipe != m_pipes.end ())
+  {
+    close (pipe->second);
+    m_pipes.erase (pipe);
+  }
+}
+
+void Supervisor::onStop (Supervisor *pThis, uint64_t stream_id)
+{
+  auto pending = pThis->m_decoding.find (stream_id);
+
+  if (pending != pThis->m_decoding.end ())
+  {
+    // the worker doesn't know the stream yet, it's stopped there once the decode reply comes in
+    pending->second->stopped = true;
+    pThis->m_decoding.erase (pending);
+    return;
+  }
+
+  if (Worker *worker = pThis->find (stream_id))
+    stream_decoder_call_stop (worker->proxy, stream_id, NULL, NULL, NULL);
+
+  pThis->forget (stream_id);
+}
+
+gchar ** Supervisor::getSupportedProtocols (Supervisor *pThis)
+{
+  return SupportedProtocols::get ().asArrayOfStrings ();
+}
+
+void Supervisor::reset (Supervisor *pThis)
+{
+  for (auto &worker : pThis->m_workers)
+  {
+    if (worker->proxy)
+      stream_decoder_call_reset (worker->proxy, NULL, NULL, NULL);
+  }
+
+  for (auto &pending : pThis->m_decoding)
+    pending.second->stopped = true;
+
+  pThis->m_decoding.clear ();
+
+  while (!pThis->m_streams.empty ())
+    pThis->forget (pThis->m_streams.begin ()->first);
+}
+
+GVariant *Supervisor::getLoad (Supervisor *pThis)
+{
+  double cpuLoad = 0;
+  guint workers = 0;
+  HttpSession::Stats http = pThis->m_retiredHttp;
+
+  for (auto &worker : pThis->m_workers)
+  {
+    cpuLoad += worker->cpuLoad;
+    http.add (worker->http);
+
+    if (worker->proxy)
+      workers++;
+  }
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  g_variant_builder_add (&builder, "{sv}", "streams", g_variant_new_uint32 (pThis->m_streams.size ()));
+  g_variant_builder_add (&builder, "{sv}", "cpuLoad", g_variant_new_double (cpuLoad));
+  g_variant_builder_add (&builder, "{sv}", "cpuBudget", g_variant_new_double (pThis->m_workerBudget * pThis->m_workers.size ()));
+  g_variant_builder_add (&builder, "{sv}", "workers", g_variant_new_uint32 (workers));
+  http.addTo (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+Supervisor::Call::Call (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation) :
+    service (STREAM_DECODER (g_object_ref (service))),
+    invocation (invocation)
+{
+}
+
+Supervisor::Call::~Call ()
+{
+  g_object_unref (service);
+}
+
+Supervisor::StartupStatsCall::StartupStatsCall (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation) :
+    Call (service, invocation)
+{
+}
+
+Supervisor::StartupStatsCall::~StartupStatsCall ()
+{
+  for (auto &phase : merged)
+  {
+    for (auto &value : phase.second)
+      g_variant_unref (value.second);
+  }
+}
+
+Supervisor::DecodeCall::DecodeCall (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation) :
+    Call (service, invocation)
+{
+}
+
+Supervisor::DecodeCall::~DecodeCall ()
+{
+  if (allowedSamplerates)
+    g_variant_unref (allowedSamplerates);
+
+  if (options)
+    g_variant_unref (options);
+}
+
+gboolean Supervisor::onForward (Supervisor *pThis, GDBusMethodInvocation *invocation)
+{
+  const gchar *method = g_dbus_method_invocation_get_method_name (invocation);
+  GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+  uint64_t stream_id = 0;
+  guint64 ns = 0;
+
+  if (g_str_equal (method, "Decode") || g_str_equal (method, "DecodeWithOptions"))
+  {
+    DecodeCall *call = new DecodeCall (pThis->m_service, invocation);
+    const gchar *uri = NULL;
+
+    call->supervisor = pThis;
+    call->withOptions = g_str_equal (method, "DecodeWithOptions");
+
+    if (call->withOptions)
+    {
+      g_variant_get (parameters, "(t&s@ai@a{sv})", &call->stream_id, &uri, &call->allowedSamplerates, &call->options);
+    }
+    else
+    {
+      g_variant_get (parameters, "(t&s@ai)", &call->stream_id, &uri, &call->allowedSamplerates);
+      call->options = g_variant_ref_sink (g_variant_new ("a{sv}", NULL));
+    }
+
+    call->uri = uri;
+    pThis->decode (call);
+  }
+  else if (g_str_equal (method, "GetStartupStats"))
+  {
+    pThis->getStartupStats (new StartupStatsCall (pThis->m_service, invocation));
+  }
+  else if (g_str_equal (method, "GetStreamStats"))
+  {
+    g_variant_get (parameters, "(t)", &stream_id);
+
+    if (Worker *worker = pThis->find (stream_id))
+      stream_decoder_call_get_stream_stats (worker->proxy, stream_id, pThis->m_cancellable,
+                                            (GAsyncReadyCallback) &Supervisor::onStreamStatsReply, new Call (pThis->m_service, invocation));
+    else
+      g_dbus_method_invocation_return_dbus_error (invocation, "error", "Unknown stream_id");
+  }
+  else if (g_str_equal (method, "Seek"))
+  {
+    g_variant_get (parameters, "(tt)", &stream_id, &ns);
+
+    if (Worker *worker = pThis->find (stream_id))
+      stream_decoder_call_seek (worker->proxy, stream_id, ns, pThis->m_cancellable,
+                                (GAsyncReadyCallback) &Supervisor::onSeekReply, new Call (pThis->m_service, invocation));
+    else
+      g_dbus_method_invocation_return_dbus_error (invocation, "error", "Seek failed");
+  }
+  else if (g_str_equal (method, "Pause") || g_str_equal (method, "Resume"))
+  {
+    g_variant_get (parameters, "(t)", &stream_id);
+    bool pause = g_str_equal (method, "Pause");
+
+    if (Worker *worker = pThis->find (stream_id))
+    {
+      if (pause)
+        stream_decoder_call_pause (worker->proxy, stream_id, pThis->m_cancellable,
+                                   (GAsyncReadyCallback) &Supervisor::onPauseReply, new Call (pThis->m_service, invocation));
+      else
+        stream_decoder_call_resume (worker->proxy, stream_id, pThis->m_cancellable,
+                                    (GAsyncReadyCallback) &Supervisor::onResumeReply, new Call (pThis->m_service, invocation));
+    }
+    else
+    {
+      g_dbus_method_invocation_return_dbus_error (invocation, "error", "Stream has no timeshift buffer");
+    }
+  }
+  else if (g_str_equal (method, "Rewind"))
+  {
+    g_variant_get (parameters, "(tt)", &stream_id, &ns);
+
+    if (Worker *worker = pThis->find (stream_id))
+      stream_decoder_call_rewind (worker->proxy, stream_id, ns, pThis->m_cancellable,
+                                  (GAsyncReadyCallback) &Supervisor::onRewindReply, new Call (pThis->m_service, invocation));
+    else
+      g_dbus_method_invocation_return_dbus_error (invocation, "error", "Stream has no timeshift buffer");
+  }
+  else
+  {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void Supervisor::decode (DecodeCall *call)
+{
+  if (call->stream_id == 0)
+  {
+    failDecode (call, "Wrong stream_id parameter");
+    return;
+  }
+
+  // the stream being replaced may live in another worker, or still be on its way to one
+  if (m_streams.count (call->stream_id) || m_decoding.count (call->stream_id))
+    onStop (this, call->stream_id);
+
+  m_decoding[call->stream_id] = call;
+  call->candidates = getCandidates ();
+  call->error = "No decoder process available";
+  decodeNext (call);
+}
+
+void Supervisor::decodeNext (DecodeCall *call)
+{
+  // a worker without room rejects the stream, the next one may still take it
+  while (call->next < call->candidates.size ())
+  {
+    Worker *worker = call->candidates[call->next++];
+
+    // it may have died while the previous one was asked
+    if (!worker->proxy)
+      continue;
+
+    call->worker = worker;
+    stream_decoder_call_decode_with_options (worker->proxy, call->stream_id, call->uri.c_str (), call->allowedSamplerates, call->options, NULL,
+                                             m_cancellable, (GAsyncReadyCallback) &Supervisor::onDecodeReply, call);
+    return;
+  }
+
+  failDecode (call, call->error);
+}
+
+void Supervisor::failDecode (DecodeCall *call, const string &reason)
+{
+  Tracer::alarm ("onDecode failed:", reason);
+
+  if (!call->stopped)
+    call->supervisor->m_decoding.erase (call->stream_id);
+
+  stream_decoder_emit_message_signal (STREAM_DECODER_DBUS_SERVICE (call->service), call->stream_id, "error", reason.c_str ());
+  g_dbus_method_invocation_return_dbus_error (call->invocation, "error", reason.c_str ());
+  delete call;
+}
+
+void Supervisor::onDecodeReply (GObject *source, GAsyncResult *result, DecodeCall *call)
+{
+  GVariant *handle = NULL;
+  GUnixFDList *fdList = NULL;
+  GError *error = NULL;
+
+  if (!stream_decoder_call_decode_with_options_finish (STREAM_DECODER (source), &handle, &fdList, result, &error))
+  {
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      // the Supervisor is gone
+      g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Decoder is shutting down");
+      g_error_free (error);
+      delete call;
+      return;
+    }
+
+    g_dbus_error_strip_remote_error (error);
+    Tracer::warning ("Supervisor: worker", call->worker->index, "rejected stream", call->stream_id);
+
+    call->error = error->message;
+    g_error_free (error);
+
+    if (call->stopped)
+    {
+      // nobody wants the stream anymore, no need to ask the other workers
+      g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Stream was stopped");
+      delete call;
+      return;
+    }
+
+    call->supervisor->decodeNext (call);
+    return;
+  }
+
+  gint32 fd = g_unix_fd_list_get (fdList, g_variant_get_handle (handle), &error);
+
+  g_variant_unref (handle);
+  g_object_unref (fdList);
+
+  if (fd < 0)
+  {
+    failDecode (call, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  Supervisor *pThis = call->supervisor;
+  Worker *worker = call->worker;
+
+  if (call->stopped)
+  {
+    Tracer::info ("Supervisor: stream", call->stream_id, "was stopped while worker", worker->index, "set it up");
+
+    // a newer Decode for the same stream on this worker has replaced it there already
+    Worker *successor = NULL;
+    auto pending = pThis->m_decoding.find (call->stream_id);
+    auto running = pThis->m_streams.find (call->stream_id);
+
+    if (pending != pThis->m_decoding.end ())
+      successor = pending->second->worker;
+    else if (running != pThis->m_streams.end ())
+      successor = running->second;
+
+    if (worker->proxy && successor != worker)
+      stream_decoder_call_stop (worker->proxy, call->stream_id, NULL, NULL, NULL);
+
+    close (fd);
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Stream was stopped");
+    delete call;
+    return;
+  }
+
+  pThis->m_decoding.erase (call->stream_id);
+
+  Tracer::info ("Supervisor: stream", call->stream_id, "decoded by worker", worker->index);
+
+  pThis->m_streams[call->stream_id] = worker;
+  pThis->m_pipes[call->stream_id] = fd;
+  worker->streams++;
+
+  // our copy stays open until the stream is stopped
+  GUnixFDList *replyFds = g_unix_fd_list_new ();
+  g_unix_fd_list_append (replyFds, fd, NULL);
+
+  if (call->withOptions)
+    stream_decoder_complete_decode_with_options (call->service, call->invocation, replyFds, g_variant_new_handle (0));
+  else
+    stream_decoder_complete_decode (call->service, call->invocation, replyFds, g_variant_new_handle (0));
+
+  g_object_unref (replyFds);
+  delete call;
+}
+
+void Supervisor::onStreamStatsReply (GObject *source, GAsyncResult *result, Call *call)
+{
+  GVariant *stats = NULL;
+
+  if (stream_decoder_call_get_stream_stats_finish (STREAM_DECODER (source), &stats, result, NULL))
+  {
+    stream_decoder_complete_get_stream_stats (call->service, call->invocation, stats);
+    g_variant_unref (stats);
+  }
+  else
+  {
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Unknown stream_id");
+  }
+
+  delete call;
+}
+
+void Supervisor::getStartupStats (StartupStatsCall *call)
+{
+  for (auto &worker : m_workers)
+  {
+    if (!worker->proxy)
+      continue;
+
+    call->pending++;
+    stream_decoder_call_get_startup_stats (worker->proxy, m_cancellable, (GAsyncReadyCallback) &Supervisor::onStartupStatsReply, call);
+  }
+
+  if (call->pending)
+    return;
+
+  stream_decoder_complete_get_startup_stats (call->service, call->invocation, buildStartupStats (call->merged));
+  delete call;
+}
+
+void Supervisor::onStartupStatsReply (GObject *source, GAsyncResult *result, StartupStatsCall *call)
+{
+  GVariant *stats = NULL;
+
+  if (stream_decoder_call_get_startup_stats_finish (STREAM_DECODER (source), &stats, result, NULL))
+  {
+    mergeStartupStats (call->merged, stats);
+    g_variant_unref (stats);
+  }
+
+  if (--call->pending > 0)
+    return;
+
+  stream_decoder_complete_get_startup_stats (call->service, call->invocation, buildStartupStats (call->merged));
+  delete call;
+}
+
+void Supervisor::mergeStartupStats (tStartupStats &merged, GVariant *stats)
+{
+  // histograms can't be merged from their percentiles, but the largest
+  // percentile of all workers is an upper bound for the combined one
+  GVariantIter phases;
+  const gchar *phase = NULL;
+  GVariant *values = NULL;
+
+  g_variant_iter_init (&phases, stats);
+
+  while (g_variant_iter_next (&phases, "{&sv}", &phase, &values))
+  {
+    GVariantIter iter;
+    const gchar *key = NULL;
+    GVariant *value = NULL;
+
+    g_variant_iter_init (&iter, values);
+
+    while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
+    {
+      GVariant *&entry = merged[phase][key];
+
+      if (!entry)
+      {
+        entry = value;
+        continue;
+      }
+
+      GVariant *combined = value;
+
+      if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+        combined = g_variant_ref_sink (g_variant_new_uint64 (g_variant_get_uint64 (entry) + g_variant_get_uint64 (value)));
+      else if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+        combined = g_variant_ref_sink (g_variant_new_int64 (MAX (g_variant_get_int64 (entry), g_variant_get_int64 (value))));
+      else
+        g_variant_ref (combined);
+
+      g_variant_unref (value);
+      g_variant_unref (entry);
+      entry = combined;
+    }
+
+    g_variant_unref (values);
+  }
+}
+
+GVariant *Supervisor::buildStartupStats (const tStartupStats &merged)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  for (auto &phase : merged)
+  {
+    GVariantBuilder values;
+    g_variant_builder_init (&values, G_VARIANT_TYPE_VARDICT);
+
+    for (auto &value : phase.second)
+      g_variant_builder_add (&values, "{sv}", value.first.c_str (), value.second);
+
+    g_variant_builder_add (&builder, "{sv}", phase.first.c_str (), g_variant_builder_end (&values));
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+void Supervisor::onSeekReply (GObject *source, GAsyncResult *result, Call *call)
+{
+  if (stream_decoder_call_seek_finish (STREAM_DECODER (source), result, NULL))
+    stream_decoder_complete_seek (call->service, call->invocation);
+  else
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Seek failed");
+
+  delete call;
+}
+
+void Supervisor::onPauseReply (GObject *source, GAsyncResult *result, Call *call)
+{
+  if (stream_decoder_call_pause_finish (STREAM_DECODER (source), result, NULL))
+    stream_decoder_complete_pause (call->service, call->invocation);
+  else
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Stream has no timeshift buffer");
+
+  delete call;
+}
+
+void Supervisor::onResumeReply (GObject *source, GAsyncResult *result, Call *call)
+{
+  if (stream_decoder_call_resume_finish (STREAM_DECODER (source), result, NULL))
+    stream_decoder_complete_resume (call->service, call->invocation);
+  else
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Stream has no timeshift buffer");
+
+  delete call;
+}
+
+void Supervisor::onRewindReply (GObject *source, GAsyncResult *result, Call *call)
+{
+  if (stream_decoder_call_rewind_finish (STREAM_DECODER (source), result, NULL))
+    stream_decoder_complete_rewind (call->service, call->invocation);
+  else
+    g_dbus_method_invocation_return_dbus_error (call->invocation, "error", "Stream has no timeshift buffer");
+
+  delete call;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "stream-decoder-dbus-service.h"
+#include "stream-decoder-gdbus.h"
+#include "HttpSession.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Supervisor serves the D-Bus interface in place of Pipelines and spreads
+ * the streams over worker processes, each pinned to a core and running its
+ * own main loop, Pipelines and WatchDog.
+ *
+ * Every worker serves the same interface peer-to-peer over a socketpair, so
+ * calls are forwarded unchanged and the renderer's pipe comes back through
+ * SCM_RIGHTS. A worker that dies takes only its own streams along, it is
+ * started again after a second.
+ */
+class Supervisor
+{
+  public:
+    Supervisor (StreamDecoderDBusService *service, int numWorkers, double cpuBudget);
+    virtual ~Supervisor ();
+
+    // the descriptor a worker finds its end of the socketpair at
+    static const int WORKER_FD = 3;
+
+  private:
+    struct Worker
+    {
+      Supervisor *supervisor;
+      int index;
+      int cpu;
+      GPid pid;
+      guint childWatch;
+      guint respawnSource;
+      GDBusConnection *connection;
+      StreamDecoder *proxy;
+      guint streams;
+      double cpuLoad;
+      HttpSession::Stats http;
+    };
+
+    // a call forwarded to the workers, completed from their replies
+    struct Call
+    {
+      Call (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation);
+      virtual ~Call ();
+
+      StreamDecoder *service;
+      GDBusMethodInvocation *invocation;
+    };
+
+    typedef map<string, map<string, GVariant *>> tStartupStats;
+
+    struct StartupStatsCall : public Call
+    {
+      StartupStatsCall (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation);
+      ~StartupStatsCall ();
+
+      guint pending = 0;
+      tStartupStats merged;
+    };
+
+    struct DecodeCall : public Call
+    {
+      DecodeCall (StreamDecoderDBusService *service, GDBusMethodInvocation *invocation);
+      ~DecodeCall ();
+
+      Supervisor *supervisor = NULL;
+      bool withOptions = false;
+      uint64_t stream_id = 0;
+      string uri;
+      GVariant *allowedSamplerates = NULL;
+      GVariant *options = NULL;
+      vector<Worker *> candidates;
+      size_t next = 0;
+      Worker *worker = NULL;
+      string error;
+
+      // a Stop or a newer Decode arrived before the worker answered
+      bool stopped = false;
+    };
+
+    void connect ();
+    void spawn (Worker *worker);
+    void release (Worker *worker);
+    vector<Worker *> getCandidates () const;
+    Worker *find (uint64_t stream_id) const;
+    void forget (uint64_t stream_id);
+
+    void decode (DecodeCall *call);
+    void decodeNext (DecodeCall *call);
+    void getStartupStats (StartupStatsCall *call);
+
+    static void reap (GPid pid);
+    static void mergeStartupStats (tStartupStats &merged, GVariant *stats);
+    static GVariant *buildStartupStats (const tStartupStats &merged);
+    static void failDecode (DecodeCall *call, const string &reason);
+
+    static void onChildSetup (gpointer data);
+    static void onConnected (GObject *source, GAsyncResult *result, Worker *worker);
+    static void onWorkerExited (GPid pid, gint status, Worker *worker);
+    static gboolean onRespawn (Worker *worker);
+    static void onWorkerMessage (StreamDecoder *proxy, const gchar *type, const gchar *content, guint64 stream_id, Worker *worker);
+    static void onLoadReply (GObject *source, GAsyncResult *result, shared_ptr<Worker> *reference);
+    static gboolean onLoadTimer (Supervisor *pThis);
+
+    // the replies may arrive after the Supervisor is gone, they only touch it unless cancelled
+    static void onDecodeReply (GObject *source, GAsyncResult *result, DecodeCall *call);
+    static void onStreamStatsReply (GObject *source, GAsyncResult *result, Call *call);
+    static void onStartupStatsReply (GObject *source, GAsyncResult *result, StartupStatsCall *call);
+    static void onSeekReply (GObject *source, GAsyncResult *result, Call *call);
+    static void onPauseReply (GObject *source, GAsyncResult *result, Call *call);
+    static void onResumeReply (GObject *source, GAsyncResult *result, Call *call);
+    static void onRewindReply (GObject *source, GAsyncResult *result, Call *call);
+
+    static gboolean onForward (Supervisor *pThis, GDBusMethodInvocation *invocation);
+    static void onStop (Supervisor *pThis, uint64_t stream_id);
+    static gchar ** getSupportedProtocols (Supervisor *pThis);
+    static void reset (Supervisor *pThis);
+    static GVariant *getLoad (Supervisor *pThis);
+
+    StreamDecoderDBusService *m_service;
+    double m_workerBudget;
+    HttpSession::Stats m_retiredHttp;
+    // shared with the load requests in flight
+    vector<shared_ptr<Worker>> m_workers;
+    map<uint64_t, Worker *> m_streams;
+
+    // Decode calls still waiting for a worker's answer
+    map<uint64_t, DecodeCall *> m_decoding;
+
+    // our copies of the renderers' pipes, closed with their streams
+    map<uint64_t, int> m_pipes;
+
+    guint m_loadTimer;
+
+    // cancels the calls still waiting for a worker when the Supervisor goes away
+    GCancellable *m_cancellable;
+};
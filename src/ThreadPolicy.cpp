@@ -0,0 +1,352 @@
+#include "ThreadPolicy.h"
+#include "Trace.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+namespace
+{
+  const int MIN_RT_PRIORITY = 1;
+  const int MAX_RT_PRIORITY = 99;
+  const int MIN_NICE = -20;
+  const int MAX_NICE = 19;
+
+  // every streaming thread tries the same, so only complain once about each
+  std::atomic<bool> s_affinityWarned (false);
+  std::atomic<bool> s_policyWarned (false);
+  std::atomic<bool> s_restoreWarned (false);
+
+  bool parseInt (const gchar *text, int minimum, int maximum, int &value)
+  {
+    gchar *end = NULL;
+    gint64 parsed = g_ascii_strtoll (text, &end, 10);
+
+    if (end == text || *end || parsed < minimum || parsed > maximum)
+      return false;
+
+    value = parsed;
+    return true;
+  }
+}
+
+bool ThreadPolicy::fromString (const gchar *spec, ThreadPolicy &policy)
+{
+  vector<Alternative> alternatives;
+  gchar **parts = g_strsplit (spec, ",", -1);
+  bool valid = parts[0] != NULL;
+
+  for (gchar **part = parts; valid && *part; part++)
+  {
+    gchar *name = g_strstrip (*part);
+    gchar *value = strchr (name, ':');
+
+    if (value)
+      *value++ = '\0';
+
+    Alternative alternative = { KIND_OTHER, 0 };
+
+    if (!strcmp (name, "other"))
+      valid = !value;
+    else if (!strcmp (name, "nice"))
+    {
+      alternative.kind = KIND_NICE;
+      valid = value && parseInt (value, MIN_NICE, MAX_NICE, alternative.priority);
+    }
+    else if (!strcmp (name, "fifo") || !strcmp (name, "rr"))
+    {
+      alternative.kind = strcmp (name, "fifo") ? KIND_RR : KIND_FIFO;
+      valid = value && parseInt (value, MIN_RT_PRIORITY, MAX_RT_PRIORITY, alternative.priority);
+    }
+    else
+      valid = false;
+
+    alternatives.push_back (alternative);
+  }
+
+  g_strfreev (parts);
+
+  if (valid)
+    policy.alternatives = alternatives;
+
+  return valid;
+}
+
+bool ThreadPolicy::parseCpus (const gchar *spec, ThreadPolicy &policy)
+{
+  vector<int> cpus;
+  gchar **ranges = g_strsplit (spec, ",", -1);
+  bool valid = ranges[0] != NULL;
+
+  for (gchar **range = ranges; valid && *range; range++)
+  {
+    gchar *first = g_strstrip (*range);
+    gchar *last = strchr (first, '-');
+
+    if (last)
+      *last++ = '\0';
+
+    int from = 0;
+    int to = 0;
+
+    valid = parseInt (first, 0, CPU_SETSIZE - 1, from) && parseInt (last ? last : first, from, CPU_SETSIZE - 1, to);
+
+    for (int cpu = from; valid && cpu <= to; cpu++)
+      cpus.push_back (cpu);
+  }
+
+  g_strfreev (ranges);
+
+  if (valid)
+    policy.cpus = cpus;
+
+  return valid;
+}
+
+ThreadPolicy &ThreadPolicy::getDefault ()
+{
+  static ThreadPolicy policy;
+  return policy;
+}
+
+bool ThreadPolicy::isEmpty () const
+{
+  return alternatives.empty () && cpus.empty ();
+}
+
+string ThreadPolicy::toString (const Alternative &alternative)
+{
+  switch (alternative.kind)
+  {
+    case KIND_NICE:
+      return "nice:" + to_string (alternative.priority);
+    case KIND_FIFO:
+      return "fifo:" + to_string (alternative.priority);
+    case KIND_RR:
+      return "rr:" + to_string (alternative.priority);
+    default:
+      return "other";
+  }
+}
+
+string ThreadPolicy::toString () const
+{
+  string result;
+
+  for (const Alternative &alternative : alternatives)
+    result += (result.empty () ? "" : ",") + toString (alternative);
+
+  return result;
+}
+
+bool ThreadPolicy::applyAlternative (const Alternative &alternative, int &error)
+{
+  struct sched_param param;
+  memset (&param, 0, sizeof (param));
+
+  switch (alternative.kind)
+  {
+    case KIND_FIFO:
+    case KIND_RR:
+      param.sched_priority = alternative.priority;
+      error = pthread_setschedparam (pthread_self (), alternative.kind == KIND_FIFO ? SCHED_FIFO : SCHED_RR, &param);
+      return !error;
+
+    case KIND_NICE:
+      error = pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+
+      // on Linux, the nice value of a thread id applies to that thread only
+      if (!error && setpriority (PRIO_PROCESS, getThreadId (), alternative.priority) < 0)
+        error = errno;
+
+      return !error;
+
+    default:
+      error = pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+      return !error;
+  }
+}
+
+string ThreadPolicy::apply () const
+{
+  if (!cpus.empty ())
+  {
+    cpu_set_t set;
+    CPU_ZERO (&set);
+
+    for (int cpu : cpus)
+      CPU_SET (cpu, &set);
+
+    int error = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+
+    if (error && !s_affinityWarned.exchange (true))
+      Tracer::warning ("ThreadPolicy: cannot restrict thread to cpus,", strerror (error));
+  }
+
+  for (const Alternative &alternative : alternatives)
+  {
+    int error = 0;
+
+    if (applyAlternative (alternative, error))
+      return toString (alternative);
+
+    // EPERM without CAP_SYS_NICE or a sufficient rlimit, fall back to the next one
+    if (!s_policyWarned.exchange (true))
+      Tracer::warning ("ThreadPolicy: cannot apply", toString (alternative), strerror (error), "- trying the next alternative");
+  }
+
+  return alternatives.empty () ? string () : "unchanged";
+}
+
+ThreadPolicy::Saved ThreadPolicy::save ()
+{
+  Saved saved;
+  memset (&saved, 0, sizeof (saved));
+
+  saved.valid = pthread_getschedparam (pthread_self (), &saved.policy, &saved.param) == 0;
+
+  // -1 is a valid nice value, so errno tells the failure apart
+  errno = 0;
+  saved.nice = getpriority (PRIO_PROCESS, getThreadId ());
+  saved.valid = saved.valid && !errno;
+
+  saved.cpusSaved = pthread_getaffinity_np (pthread_self (), sizeof (saved.cpus), &saved.cpus) == 0;
+  return saved;
+}
+
+void ThreadPolicy::restore (const Saved &saved)
+{
+  int error = 0;
+
+  if (saved.valid)
+  {
+    // leaving a real-time class is always allowed, the nice value only applies outside of it
+    error = pthread_setschedparam (pthread_self (), saved.policy, &saved.param);
+
+    if (!error && saved.policy != SCHED_FIFO && saved.policy != SCHED_RR && setpriority (PRIO_PROCESS, getThreadId (), saved.nice) < 0)
+      error = errno;
+  }
+
+  if (saved.cpusSaved)
+  {
+    int cpusError = pthread_setaffinity_np (pthread_self (), sizeof (saved.cpus), &saved.cpus);
+    error = error ? error : cpusError;
+  }
+
+  // e.g. lowering the nice value again without an RLIMIT_NICE
+  if (error && !s_restoreWarned.exchange (true))
+    Tracer::warning ("ThreadPolicy: cannot restore the scheduling of a pooled thread,", strerror (error));
+}
+
+pid_t ThreadPolicy::getThreadId ()
+{
+  return syscall (SYS_gettid);
+}
+
+bool ThreadPolicy::readSchedStat (pid_t tid, guint64 &runDelayNs, guint64 &timeslices)
+{
+  gchar *path = g_strdup_printf ("/proc/self/task/%d/schedstat", (int) tid);
+  gchar *contents = NULL;
+  bool found = g_file_get_contents (path, &contents, NULL, NULL);
+  g_free (path);
+
+  if (!found)
+    return false;
+
+  // time on the CPU, time waiting on a runqueue, number of timeslices
+  guint64 runNs = 0;
+  bool parsed = sscanf (contents, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &runNs, &runDelayNs, &timeslices) == 3;
+
+  g_free (contents);
+  return parsed;
+}
+
+static void test_fromString ()
+{
+  ThreadPolicy policy;
+
+  g_assert (ThreadPolicy::fromString ("fifo:40, nice:-10,other", policy));
+  g_assert_cmpuint (policy.alternatives.size (), ==, 3);
+  g_assert_cmpint (policy.alternatives[0].kind, ==, ThreadPolicy::KIND_FIFO);
+  g_assert_cmpint (policy.alternatives[0].priority, ==, 40);
+  g_assert_cmpint (policy.alternatives[1].kind, ==, ThreadPolicy::KIND_NICE);
+  g_assert_cmpint (policy.alternatives[1].priority, ==, -10);
+  g_assert (policy.toString () == "fifo:40,nice:-10,other");
+
+  // invalid specs leave the policy alone
+  g_assert (!ThreadPolicy::fromString ("rr:0", policy));
+  g_assert (!ThreadPolicy::fromString ("nice:-21", policy));
+  g_assert (!ThreadPolicy::fromString ("fifo", policy));
+  g_assert (!ThreadPolicy::fromString ("other:1", policy));
+  g_assert (!ThreadPolicy::fromString ("idle:1", policy));
+  g_assert (!ThreadPolicy::fromString ("", policy));
+  g_assert (policy.toString () == "fifo:40,nice:-10,other");
+}
+
+static void test_parseCpus ()
+{
+  ThreadPolicy policy;
+
+  g_assert (ThreadPolicy::parseCpus ("1,3-5", policy));
+  g_assert_cmpuint (policy.cpus.size (), ==, 4);
+  g_assert_cmpint (policy.cpus[0], ==, 1);
+  g_assert_cmpint (policy.cpus[3], ==, 5);
+
+  g_assert (!ThreadPolicy::parseCpus ("3-1", policy));
+  g_assert (!ThreadPolicy::parseCpus ("a", policy));
+  g_assert (!ThreadPolicy::parseCpus ("2-", policy));
+  g_assert_cmpuint (policy.cpus.size (), ==, 4);
+}
+
+static void test_restore ()
+{
+  // on a thread of its own, so the test runner keeps its scheduling
+  std::thread thread ([] ()
+  {
+    ThreadPolicy::Saved before = ThreadPolicy::save ();
+    g_assert (before.valid && before.cpusSaved);
+
+    int firstCpu = 0;
+
+    while (!CPU_ISSET (firstCpu, &before.cpus))
+      firstCpu++;
+
+    // raising the nice value and narrowing the CPU set need no privileges
+    ThreadPolicy policy;
+    g_assert (ThreadPolicy::fromString ("fifo:1,nice:5", policy));
+    policy.cpus.push_back (firstCpu);
+    policy.apply ();
+
+    ThreadPolicy::Saved applied = ThreadPolicy::save ();
+    g_assert_cmpint (CPU_COUNT (&applied.cpus), ==, 1);
+
+    ThreadPolicy::restore (before);
+
+    ThreadPolicy::Saved after = ThreadPolicy::save ();
+    g_assert_cmpint (after.policy, ==, before.policy);
+    g_assert_cmpint (after.param.sched_priority, ==, before.param.sched_priority);
+    g_assert (CPU_EQUAL (&after.cpus, &before.cpus));
+
+    // without an RLIMIT_NICE, the raised value can't be lowered again
+    struct rlimit limit;
+
+    if (after.nice != before.nice && getrlimit (RLIMIT_NICE, &limit) == 0 && 20 - (int) limit.rlim_cur > before.nice)
+      g_test_message ("no RLIMIT_NICE, nice value not restored");
+    else
+      g_assert_cmpint (after.nice, ==, before.nice);
+  });
+
+  thread.join ();
+}
+
+void ThreadPolicy::registerTests ()
+{
+  g_test_add_func ("/ThreadPolicy/fromString", test_fromString);
+  g_test_add_func ("/ThreadPolicy/parseCpus", test_parseCpus);
+  g_test_add_func ("/ThreadPolicy/restore", test_restore);
+}
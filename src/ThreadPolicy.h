@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glib.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * ThreadPolicy gives the threads on the audio path precedence over the rest
+ * of the box, so UI and indexing work can't starve the decoder.
+ *
+ * A policy is a list of alternatives tried in order, e.g. "fifo:40,nice:-10":
+ * real-time scheduling needs CAP_SYS_NICE or an RLIMIT_RTPRIO, a negative
+ * nice value an RLIMIT_NICE, and a thread that gets neither simply keeps
+ * running as SCHED_OTHER. Optionally the threads are restricted to a set of
+ * CPUs, given like "2-3" or "1,3".
+ */
+class ThreadPolicy
+{
+  public:
+    enum Kind
+    {
+      KIND_OTHER,
+      KIND_NICE,
+      KIND_FIFO,
+      KIND_RR
+    };
+
+    struct Alternative
+    {
+      Kind kind;
+      int priority;   // real-time priority for fifo and rr, the nice value for nice
+    };
+
+    // false if the string can't be parsed, policy is left untouched then
+    static bool fromString (const gchar *spec, ThreadPolicy &policy);
+    static bool parseCpus (const gchar *spec, ThreadPolicy &policy);
+
+    // used by the Pipelines' streaming threads and the output thread
+    static ThreadPolicy &getDefault ();
+
+    bool isEmpty () const;
+    string toString () const;
+
+    // on the calling thread, returns the alternative that took effect, e.g. "nice:-10"
+    string apply () const;
+
+    // the scheduling of the calling thread before apply (), for threads that go back to a pool
+    struct Saved
+    {
+      bool valid;
+      int policy;
+      struct sched_param param;
+      int nice;
+      bool cpusSaved;
+      cpu_set_t cpus;
+    };
+
+    static Saved save ();
+    static void restore (const Saved &saved);
+
+    // e.g. run_delay from /proc/self/task/<tid>/schedstat, false if the kernel has no schedstats
+    static bool readSchedStat (pid_t tid, guint64 &runDelayNs, guint64 &timeslices);
+    static pid_t getThreadId ();
+
+    static void registerTests ();
+
+    vector<Alternative> alternatives;
+
+    // empty keeps the inherited affinity
+    vector<int> cpus;
+
+  private:
+    static bool applyAlternative (const Alternative &alternative, int &error);
+    static string toString (const Alternative &alternative);
+};
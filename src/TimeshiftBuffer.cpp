@@ -0,0 +1,245 @@
+#include "TimeshiftBuffer.h"
+#include "Trace.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+namespace
+{
+  const gsize DRAIN_CHUNK_SIZE = 16 * 1024;
+}
+
+TimeshiftBuffer::TimeshiftBuffer (GOutputStream *output, gsize capacity, gsize frameSize, const string &directory) :
+    m_output (G_OUTPUT_STREAM (g_object_ref (output))),
+    m_cancellable (g_cancellable_new ()),
+    m_ring (NULL),
+    m_capacity (capacity - capacity % frameSize),
+    m_frameSize (frameSize)
+{
+  // a tmpfs would keep the pages in RAM after all
+  const gchar *parent = directory.empty () ? g_get_tmp_dir () : directory.c_str ();
+  gchar *path = g_build_filename (parent, "stream-decoder-timeshift-XXXXXX", NULL);
+  int fd = g_mkstemp (path);
+
+  if (fd < 0)
+  {
+    Tracer::warning ("TimeshiftBuffer: cannot create backing file in", string (parent) + ",", strerror (errno));
+    g_free (path);
+    return;
+  }
+
+  // nobody else needs the name, the mapping keeps the file alive
+  unlink (path);
+  g_free (path);
+
+  if (ftruncate (fd, m_capacity) == 0)
+  {
+    void *mapped = mmap (NULL, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapped != MAP_FAILED)
+      m_ring = (guint8 *) mapped;
+  }
+
+  if (!m_ring)
+    Tracer::warning ("TimeshiftBuffer: cannot map", m_capacity, "bytes,", strerror (errno));
+
+  close (fd);
+
+  if (m_ring)
+  {
+    m_thread = thread ([this] ()
+    {
+      drain ();
+    });
+  }
+}
+
+TimeshiftBuffer::~TimeshiftBuffer ()
+{
+  stop ();
+
+  if (m_thread.joinable ())
+    m_thread.join ();
+
+  if (m_ring)
+    munmap (m_ring, m_capacity);
+
+  g_object_unref (m_cancellable);
+  g_object_unref (m_output);
+}
+
+bool TimeshiftBuffer::isValid () const
+{
+  return m_ring != NULL;
+}
+
+void TimeshiftBuffer::write (const void *data, gsize size)
+{
+  const guint8 *bytes = (const guint8 *) data;
+  lock_guard<mutex> lock (m_mutex);
+
+  // only the last capacity bytes survive anyway
+  if (size > m_capacity)
+  {
+    m_writePos += size - m_capacity;
+    bytes += size - m_capacity;
+    size = m_capacity;
+  }
+
+  while (size > 0)
+  {
+    gsize index = m_writePos % m_capacity;
+    gsize chunk = MIN (size, m_capacity - index);
+
+    memcpy (m_ring + index, bytes, chunk);
+    m_writePos += chunk;
+    bytes += chunk;
+    size -= chunk;
+  }
+
+  guint64 oldest = getOldest ();
+
+  if (m_readPos < oldest)
+  {
+    // playback fell out of the window, skip ahead by whole frames
+    guint64 lost = oldest - m_readPos;
+    m_readPos += (lost + m_frameSize - 1) / m_frameSize * m_frameSize;
+    m_generation++;
+  }
+
+  m_canDrain.notify_one ();
+}
+
+void TimeshiftBuffer::pause ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_paused = true;
+}
+
+void TimeshiftBuffer::resume ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_paused = false;
+  m_canDrain.notify_one ();
+}
+
+gsize TimeshiftBuffer::rewind (gsize bytes)
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  guint64 possible = m_readPos - getOldest ();
+  guint64 rewound = MIN ((guint64) bytes, possible);
+  rewound -= rewound % m_frameSize;
+
+  // the drain thread's write in progress stays valid
+  if (rewound == 0)
+    return 0;
+
+  m_readPos -= rewound;
+  m_generation++;
+  m_canDrain.notify_one ();
+
+  return rewound;
+}
+
+void TimeshiftBuffer::finish ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_finished = true;
+  m_canDrain.notify_one ();
+}
+
+void TimeshiftBuffer::stop ()
+{
+  {
+    lock_guard<mutex> lock (m_mutex);
+    m_stopped = true;
+  }
+
+  g_cancellable_cancel (m_cancellable);
+  m_canDrain.notify_all ();
+}
+
+bool TimeshiftBuffer::isPaused () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_paused;
+}
+
+gsize TimeshiftBuffer::getBehind () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_writePos - m_readPos;
+}
+
+gsize TimeshiftBuffer::getAvailable () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_writePos - getOldest ();
+}
+
+guint64 TimeshiftBuffer::getOldest () const
+{
+  return m_writePos > m_capacity ? m_writePos - m_capacity : 0;
+}
+
+void TimeshiftBuffer::drain ()
+{
+  vector<guint8> chunk (DRAIN_CHUNK_SIZE);
+  unique_lock<mutex> lock (m_mutex);
+
+  while (true)
+  {
+    m_canDrain.wait (lock, [this] ()
+    {
+      return m_stopped || (!m_paused && m_readPos < m_writePos) || (m_finished && m_readPos == m_writePos);
+    });
+
+    if (m_stopped)
+      break;
+
+    if (m_readPos == m_writePos)
+    {
+      // finished and caught up with the live edge
+      g_output_stream_close (m_output, m_cancellable, NULL);
+      break;
+    }
+
+    // copy out under the lock, the writer may overwrite the ring meanwhile.
+    // Whole frames only, so a rewind or an overrun during the write resumes on a frame
+    // boundary; less than a frame is only left at the end of the stream
+    gsize index = m_readPos % m_capacity;
+    gsize size = MIN (m_writePos - m_readPos, (guint64) chunk.size ());
+
+    if (size >= m_frameSize)
+      size -= size % m_frameSize;
+
+    gsize first = MIN (size, m_capacity - index);
+
+    memcpy (chunk.data (), m_ring + index, first);
+    memcpy (chunk.data () + first, m_ring, size - first);
+    guint64 generation = m_generation;
+
+    lock.unlock ();
+
+    GError *error = NULL;
+    bool success = g_output_stream_write_all (m_output, chunk.data (), size, NULL, m_cancellable, &error);
+
+    lock.lock ();
+
+    if (!success)
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        Tracer::warning ("TimeshiftBuffer: write failed,", error->message);
+
+      g_error_free (error);
+      break;
+    }
+
+    // a rewind or an overrun moved the play position in the meantime
+    if (generation == m_generation)
+      m_readPos += size;
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+/**
+ * TimeshiftBuffer keeps the last minutes of a live stream in a ring that is
+ * mapped from an unlinked temporary file, so the pages are file-backed and
+ * memory stays constant however long the window is.
+ *
+ * The decoder writes at the live edge and never blocks; the oldest data is
+ * overwritten. A drain thread feeds the renderer from the play position,
+ * which stops while paused and can be moved back within the window.
+ * Positions are moved in multiples of the frame size only.
+ */
+class TimeshiftBuffer
+{
+  public:
+    // the backing file is created in directory, the temp directory if empty
+    TimeshiftBuffer (GOutputStream *output, gsize capacity, gsize frameSize, const string &directory);
+    virtual ~TimeshiftBuffer ();
+
+    // false if the backing file couldn't be mapped
+    bool isValid () const;
+
+    void write (const void *data, gsize size);
+
+    void pause ();
+    void resume ();
+
+    // moves the play position back, returns the number of bytes actually rewound
+    gsize rewind (gsize bytes);
+
+    // closes the output once the play position reaches the live edge
+    void finish ();
+    void stop ();
+
+    bool isPaused () const;
+    gsize getBehind () const;
+    gsize getAvailable () const;
+
+  private:
+    void drain ();
+    guint64 getOldest () const;
+
+    GOutputStream *m_output;
+    GCancellable *m_cancellable;
+
+    guint8 *m_ring;
+    gsize m_capacity;
+    gsize m_frameSize;
+
+    // absolute byte positions, the ring index is position % capacity
+    guint64 m_writePos = 0;
+    guint64 m_readPos = 0;
+    guint64 m_generation = 0;
+
+    bool m_paused = false;
+    bool m_finished = false;
+    bool m_stopped = false;
+
+    mutable mutex m_mutex;
+    condition_variable m_canDrain;
+    thread m_thread;
+};
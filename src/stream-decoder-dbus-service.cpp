@@ -7,6 +7,7 @@
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "memory.h"
 #include "stream-decoder-dbus-service.h"
@@ -19,6 +20,14 @@ enum
   SIGNAL_STOP,
   SIGNAL_GET_SUPPORTED_PROTOCOLS,
   SIGNAL_RESET,
+  SIGNAL_GET_STREAM_STATS,
+  SIGNAL_SEEK,
+  SIGNAL_PAUSE,
+  SIGNAL_RESUME,
+  SIGNAL_REWIND,
+  SIGNAL_GET_STARTUP_STATS,
+  SIGNAL_GET_LOAD,
+  SIGNAL_FORWARD,
   SIGNAL_LAST
 };
 
@@ -33,22 +42,65 @@ struct _StreamDecoderDBusService
 
     guint owner_id;
 
+    // peer-to-peer connections of co-located renderers, bypassing dbus-daemon
+    GDBusServer *server;
+    gchar *server_path;
+    GList *peers;
+
     //on_decode
     static gboolean on_decode (StreamDecoder *object, GDBusMethodInvocation *invocation, GUnixFDList *fd_list, uint64_t stream_id, const gchar *arg_uri,
                                GVariant *arg_allowed_samplerates);
 
+    static gboolean on_decode_with_options (StreamDecoder *object, GDBusMethodInvocation *invocation, GUnixFDList *fd_list, uint64_t stream_id,
+                                            const gchar *arg_uri, GVariant *arg_allowed_samplerates, GVariant *arg_options);
+
+    static gboolean forward (StreamDecoder *object, GDBusMethodInvocation *invocation);
+
+    static GUnixFDList *start_decoding (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, const gchar *uri,
+                                        GVariant *allowed_samplerates, GVariant *options);
+
     static gboolean on_stop (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data);
 
     static gboolean on_get_supported_protocols (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data);
 
     static gboolean on_reset (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data);
 
+    static gboolean on_get_stream_stats (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data);
+
+    static gboolean on_get_startup_stats (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data);
+
+    static gboolean on_get_load (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data);
+
+    static gboolean on_seek (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, guint64 position_ns, gpointer user_data);
+
+    static gboolean on_pause (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data);
+
+    static gboolean on_resume (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data);
+
+    static gboolean on_rewind (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, guint64 duration_ns, gpointer user_data);
+
     static void on_connection_closed (GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data);
+
+    static gboolean on_authorize_peer (GDBusAuthObserver *observer, GIOStream *stream, GCredentials *credentials, gpointer user_data);
+
+    static gboolean on_new_peer (GDBusServer *server, GDBusConnection *connection, gpointer user_data);
+
+    static void on_peer_closed (GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data);
 };
 
 static guint stream_decoder_signals[SIGNAL_LAST] =
 {0 };
 
+gboolean _StreamDecoderDBusService::forward (StreamDecoder *object, GDBusMethodInvocation *invocation)
+{
+  // a handler taking the invocation completes it later, e.g. once a worker process replied
+  gboolean forwarded = FALSE;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_FORWARD], 0, invocation, &forwarded);
+
+  return forwarded;
+}
+
 gboolean _StreamDecoderDBusService::on_decode (StreamDecoder *object,
     GDBusMethodInvocation *invocation,
     GUnixFDList *fd_list,
@@ -58,37 +110,84 @@ gboolean _StreamDecoderDBusService::on_decode (StreamDecoder *object,
 {
   Tracer::overdose( __PRETTY_FUNCTION__, "stream_id:", stream_id );
 
+  if (forward (object, invocation))
+    return true;
+
+  GVariant *options = g_variant_ref_sink (g_variant_new ("a{sv}", NULL));
+  GUnixFDList *local_fdlist = start_decoding (object, invocation, stream_id, uri, allowed_samplerates, options);
+  g_variant_unref (options);
+
+  if (!local_fdlist)
+    return false;
+
+  stream_decoder_complete_decode (object, invocation, local_fdlist, g_variant_new_handle (0));
+
+  g_object_unref (local_fdlist);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_decode_with_options (StreamDecoder *object,
+    GDBusMethodInvocation *invocation,
+    GUnixFDList *fd_list,
+    uint64_t stream_id,
+    const gchar *uri,
+    GVariant *allowed_samplerates,
+    GVariant *options)
+{
+  Tracer::overdose( __PRETTY_FUNCTION__, "stream_id:", stream_id );
+
+  if (forward (object, invocation))
+    return true;
+
+  GUnixFDList *local_fdlist = start_decoding (object, invocation, stream_id, uri, allowed_samplerates, options);
+
+  if (!local_fdlist)
+    return false;
+
+  stream_decoder_complete_decode_with_options (object, invocation, local_fdlist, g_variant_new_handle (0));
+
+  g_object_unref (local_fdlist);
+
+  return true;
+}
+
+GUnixFDList *_StreamDecoderDBusService::start_decoding (StreamDecoder *object,
+    GDBusMethodInvocation *invocation,
+    uint64_t stream_id,
+    const gchar *uri,
+    GVariant *allowed_samplerates,
+    GVariant *options)
+{
   if( 0 == stream_id )
   {
     Tracer::alarm("StreamDecoderDBusService::on_decode, stream_id == 0");
     stream_decoder_emit_message_signal (STREAM_DECODER_DBUS_SERVICE(object), stream_id, "error", "Wrong stream_id parameter");
     g_dbus_method_invocation_return_dbus_error (invocation, "error", "Wrong stream_id parameter");
-    return false;
+    return NULL;
   }
 
   gint32 pipe = 0;
   gboolean result = FALSE;
-  g_signal_emit (object, stream_decoder_signals[SIGNAL_DECODE], 0, stream_id, uri, allowed_samplerates, &pipe, &result );
+  GError* error = NULL;
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_DECODE], 0, stream_id, uri, allowed_samplerates, options, &pipe, &error, &result );
   if( FALSE == result )
   {
-    Tracer::alarm("onDecode failed");
-    stream_decoder_emit_message_signal (STREAM_DECODER_DBUS_SERVICE(object), stream_id, "error", "onDecode failed");
-    g_dbus_method_invocation_return_dbus_error (invocation, "error", "onDecode failed");
-    return false;
+    const gchar *reason = error ? error->message : "onDecode failed";
+    Tracer::alarm("onDecode failed:", reason);
+    stream_decoder_emit_message_signal (STREAM_DECODER_DBUS_SERVICE(object), stream_id, "error", reason);
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", reason);
+    g_clear_error (&error);
+    return NULL;
   }
 
-  GError* error = NULL;
   GUnixFDList *local_fdlist = g_unix_fd_list_new ();
   g_unix_fd_list_append (local_fdlist, pipe, &error);
   g_assert_no_error (error);
 
   Tracer::warning("_StreamDecoderDBusService::on_decode, stream_id:", stream_id, "pipe:", pipe );
 
-  stream_decoder_complete_decode (object, invocation, local_fdlist, g_variant_new_handle (0));
-
-  g_object_unref (local_fdlist);
-
-  return true;
+  return local_fdlist;
 }
 
 gboolean _StreamDecoderDBusService::on_stop (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data)
@@ -136,11 +235,207 @@ gboolean _StreamDecoderDBusService::on_reset(StreamDecoder* object, GDBusMethodI
   return true;
 }
 
+gboolean _StreamDecoderDBusService::on_get_stream_stats (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data)
+{
+  Tracer::overdose( __PRETTY_FUNCTION__, "stream_id:", stream_id );
+
+  if (forward (object, invocation))
+    return true;
+
+  GVariant *stats = NULL;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_GET_STREAM_STATS], 0, stream_id, &stats);
+
+  if (!stats)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "Unknown stream_id");
+    return true;
+  }
+
+  stream_decoder_complete_get_stream_stats (object, invocation, stats);
+  g_variant_unref (stats);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_get_startup_stats (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+  Tracer::overdose( __PRETTY_FUNCTION__ );
+
+  if (forward (object, invocation))
+    return true;
+
+  GVariant *stats = NULL;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_GET_STARTUP_STATS], 0, &stats);
+
+  if (!stats)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "No startup statistics");
+    return true;
+  }
+
+  stream_decoder_complete_get_startup_stats (object, invocation, stats);
+  g_variant_unref (stats);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_get_load (StreamDecoder *object, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+  Tracer::overdose( __PRETTY_FUNCTION__ );
+
+  GVariant *load = NULL;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_GET_LOAD], 0, &load);
+
+  if (!load)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "No load information");
+    return true;
+  }
+
+  stream_decoder_complete_get_load (object, invocation, load);
+  g_variant_unref (load);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_seek (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, guint64 position_ns, gpointer user_data)
+{
+  Tracer::info( __PRETTY_FUNCTION__, "stream_id:", stream_id, "position:", position_ns );
+
+  if (forward (object, invocation))
+    return true;
+
+  gboolean result = FALSE;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_SEEK], 0, stream_id, position_ns, &result);
+
+  if (!result)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "Seek failed");
+    return true;
+  }
+
+  stream_decoder_complete_seek (object, invocation);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_pause (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data)
+{
+  Tracer::info( __PRETTY_FUNCTION__, "stream_id:", stream_id );
+
+  if (forward (object, invocation))
+    return true;
+
+  gboolean result = FALSE;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_PAUSE], 0, stream_id, &result);
+
+  if (!result)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "Stream has no timeshift buffer");
+    return true;
+  }
+
+  stream_decoder_complete_pause (object, invocation);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_resume (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, gpointer user_data)
+{
+  Tracer::info( __PRETTY_FUNCTION__, "stream_id:", stream_id );
+
+  if (forward (object, invocation))
+    return true;
+
+  gboolean result = FALSE;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_RESUME], 0, stream_id, &result);
+
+  if (!result)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "Stream has no timeshift buffer");
+    return true;
+  }
+
+  stream_decoder_complete_resume (object, invocation);
+
+  return true;
+}
+
+gboolean _StreamDecoderDBusService::on_rewind (StreamDecoder *object, GDBusMethodInvocation *invocation, uint64_t stream_id, guint64 duration_ns, gpointer user_data)
+{
+  Tracer::info( __PRETTY_FUNCTION__, "stream_id:", stream_id, "duration:", duration_ns );
+
+  if (forward (object, invocation))
+    return true;
+
+  gboolean result = FALSE;
+
+  g_signal_emit (object, stream_decoder_signals[SIGNAL_REWIND], 0, stream_id, duration_ns, &result);
+
+  if (!result)
+  {
+    g_dbus_method_invocation_return_dbus_error (invocation, "error", "Stream has no timeshift buffer");
+    return true;
+  }
+
+  stream_decoder_complete_rewind (object, invocation);
+
+  return true;
+}
+
 void _StreamDecoderDBusService::on_connection_closed( GDBusConnection* connection, gboolean remote_peer_vanished, GError* error, gpointer user_data )
 {
   Tracer::overdose( __PRETTY_FUNCTION__ );
 }
 
+gboolean _StreamDecoderDBusService::on_authorize_peer (GDBusAuthObserver *observer, GIOStream *stream, GCredentials *credentials, gpointer user_data)
+{
+  // the session bus wouldn't let other users in either
+  GError *error = NULL;
+  uid_t uid = credentials ? g_credentials_get_unix_user (credentials, &error) : (uid_t) -1;
+
+  if (error)
+    g_error_free (error);
+
+  return uid == getuid ();
+}
+
+gboolean _StreamDecoderDBusService::on_new_peer (GDBusServer *server, GDBusConnection *connection, gpointer user_data)
+{
+  StreamDecoderDBusService *service = STREAM_DECODER_DBUS_SERVICE (user_data);
+  GError *error = NULL;
+
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service), connection, "/com/raumfeld/StreamDecoder", &error))
+  {
+    g_printerr ("->DBus: error exporting interface to peer: %s\n", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  service->peers = g_list_prepend (service->peers, g_object_ref (connection));
+  g_signal_connect (connection, "closed", G_CALLBACK (StreamDecoderDBusService::on_peer_closed), service);
+
+  Tracer::info ("->DBus: peer connected,", g_list_length (service->peers), "peers");
+  return TRUE;
+}
+
+void _StreamDecoderDBusService::on_peer_closed (GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data)
+{
+  StreamDecoderDBusService *service = STREAM_DECODER_DBUS_SERVICE (user_data);
+
+  g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (service), connection);
+  service->peers = g_list_remove (service->peers, connection);
+  g_object_unref (connection);
+
+  Tracer::info ("->DBus: peer disconnected,", g_list_length (service->peers), "peers");
+}
+
 static void stream_decoder_dbus_service_dispose (GObject *object);
 
 G_DEFINE_TYPE (StreamDecoderDBusService, stream_decoder_dbus_service, TYPE_STREAM_DECODER_SKELETON)
@@ -156,7 +451,7 @@ static void stream_decoder_dbus_service_class_init (StreamDecoderDBusServiceClas
                 GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
                 0, NULL, NULL,
                 NULL,
-                G_TYPE_BOOLEAN, 4, G_TYPE_UINT64, G_TYPE_STRING, G_TYPE_VARIANT, G_TYPE_POINTER);
+                G_TYPE_BOOLEAN, 6, G_TYPE_UINT64, G_TYPE_STRING, G_TYPE_VARIANT, G_TYPE_VARIANT, G_TYPE_POINTER, G_TYPE_POINTER);
 
   stream_decoder_signals[SIGNAL_STOP] =
   g_signal_new ("stop",
@@ -181,17 +476,92 @@ static void stream_decoder_dbus_service_class_init (StreamDecoderDBusServiceClas
                 0, NULL, NULL,
                 NULL,
                 G_TYPE_NONE, 0 );
+
+  stream_decoder_signals[SIGNAL_GET_STREAM_STATS] =
+  g_signal_new ("get-stream-stats",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_VARIANT, 1, G_TYPE_UINT64);
+
+  stream_decoder_signals[SIGNAL_SEEK] =
+  g_signal_new ("seek",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_BOOLEAN, 2, G_TYPE_UINT64, G_TYPE_UINT64);
+
+  stream_decoder_signals[SIGNAL_PAUSE] =
+  g_signal_new ("pause",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_BOOLEAN, 1, G_TYPE_UINT64);
+
+  stream_decoder_signals[SIGNAL_RESUME] =
+  g_signal_new ("resume",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_BOOLEAN, 1, G_TYPE_UINT64);
+
+  stream_decoder_signals[SIGNAL_REWIND] =
+  g_signal_new ("rewind",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_BOOLEAN, 2, G_TYPE_UINT64, G_TYPE_UINT64);
+
+  stream_decoder_signals[SIGNAL_GET_STARTUP_STATS] =
+  g_signal_new ("get-startup-stats",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_VARIANT, 0);
+
+  stream_decoder_signals[SIGNAL_GET_LOAD] =
+  g_signal_new ("get-load",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_VARIANT, 0);
+
+  stream_decoder_signals[SIGNAL_FORWARD] =
+  g_signal_new ("forward",
+                G_TYPE_FROM_CLASS (klass),
+                GSignalFlags (G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS),
+                0, NULL, NULL,
+                NULL,
+                G_TYPE_BOOLEAN, 1, G_TYPE_POINTER);
 }
 
-static void stream_decoder_dbus_service_bus_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+static void stream_decoder_dbus_service_connect_handlers (GDBusInterfaceSkeleton *skeleton, gpointer user_data)
 {
-  GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON (user_data);
-  GError *error = NULL;
-
   g_signal_connect (skeleton, "handle-decode", G_CALLBACK (StreamDecoderDBusService::on_decode), user_data);
+  g_signal_connect (skeleton, "handle-decode-with-options", G_CALLBACK (StreamDecoderDBusService::on_decode_with_options), user_data);
   g_signal_connect (skeleton, "handle-stop", G_CALLBACK (StreamDecoderDBusService::on_stop), user_data);
   g_signal_connect (skeleton, "handle-get-supported-protocols", G_CALLBACK (StreamDecoderDBusService::on_get_supported_protocols), user_data);
   g_signal_connect (skeleton, "handle-reset", G_CALLBACK (StreamDecoderDBusService::on_reset), user_data);
+  g_signal_connect (skeleton, "handle-get-stream-stats", G_CALLBACK (StreamDecoderDBusService::on_get_stream_stats), user_data);
+  g_signal_connect (skeleton, "handle-get-startup-stats", G_CALLBACK (StreamDecoderDBusService::on_get_startup_stats), user_data);
+  g_signal_connect (skeleton, "handle-get-load", G_CALLBACK (StreamDecoderDBusService::on_get_load), user_data);
+  g_signal_connect (skeleton, "handle-seek", G_CALLBACK (StreamDecoderDBusService::on_seek), user_data);
+  g_signal_connect (skeleton, "handle-pause", G_CALLBACK (StreamDecoderDBusService::on_pause), user_data);
+  g_signal_connect (skeleton, "handle-resume", G_CALLBACK (StreamDecoderDBusService::on_resume), user_data);
+  g_signal_connect (skeleton, "handle-rewind", G_CALLBACK (StreamDecoderDBusService::on_rewind), user_data);
+}
+
+static void stream_decoder_dbus_service_bus_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON (user_data);
+  GError *error = NULL;
 
   int ret = g_signal_connect( G_DBUS_CONNECTION(connection), "closed", G_CALLBACK (StreamDecoderDBusService::on_connection_closed), user_data);
   if( 0 >= ret ){
@@ -223,14 +593,42 @@ static void stream_decoder_dbus_service_name_lost (GDBusConnection *connection,
   g_printerr ("->DBus: lost bus name, this shouldn't happen\n");
 }
 
+static void stream_decoder_dbus_service_listen (StreamDecoderDBusService *service)
+{
+  service->server_path = g_build_filename (g_get_user_runtime_dir (), "com.raumfeld.StreamDecoder", NULL);
+
+  // a previous instance may have left its socket behind
+  unlink (service->server_path);
+
+  gchar *address = g_strdup_printf ("unix:path=%s", service->server_path);
+  gchar *guid = g_dbus_generate_guid ();
+  GDBusAuthObserver *observer = g_dbus_auth_observer_new ();
+  GError *error = NULL;
+
+  g_signal_connect (observer, "authorize-authenticated-peer", G_CALLBACK (StreamDecoderDBusService::on_authorize_peer), NULL);
+
+  service->server = g_dbus_server_new_sync (address, G_DBUS_SERVER_FLAGS_NONE, guid, observer, NULL, &error);
+
+  if (service->server)
+  {
+    g_signal_connect (service->server, "new-connection", G_CALLBACK (StreamDecoderDBusService::on_new_peer), service);
+    g_dbus_server_start (service->server);
+    g_print ("->DBus: listening for peers at %s\n", g_dbus_server_get_client_address (service->server));
+  }
+  else
+  {
+    g_printerr ("->DBus: cannot listen for peers at %s: %s\n", address, error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (observer);
+  g_free (guid);
+  g_free (address);
+}
+
 static void stream_decoder_dbus_service_init (StreamDecoderDBusService *service)
 {
-  service->owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, "com.raumfeld.StreamDecoder",
-                                      G_BUS_NAME_OWNER_FLAGS_NONE,
-                                      stream_decoder_dbus_service_bus_acquired,
-                                      stream_decoder_dbus_service_name_acquired,
-                                      stream_decoder_dbus_service_name_lost,
-                                      service, NULL);
+  stream_decoder_dbus_service_connect_handlers (G_DBUS_INTERFACE_SKELETON (service), service);
 }
 
 static void stream_decoder_dbus_service_dispose (GObject *object)
@@ -238,18 +636,35 @@ static void stream_decoder_dbus_service_dispose (GObject *object)
   Tracer::overdose( __PRETTY_FUNCTION__ );
 
   StreamDecoderDBusService *service = STREAM_DECODER_DBUS_SERVICE(object);
+  GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON (service);
+
+  if (g_dbus_interface_skeleton_get_connection (skeleton) != NULL)
+    g_dbus_interface_skeleton_unexport (skeleton);
 
   if (service->owner_id)
   {
-    GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON (service);
-
-    if (g_dbus_interface_skeleton_get_connection (skeleton) != NULL)
-      g_dbus_interface_skeleton_unexport (skeleton);
-
     g_bus_unown_name (service->owner_id);
     service->owner_id = 0;
   }
 
+  if (service->server)
+  {
+    g_dbus_server_stop (service->server);
+    g_clear_object (&service->server);
+    unlink (service->server_path);
+  }
+
+  g_clear_pointer (&service->server_path, g_free);
+
+  while (service->peers)
+  {
+    GDBusConnection *connection = G_DBUS_CONNECTION (service->peers->data);
+    g_signal_handlers_disconnect_by_data (connection, service);
+    g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+    service->peers = g_list_delete_link (service->peers, service->peers);
+  }
+
   G_OBJECT_CLASS (stream_decoder_dbus_service_parent_class)->dispose (object);
 
 }
@@ -258,6 +673,30 @@ StreamDecoderDBusService *stream_decoder_dbus_service_new ()
 {
   StreamDecoderDBusService *service = (StreamDecoderDBusService *) g_object_new (TYPE_STREAM_DECODER_DBUS_SERVICE, NULL);
 
+  stream_decoder_dbus_service_listen (service);
+
+  service->owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, "com.raumfeld.StreamDecoder",
+                                      G_BUS_NAME_OWNER_FLAGS_NONE,
+                                      stream_decoder_dbus_service_bus_acquired,
+                                      stream_decoder_dbus_service_name_acquired,
+                                      stream_decoder_dbus_service_name_lost,
+                                      service, NULL);
+
+  return service;
+}
+
+StreamDecoderDBusService *stream_decoder_dbus_service_new_for_peer (GDBusConnection *connection)
+{
+  StreamDecoderDBusService *service = (StreamDecoderDBusService *) g_object_new (TYPE_STREAM_DECODER_DBUS_SERVICE, NULL);
+  GError *error = NULL;
+
+  // a worker process serves its supervisor only, neither the bus nor other peers see it
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service), connection, "/com/raumfeld/StreamDecoder", &error))
+  {
+    g_printerr ("->DBus: error exporting interface to supervisor: %s\n", error->message);
+    g_error_free (error);
+  }
+
   return service;
 }
 
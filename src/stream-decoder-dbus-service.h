@@ -2,6 +2,7 @@
 #define __STREAM_DECODER_DBUS_SERVICE_H__
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <cstdint>
 
 #define TYPE_STREAM_DECODER_DBUS_SERVICE            (stream_decoder_dbus_service_get_type ())
@@ -19,6 +20,7 @@ typedef gint (*GET_SUPPORTED_PROTOCOLS_CALLBACK) (gchar** &protocols, gpointer c
 
 GType stream_decoder_dbus_service_get_type (void) G_GNUC_CONST;
 StreamDecoderDBusService *stream_decoder_dbus_service_new ();
+StreamDecoderDBusService *stream_decoder_dbus_service_new_for_peer (GDBusConnection *connection);
 void stream_decoder_emit_message_signal (StreamDecoderDBusService* object, uint64_t stream_id, const gchar* type, const gchar* str);
 
 #endif  /*  __STREAM_DECODER_DBUS_SERVICE_H__  */
@@ -51,7 +51,7 @@ extern "C"
 
       if (! s_resampler)
       {
-	s_resampler = new Resampler (srcSR, s_sampleRate);
+	s_resampler = Resampler::create (srcSR, s_sampleRate, 2);
 	g_print ("Created audio resampler (%d -> %u)\n", srcSR, s_sampleRate);
       }
 
@@ -1,13 +1,39 @@
 #include <glib.h>
+#include <gst/gst.h>
 
 #include "AudioConverter.h"
+#include "SampleRateChooser.h"
+#include "RawPcmFormat.h"
+#include "DownmixMatrix.h"
+#include "DriftController.h"
+#include "LoadScheduler.h"
+#include "PeriodAligner.h"
+#include "CaptureFile.h"
+#include "Histogram.h"
+#include "HttpSession.h"
+#include "ThreadPolicy.h"
+#include "DecodeOptions.h"
+#include "Resampler.h"
 
 int
 main (int argc, char *argv[])
 {
   g_test_init (&argc, &argv, NULL);
+  gst_init (&argc, &argv);
 
   AudioConverter::registerTests ();
+  SampleRateChooser::registerTests ();
+  RawPcmFormat::registerTests ();
+  DownmixMatrix::registerTests ();
+  DriftController::registerTests ();
+  LoadScheduler::registerTests ();
+  PeriodAligner::registerTests ();
+  CaptureFile::registerTests ();
+  Histogram::registerTests ();
+  HttpSession::registerTests ();
+  ThreadPolicy::registerTests ();
+  DecodeOptions::registerTests ();
+  Resampler::registerTests ();
 
   return g_test_run ();
 }